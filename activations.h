@@ -9,17 +9,39 @@
 # include <string>
 #include <stdexcept>
 
+# include "tensor.h"
+# include "activation_kernels.h"
+
 class Activation{
+    /*
+    Activations are applied in place on a whole batch by the vectorized kernels of activation_kernels.h,
+    and hold no state, so one activation object can be used by several threads at once.
+    Element-wise activations can also be fused in the GEMM epilogue of the layer (see get_kind).
+    */
     public:
-        virtual std::vector<float> call(std::vector<float>) = 0;
-        std::vector<float> get_gradients();
+        Activation(ActivationKind kind_, float parameter_ = 0.) : kind(kind_), parameter(parameter_) {};
+        virtual ~Activation() {};
+        // replaces "values" by their activation, and writes the derivative at "values" in "gradients";
+        // an empty "gradients" view (inference) skips the derivative
+        virtual void call(const TensorView values, const TensorView gradients) const;
+
+        ActivationKind get_kind() const;
+        float get_parameter() const;
     protected:
-        std::vector<float> gradients;
+        ActivationKind kind;
+        float parameter;
 };
 
-std::vector<float> Activation::get_gradients(){
-    std::vector<float> output(gradients);
-    return output;
+void Activation::call(const TensorView values, const TensorView gradients) const{
+    activation_kernel(kind, parameter, values, gradients);
+}
+
+ActivationKind Activation::get_kind() const{
+    return kind;
+}
+
+float Activation::get_parameter() const{
+    return parameter;
 }
 
 class IdentityActivation : public Activation{
@@ -27,129 +49,44 @@ class IdentityActivation : public Activation{
     Identity activation. Returns the input.
     */  
    public:
-    std::vector<float> call(std::vector<float>);   
+    IdentityActivation() : Activation(ActivationKind::identity) {};
 };
 
-std::vector<float> IdentityActivation::call(std::vector<float> input){
-    std::vector<float> output(input.begin(), input.end());
-
-    gradients.clear();
-    std::transform(input.begin(), input.end(), std::back_inserter(gradients), [](float x){return 1; });    
-
-    return output;
-}
-
 class LogisticActivation : public Activation{   
     /*
     Logistic activation function, also called sigmoid function.
-    Simple implementation that applies the function element wise to the input vector and compute gradient.
+    Applied element wise, the derivative s * (1 - s) is computed from the output.
     */  
     public:
-        std::vector<float> call(std::vector<float>);   
+        LogisticActivation() : Activation(ActivationKind::sigmoid) {};
 };
 
-std::vector<float> LogisticActivation::call(std::vector<float> input){
-    /*
-    Apply the logistic activation element wise to the input vector.
-    */
-    std::vector<float> output;
-
-    gradients.clear();
-    // Compute gradient in the forward pass (TODO option to not do that)
-    std::transform(input.begin(), input.end(), std::back_inserter(gradients), [](float x){return (1 / (1 + std::exp(-x))) * (1 - 1 / (1 + std::exp(-x))); });
-
-    // Compute output
-    std::transform(input.begin(), input.end(), std::back_inserter(output), [](float x){return 1 / (1 + std::exp(-x)); });
-
-    return output;
-}
-
 class ReLU : public Activation{   
     /*
-    ReLU activation function, also called sigmoid function.
-    Simple implementation that applies the function element wise to the input vector and compute gradient.
+    ReLU activation function (rectified linear unit), applied element wise.
     */  
     public:
-        std::vector<float> call(std::vector<float>);   
+        ReLU() : Activation(ActivationKind::relu) {};
 };
 
-std::vector<float> ReLU::call(std::vector<float> input){
-    /*
-    Apply the rectified linear unit activation element wise to the input vector.
-    */
-    std::vector<float> output;
-
-    gradients.clear();
-    // Compute gradient in the forward pass (TODO option to not do that)
-    std::transform(input.begin(), input.end(), std::back_inserter(gradients), [](float x){return x > 0 ? 1. : 0.; });
-
-    // Compute output
-    std::transform(input.begin(), input.end(), std::back_inserter(output), [](float x){return x > 0 ? x : 0.; });
-
-    return output;
-}
-
 class LeakyReLU : public Activation{   
     /*
-    LeakyReLU activation function, also called sigmoid function.
-    Simple implementation that applies the function element wise to the input vector and compute gradient.
+    LeakyReLU activation function, applied element wise: x if x > 0, leaky_parameter * x otherwise.
     */  
     public:
-        std::vector<float> call(std::vector<float>);   
-        LeakyReLU(float);
-    protected:
-        float leaky_parameter;
+        LeakyReLU(float leaky_parameter) : Activation(ActivationKind::leaky_relu, leaky_parameter) {};
 };
 
-LeakyReLU::LeakyReLU(float leaky_parameter_) : leaky_parameter(leaky_parameter_) {};
-
-std::vector<float> LeakyReLU::call(std::vector<float> input){
-    /*
-    Apply the leaky rectified linear unit activation element wise to the input vector.
-    TODO: configurable leaky parameter
-    */
-    std::vector<float> output;
-
-    gradients.clear();
-    // Compute gradient in the forward pass (TODO option to not do that)
-    std::transform(input.begin(), input.end(), std::back_inserter(gradients), [&](float x){return x > 0 ? 1. : leaky_parameter; });
-
-    // Compute output
-    std::transform(input.begin(), input.end(), std::back_inserter(output), [&](float x){return x > 0 ? x : leaky_parameter * x; });
-
-    return output;
-}
-
 class SoftmaxActivation : public Activation{
     /*
-    Softmax activation function.
+    Softmax activation function, applied to each row of the input.
+    I am not really computing the gradient, we use it with the cross entropy whose gradient already includes it:
+    the derivative is all ones, which gives the right size.
     */
     public:
-        std::vector<float> call(std::vector<float>);   
+        SoftmaxActivation() : Activation(ActivationKind::softmax) {};
 };
 
-std::vector<float> SoftmaxActivation::call(std::vector<float> input){
-
-    // we substract the max value in the input vector for computational stability
-    float max_input_val = *std::max_element(input.begin(), input.end());
-
-    std::vector<float> exp_input;
-
-    std::transform(input.begin(), input.end(), std::back_inserter(exp_input), [max_input_val](float x){return std::exp(x - max_input_val); });
-
-    float sum_exp_input = std::accumulate(exp_input.begin(), exp_input.end(), 0.);
-
-    std::vector<float> output;
-
-    std::transform(exp_input.begin(), exp_input.end(), std::back_inserter(output), [sum_exp_input](float x){return x / sum_exp_input; });
-
-    gradients.clear();
-    // I am not really computing the gradient, our gradient will be zero everywhere and we will use the cross entropy, but this will give the right size
-    std::transform(exp_input.begin(), exp_input.end(), std::back_inserter(gradients), [](float x){return 1; });
-
-    return output;
-}
-
 std::unique_ptr<Activation> activation_from_str(std::string name){
     if (name == "identity"){
         return std::make_unique<IdentityActivation>();
@@ -167,4 +104,23 @@ std::unique_ptr<Activation> activation_from_str(std::string name){
         return std::make_unique<LogisticActivation>();
     }
     throw std::invalid_argument("unknown activation function name");
+}
+
+// name accepted by activation_from_str for each kind
+std::string activation_name(ActivationKind kind){
+    switch (kind){
+        case ActivationKind::identity: return "identity";
+        case ActivationKind::relu: return "relu";
+        case ActivationKind::leaky_relu: return "leakyrelu";
+        case ActivationKind::sigmoid: return "sigmoid";
+        case ActivationKind::softmax: return "softmax";
+    }
+    throw std::invalid_argument("unknown activation kind");
+}
+
+std::unique_ptr<Activation> activation_from_kind(ActivationKind kind, float parameter){
+    if (kind == ActivationKind::leaky_relu){
+        return std::make_unique<LeakyReLU>(parameter);
+    }
+    return activation_from_str(activation_name(kind));
 }
\ No newline at end of file
@@ -0,0 +1,217 @@
+# pragma once
+
+# include <vector>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <exception>
+# include <stdexcept>
+# include <random>
+# include <numeric>
+# include <algorithm>
+# include <cstdint>
+# include <cstring>
+
+# include "tensor.h"
+
+struct Targets{
+    // expected outputs of a batch: dense rows (one-hot, probabilities, regression values) or integer class labels
+    ConstTensorView values;
+    ConstLabelView labels;
+
+    int rows() const { return labels.empty() ? values.rows() : labels.rows(); }
+    Targets slice_rows(int begin, int end) const;
+};
+
+Targets Targets::slice_rows(int begin, int end) const{
+    Targets output;
+    if (labels.empty()) {
+        output.values = values.slice_rows(begin, end);
+    }
+    else {
+        output.labels = labels.slice_rows(begin, end);
+    }
+    return output;
+}
+
+struct Batch{
+    // views used for training; they point either into the dataset (no shuffling) or into the storage below
+    ConstTensorView x;
+    Targets y;
+    int epoch;
+    int index;
+
+    Tensor x_storage;
+    Tensor values_storage;
+    LabelTensor labels_storage;
+};
+
+class BatchPipeline{
+    /*
+    Produces the mini-batches of several epochs on a background thread, one batch ahead of the consumer.
+    With shuffling, every epoch draws a new permutation of the samples and the rows of each batch are gathered
+    into one of two reusable buffers while the consumer trains on the other one.
+    Without shuffling, batches are views on the dataset and nothing is copied.
+    The sequence of batches only depends on the seed.
+    */
+    public:
+        BatchPipeline(const ConstTensorView x, const Targets& y, int batch_size, int epochs, bool shuffle, std::uint64_t seed = 0);
+        ~BatchPipeline();
+        BatchPipeline(const BatchPipeline&) = delete;
+        BatchPipeline& operator=(const BatchPipeline&) = delete;
+
+        // next batch, or nullptr after the last one; the returned batch stays valid until the following call
+        const Batch* next();
+
+    protected:
+        void produce();
+        void fill(Batch& batch, const std::vector<int>& permutation, int begin, int end);
+
+        ConstTensorView x;
+        Targets y;
+        int batch_size;
+        int epochs;
+        bool shuffle;
+        std::uint64_t seed;
+
+        Batch slots[2];
+        long produced;
+        long released;
+        bool holding;
+        bool finished;
+        bool stopping;
+        std::exception_ptr error;
+
+        std::mutex mutex;
+        std::condition_variable batch_ready;
+        std::condition_variable slot_free;
+        std::thread producer;
+};
+
+BatchPipeline::BatchPipeline(const ConstTensorView x_, const Targets& y_, int batch_size_, int epochs_, bool shuffle_, std::uint64_t seed_)
+    : x(x_), y(y_), batch_size(batch_size_), epochs(epochs_), shuffle(shuffle_), seed(seed_),
+      produced(0), released(0), holding(false), finished(false), stopping(false){
+    if (x.rows() != y.rows()) {
+        throw std::invalid_argument("BatchPipeline: x and y must have the same number of rows");
+    }
+    if (batch_size < 1) {
+        throw std::invalid_argument("BatchPipeline: the batch size must be positive");
+    }
+    if (shuffle) {
+        // buffers are allocated once for a full batch; the last, smaller batch of an epoch only resizes them down
+        for (Batch& slot : slots) {
+            slot.x_storage.resize(batch_size, x.cols());
+            if (y.labels.empty()) {
+                slot.values_storage.resize(batch_size, y.values.cols());
+            }
+            else {
+                slot.labels_storage.resize(batch_size, 1);
+            }
+        }
+    }
+    producer = std::thread(&BatchPipeline::produce, this);
+}
+
+BatchPipeline::~BatchPipeline(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    slot_free.notify_one();
+    producer.join();
+}
+
+const Batch* BatchPipeline::next(){
+    std::unique_lock<std::mutex> lock(mutex);
+    if (holding) {
+        holding = false;
+        ++released;
+        slot_free.notify_one();
+    }
+    batch_ready.wait(lock, [&]{ return produced > released || finished; });
+    if (produced == released) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return nullptr;
+    }
+    holding = true;
+    return &slots[released % 2];
+}
+
+void BatchPipeline::fill(Batch& batch, const std::vector<int>& permutation, int begin, int end){
+    if (!shuffle) {
+        batch.x = x.slice_rows(begin, end);
+        batch.y = y.slice_rows(begin, end);
+        return;
+    }
+
+    const int rows = end - begin;
+    batch.x_storage.resize(rows, x.cols());
+    for (int r = 0; r < rows; ++r) {
+        std::memcpy(batch.x_storage.view().row_data(r), x.row_data(permutation[begin + r]), x.cols() * sizeof(float));
+    }
+    batch.x = batch.x_storage;
+
+    batch.y = Targets();
+    if (y.labels.empty()) {
+        batch.values_storage.resize(rows, y.values.cols());
+        for (int r = 0; r < rows; ++r) {
+            std::memcpy(batch.values_storage.view().row_data(r), y.values.row_data(permutation[begin + r]), y.values.cols() * sizeof(float));
+        }
+        batch.y.values = batch.values_storage;
+    }
+    else {
+        batch.labels_storage.resize(rows, 1);
+        for (int r = 0; r < rows; ++r) {
+            batch.labels_storage(r, 0) = y.labels(permutation[begin + r], 0);
+        }
+        batch.y.labels = batch.labels_storage;
+    }
+}
+
+void BatchPipeline::produce(){
+    try {
+        const int num_samples = x.rows();
+        std::vector<int> permutation(num_samples);
+        std::mt19937_64 generator(seed);
+
+        for (int epoch = 0; epoch < epochs; ++epoch) {
+            if (shuffle) {
+                std::iota(permutation.begin(), permutation.end(), 0);
+                std::shuffle(permutation.begin(), permutation.end(), generator);
+            }
+            for (int begin = 0, index = 0; begin < num_samples; begin += batch_size, ++index) {
+                Batch* batch;
+                {
+                    // at most two batches in flight: the one being trained on and the one being filled
+                    std::unique_lock<std::mutex> lock(mutex);
+                    slot_free.wait(lock, [&]{ return produced - released < 2 || stopping; });
+                    if (stopping) {
+                        return;
+                    }
+                    batch = &slots[produced % 2];
+                }
+
+                fill(*batch, permutation, begin, std::min(begin + batch_size, num_samples));
+                batch->epoch = epoch;
+                batch->index = index;
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    ++produced;
+                }
+                batch_ready.notify_one();
+            }
+        }
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(mutex);
+        error = std::current_exception();
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+    batch_ready.notify_one();
+}
@@ -0,0 +1,151 @@
+# pragma once
+
+# include <cstdint>
+# include <cstring>
+# include <cstddef>
+# include <immintrin.h>
+
+# include "tensor.h"
+# include "cpu_dispatch.h"
+
+/*
+bfloat16: the upper 16 bits of an IEEE float32 (same exponent range, 8 bits of mantissa).
+Used to halve the bytes of weights streamed by the GEMMs, while the optimizer keeps updating fp32 master copies.
+float -> bf16 rounds to nearest even (vcvtneps2bf16 with AVX512-BF16, integer emulation otherwise);
+bf16 -> float is exact and is a 16 bits shift.
+The instruction treats denormal inputs as zero where the emulation rounds them; no other value differs.
+*/
+
+struct bfloat16{
+    std::uint16_t bits;
+};
+
+enum class Precision{
+    fp32,  // weights used as stored
+    bf16   // GEMMs read a bf16 copy of the weights, refreshed from the fp32 master after each update
+};
+
+using BF16Tensor = BasicTensor<bfloat16>;
+using BF16TensorView = BasicTensorView<bfloat16>;
+using ConstBF16TensorView = BasicTensorView<const bfloat16>;
+
+bfloat16 float_to_bf16(float value){
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    if ((bits & 0x7fffffffu) > 0x7f800000u){
+        // NaN: keep it a (quiet) NaN instead of rounding it to infinity
+        return bfloat16{static_cast<std::uint16_t>((bits >> 16) | 0x40)};
+    }
+    bits += 0x7fffu + ((bits >> 16) & 1u);
+    return bfloat16{static_cast<std::uint16_t>(bits >> 16)};
+}
+
+float bf16_to_float(bfloat16 value){
+    const std::uint32_t bits = static_cast<std::uint32_t>(value.bits) << 16;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+// ----- bulk conversions -----
+
+__attribute__((target("avx512f,avx512bw,avx512bf16")))
+void convert_to_bf16_avx512bf16(const float* source, bfloat16* destination, std::size_t n){
+    std::size_t i = 0;
+    for (; i + 32 <= n; i += 32){
+        // the second operand fills the low half of the result
+        const __m512bh converted = _mm512_cvtne2ps_pbh(_mm512_loadu_ps(source + i + 16), _mm512_loadu_ps(source + i));
+        _mm512_storeu_si512(destination + i, reinterpret_cast<const __m512i&>(converted));
+    }
+    for (; i < n; ++i){
+        destination[i] = float_to_bf16(source[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+void convert_to_bf16_avx2(const float* source, bfloat16* destination, std::size_t n){
+    // round to nearest even on the integer representation, NaNs are left to the scalar tail rules
+    const __m256i one = _mm256_set1_epi32(1);
+    const __m256i bias = _mm256_set1_epi32(0x7fff);
+    const __m256i quiet = _mm256_set1_epi32(0x00400000);
+    const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff);
+    const __m256i infinity = _mm256_set1_epi32(0x7f800000);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m256i halves[2];
+        for (int h = 0; h < 2; ++h){
+            const __m256i bits = _mm256_castps_si256(_mm256_loadu_ps(source + i + 8 * h));
+            const __m256i rounded = _mm256_add_epi32(bits, _mm256_add_epi32(bias, _mm256_and_si256(_mm256_srli_epi32(bits, 16), one)));
+            const __m256i is_nan = _mm256_cmpgt_epi32(_mm256_and_si256(bits, abs_mask), infinity);
+            halves[h] = _mm256_srli_epi32(_mm256_blendv_epi8(rounded, _mm256_or_si256(bits, quiet), is_nan), 16);
+        }
+        // packus works per 128 bits lane, the permute puts the 16 values back in order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(halves[0], halves[1]), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), packed);
+    }
+    for (; i < n; ++i){
+        destination[i] = float_to_bf16(source[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+void convert_from_bf16_avx2(const bfloat16* source, float* destination, std::size_t n){
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        const __m256i widened = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), _mm256_slli_epi32(widened, 16));
+    }
+    for (; i < n; ++i){
+        destination[i] = bf16_to_float(source[i]);
+    }
+}
+
+__attribute__((target("avx512f")))
+void convert_from_bf16_avx512(const bfloat16* source, float* destination, std::size_t n){
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        const __m512i widened = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i)));
+        _mm512_storeu_si512(destination + i, _mm512_slli_epi32(widened, 16));
+    }
+    for (; i < n; ++i){
+        destination[i] = bf16_to_float(source[i]);
+    }
+}
+
+void convert_to_bf16(const float* source, bfloat16* destination, std::size_t n){
+    if (has_avx512_bf16()){
+        convert_to_bf16_avx512bf16(source, destination, n);
+    }
+    else if (active_isa() != Isa::scalar){
+        convert_to_bf16_avx2(source, destination, n);
+    }
+    else {
+        for (std::size_t i = 0; i < n; ++i){
+            destination[i] = float_to_bf16(source[i]);
+        }
+    }
+}
+
+void convert_from_bf16(const bfloat16* source, float* destination, std::size_t n){
+    if (active_isa() == Isa::avx512){
+        convert_from_bf16_avx512(source, destination, n);
+    }
+    else if (active_isa() == Isa::avx2){
+        convert_from_bf16_avx2(source, destination, n);
+    }
+    else {
+        for (std::size_t i = 0; i < n; ++i){
+            destination[i] = bf16_to_float(source[i]);
+        }
+    }
+}
+
+// rounds "source" into "destination" (same shape)
+void convert_to_bf16(const ConstTensorView source, const BF16TensorView destination){
+    if (source.rows() != destination.rows() || source.cols() != destination.cols()){
+        throw std::invalid_argument("convert_to_bf16: shapes do not match");
+    }
+    for (int r = 0; r < source.rows(); ++r){
+        convert_to_bf16(source.row_data(r), destination.row_data(r), source.cols());
+    }
+}
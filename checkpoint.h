@@ -0,0 +1,259 @@
+# pragma once
+
+# include <string>
+# include <vector>
+# include <memory>
+# include <cstdio>
+# include <cstdint>
+# include <cstring>
+# include <cerrno>
+# include <sstream>
+# include <iomanip>
+# include <algorithm>
+# include <stdexcept>
+
+# include "tensor.h"
+# include "mapped_file.h"
+# include "activations.h"
+# include "optimizers.h"
+# include "fullyconnected_layer.h"
+# include "model.h"
+
+/*
+Checkpoint format, version 1:
+    header (64 bytes)  magic, version, number of tensors, offsets and sizes of the two blocks below
+    metadata           text, one record per line:
+                           optimizer <name> <learning rate> <loss name> <n> <n hyperparameters>
+                           layer fully_connected <input dim> <output dim> <use bias> <activation> <activation parameter>
+                           state <layer> <parameter> <step> <first tensor> <number of buffers>
+    tensor table       one {offset, rows, cols} entry per tensor
+    tensors            float32 row-major blobs, each on a 64 bytes boundary
+Tensors are the parameters of every layer, in layer and parameters() order, then the optimizer state buffers
+listed by the state records. Floats in the metadata are written with enough digits to round-trip exactly.
+*/
+
+struct CheckpointHeader{
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t num_tensors;
+    std::uint64_t metadata_offset;
+    std::uint64_t metadata_size;
+    std::uint64_t table_offset;
+    std::uint64_t reserved[3];
+};
+
+struct CheckpointTensor{
+    std::uint64_t offset;
+    std::int32_t rows;
+    std::int32_t cols;
+};
+
+static_assert(sizeof(CheckpointHeader) == 64, "the checkpoint header is 64 bytes on disk");
+static_assert(sizeof(CheckpointTensor) == 16, "checkpoint table entries are 16 bytes on disk");
+
+const char CHECKPOINT_MAGIC[8] = {'C', 'N', 'N', 'C', 'K', 'P', 'T', '\0'};
+const std::uint32_t CHECKPOINT_VERSION = 1;
+const std::uint64_t CHECKPOINT_ALIGNMENT = 64;
+
+enum class CheckpointLoading{
+    copy,  // tensors are read into memory owned by the model
+    map    // tensors stay in a private mapping of the file: processes loading the same checkpoint share its pages
+           // until they write to them (inference never does), and loading costs no copy
+};
+
+std::uint64_t checkpoint_align(std::uint64_t offset){
+    return (offset + CHECKPOINT_ALIGNMENT - 1) / CHECKPOINT_ALIGNMENT * CHECKPOINT_ALIGNMENT;
+}
+
+void save_checkpoint(Model& model, const std::string& path){
+    std::ostringstream metadata;
+    metadata << std::setprecision(9);
+    std::vector<ConstTensorView> tensors;
+
+    Optimizer& optimizer = model.get_optimizer();
+    const std::vector<float> hyperparameters = optimizer.get_hyperparameters();
+    metadata << "optimizer " << optimizer.get_name() << " " << optimizer.get_learning_rate() << " " << optimizer.get_loss_name() << " " << hyperparameters.size();
+    for (float hyperparameter : hyperparameters) {
+        metadata << " " << hyperparameter;
+    }
+    metadata << "\n";
+
+    const std::vector<Layer*>& layers = model.get_layers();
+    for (Layer* layer : layers) {
+        FullyConnectedLayer* fully_connected = dynamic_cast<FullyConnectedLayer*>(layer);
+        if (!fully_connected) {
+            throw std::invalid_argument("save_checkpoint: only fully connected layers can be saved");
+        }
+        const Activation& activation = fully_connected->get_activation();
+        metadata << "layer fully_connected " << layer->input_dim << " " << layer->output_dim << " " << fully_connected->has_bias()
+                 << " " << activation_name(activation.get_kind()) << " " << activation.get_parameter() << "\n";
+        for (TensorView parameter : layer->parameters()) {
+            tensors.push_back(parameter);
+        }
+    }
+
+    for (int l = 0; l < layers.size(); ++l) {
+        std::vector<TensorView> parameters = layers[l]->parameters();
+        for (int p = 0; p < parameters.size(); ++p) {
+            const Optimizer::ParameterState* state = optimizer.find_state(parameters[p]);
+            if (!state || state->buffers.empty()) {
+                continue;
+            }
+            metadata << "state " << l << " " << p << " " << state->step << " " << tensors.size() << " " << state->buffers.size() << "\n";
+            for (const Tensor& buffer : state->buffers) {
+                tensors.push_back(buffer);
+            }
+        }
+    }
+
+    const std::string metadata_text = metadata.str();
+    CheckpointHeader header{};
+    std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    header.version = CHECKPOINT_VERSION;
+    header.num_tensors = tensors.size();
+    header.metadata_offset = sizeof(CheckpointHeader);
+    header.metadata_size = metadata_text.size();
+    header.table_offset = checkpoint_align(header.metadata_offset + header.metadata_size);
+
+    std::vector<CheckpointTensor> table;
+    std::uint64_t offset = checkpoint_align(header.table_offset + tensors.size() * sizeof(CheckpointTensor));
+    for (const ConstTensorView& tensor : tensors) {
+        table.push_back({offset, tensor.rows(), tensor.cols()});
+        offset = checkpoint_align(offset + tensor.size() * sizeof(float));
+    }
+
+    // written next to the destination and renamed, so a crash never leaves a truncated checkpoint behind
+    const std::string temporary_path = path + ".tmp";
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(temporary_path.c_str(), "wb"), &std::fclose);
+    if (!file) {
+        throw std::runtime_error("save_checkpoint: cannot open " + temporary_path + ": " + std::strerror(errno));
+    }
+    std::uint64_t position = 0;
+    auto write = [&](const void* data, std::size_t bytes){
+        if (bytes > 0 && std::fwrite(data, 1, bytes, file.get()) != bytes) {
+            throw std::runtime_error("save_checkpoint: cannot write " + temporary_path + ": " + std::strerror(errno));
+        }
+        position += bytes;
+    };
+    auto pad_to = [&](std::uint64_t target){
+        static const char zeros[CHECKPOINT_ALIGNMENT] = {};
+        write(zeros, target - position);
+    };
+
+    write(&header, sizeof(CheckpointHeader));
+    write(metadata_text.data(), metadata_text.size());
+    pad_to(header.table_offset);
+    write(table.data(), table.size() * sizeof(CheckpointTensor));
+    for (int t = 0; t < tensors.size(); ++t) {
+        pad_to(table[t].offset);
+        for (int r = 0; r < tensors[t].rows(); ++r) {
+            write(tensors[t].row_data(r), tensors[t].cols() * sizeof(float));
+        }
+    }
+    if (std::fflush(file.get()) != 0 || std::fclose(file.release()) != 0) {
+        throw std::runtime_error("save_checkpoint: cannot write " + temporary_path + ": " + std::strerror(errno));
+    }
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+        throw std::runtime_error("save_checkpoint: cannot rename " + temporary_path + " to " + path + ": " + std::strerror(errno));
+    }
+}
+
+Model load_checkpoint(const std::string& path, CheckpointLoading loading = CheckpointLoading::map){
+    auto mapping = std::make_shared<MappedFile>(path, true);
+    const MappedFile& file = *mapping;
+
+    CheckpointHeader header;
+    if (file.size() < sizeof(CheckpointHeader)) {
+        throw std::runtime_error("load_checkpoint: " + path + " is too small to be a checkpoint");
+    }
+    std::memcpy(&header, file.data(), sizeof(CheckpointHeader));
+    if (std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0) {
+        throw std::runtime_error("load_checkpoint: " + path + " is not a checkpoint");
+    }
+    if (header.version != CHECKPOINT_VERSION) {
+        throw std::runtime_error("load_checkpoint: unsupported version " + std::to_string(header.version) + " in " + path);
+    }
+    if (header.metadata_offset + header.metadata_size > file.size() || header.table_offset + header.num_tensors * sizeof(CheckpointTensor) > file.size()) {
+        throw std::runtime_error("load_checkpoint: " + path + " is truncated");
+    }
+
+    std::vector<CheckpointTensor> table(header.num_tensors);
+    std::memcpy(table.data(), file.data() + header.table_offset, table.size() * sizeof(CheckpointTensor));
+    auto tensor = [&](int index, int rows, int cols){
+        if (index < 0 || index >= table.size() || table[index].rows != rows || table[index].cols != cols) {
+            throw std::runtime_error("load_checkpoint: tensor " + std::to_string(index) + " missing or of the wrong shape in " + path);
+        }
+        const CheckpointTensor& entry = table[index];
+        if (entry.offset % CHECKPOINT_ALIGNMENT != 0 || entry.offset + static_cast<std::uint64_t>(rows) * cols * sizeof(float) > file.size()) {
+            throw std::runtime_error("load_checkpoint: " + path + " is truncated");
+        }
+        TensorView stored(reinterpret_cast<float*>(file.writable_data() + entry.offset), rows, cols);
+        return loading == CheckpointLoading::map ? Tensor::borrow(stored, mapping) : Tensor(ConstTensorView(stored));
+    };
+
+    std::istringstream metadata(std::string(reinterpret_cast<const char*>(file.data() + header.metadata_offset), header.metadata_size));
+    std::unique_ptr<Optimizer> optimizer;
+    std::vector<std::unique_ptr<Layer>> layers;
+    int next_tensor = 0;
+    std::string line;
+    while (std::getline(metadata, line)) {
+        std::istringstream record(line);
+        std::string kind;
+        record >> kind;
+        if (kind == "optimizer") {
+            std::string name, loss_name;
+            float learning_rate;
+            int num_hyperparameters;
+            record >> name >> learning_rate >> loss_name >> num_hyperparameters;
+            std::vector<float> hyperparameters(std::max(num_hyperparameters, 0));
+            for (float& hyperparameter : hyperparameters) {
+                record >> hyperparameter;
+            }
+            if (!record) {
+                throw std::runtime_error("load_checkpoint: invalid optimizer record in " + path);
+            }
+            optimizer = optimizer_from_config(name, learning_rate, loss_name, hyperparameters);
+        }
+        else if (kind == "layer") {
+            std::string type, activation;
+            int input_dim, output_dim;
+            bool use_bias;
+            float activation_parameter;
+            record >> type >> input_dim >> output_dim >> use_bias >> activation >> activation_parameter;
+            if (!record || type != "fully_connected") {
+                throw std::runtime_error("load_checkpoint: invalid layer record in " + path);
+            }
+            Tensor weights = tensor(next_tensor++, input_dim, output_dim);
+            Tensor bias = use_bias ? tensor(next_tensor++, 1, output_dim) : Tensor();
+            std::unique_ptr<Activation> layer_activation = activation_from_kind(activation_from_str(activation)->get_kind(), activation_parameter);
+            layers.push_back(std::make_unique<FullyConnectedLayer>(std::move(weights), std::move(bias), std::move(layer_activation)));
+        }
+        else if (kind == "state") {
+            int layer, parameter, first_tensor, num_buffers;
+            long step;
+            record >> layer >> parameter >> step >> first_tensor >> num_buffers;
+            if (!record || !optimizer || layer < 0 || layer >= layers.size()) {
+                throw std::runtime_error("load_checkpoint: invalid state record in " + path);
+            }
+            std::vector<TensorView> parameters = layers[layer]->parameters();
+            if (parameter < 0 || parameter >= parameters.size()) {
+                throw std::runtime_error("load_checkpoint: invalid state record in " + path);
+            }
+            Optimizer::ParameterState state;
+            state.step = step;
+            for (int b = 0; b < num_buffers; ++b) {
+                state.buffers.push_back(tensor(first_tensor + b, parameters[parameter].rows(), parameters[parameter].cols()));
+            }
+            // set before the model registers its parameters, so no zero state is allocated for nothing
+            optimizer->set_state(parameters[parameter], std::move(state));
+        }
+        else if (!kind.empty()) {
+            throw std::runtime_error("load_checkpoint: unknown record \"" + kind + "\" in " + path);
+        }
+    }
+    if (!optimizer) {
+        throw std::runtime_error("load_checkpoint: no optimizer record in " + path);
+    }
+
+    return Model(std::move(layers), std::move(optimizer));
+}
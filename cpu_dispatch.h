@@ -0,0 +1,64 @@
+# pragma once
+
+# include <string>
+# include <cstdlib>
+
+/*
+Instruction set selection shared by every SIMD kernel (GEMM, optimizers, ...).
+Detected once from cpuid; the CLASSIF_NN_ISA environment variable ("scalar", "avx2", "avx512")
+can force a narrower instruction set, e.g. to compare kernels on the same machine.
+*/
+
+enum class Isa{
+    scalar,
+    avx2,
+    avx512
+};
+
+Isa detect_isa(){
+    __builtin_cpu_init();
+    const bool has_avx512 = __builtin_cpu_supports("avx512f");
+    const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+
+    const char* forced = std::getenv("CLASSIF_NN_ISA");
+    const std::string requested = forced ? forced : "";
+
+    if (requested == "scalar"){
+        return Isa::scalar;
+    }
+    if (requested == "avx2" && has_avx2){
+        return Isa::avx2;
+    }
+    if (has_avx512 && (requested.empty() || requested == "avx512")){
+        return Isa::avx512;
+    }
+    if (has_avx2){
+        return Isa::avx2;
+    }
+    return Isa::scalar;
+}
+
+Isa active_isa(){
+    static const Isa isa = detect_isa();
+    return isa;
+}
+
+std::string isa_name(Isa isa){
+    switch (isa){
+        case Isa::avx512: return "avx512";
+        case Isa::avx2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+// int8 dot-product instructions (vpdpbusd) on top of AVX-512, used by the quantized kernels
+bool has_avx512_vnni(){
+    static const bool supported = active_isa() == Isa::avx512 && __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw");
+    return supported;
+}
+
+// bf16 conversion and dot-product instructions on top of AVX-512, used by the mixed precision layers
+bool has_avx512_bf16(){
+    static const bool supported = active_isa() == Isa::avx512 && __builtin_cpu_supports("avx512bf16") && __builtin_cpu_supports("avx512bw");
+    return supported;
+}
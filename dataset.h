@@ -0,0 +1,321 @@
+# pragma once
+
+# include <string>
+# include <vector>
+# include <cstdint>
+# include <cstdio>
+# include <cstring>
+# include <cerrno>
+# include <charconv>
+# include <stdexcept>
+# include <memory>
+# include <algorithm>
+
+# include "tensor.h"
+# include "mapped_file.h"
+
+/*
+Binary dataset format: a fixed 64 bytes header followed by the features, then the labels, each block starting
+on a 64 bytes boundary so that a mapped float32 block can be used directly by the SIMD kernels.
+    features: rows x cols, row-major, uint8 or float32 (feature = raw value * feature_scale)
+    labels:   rows x 1 int32 class indices (optional)
+All values are stored little-endian, like the machines this code targets.
+*/
+
+enum class DataType : std::uint32_t{
+    none = 0,
+    uint8 = 1,
+    int32 = 2,
+    float32 = 3
+};
+
+std::size_t data_type_size(DataType type){
+    switch (type){
+        case DataType::uint8: return 1;
+        case DataType::int32: return 4;
+        case DataType::float32: return 4;
+        default: return 0;
+    }
+}
+
+struct DatasetHeader{
+    char magic[8];
+    std::uint32_t version;
+    DataType feature_type;
+    std::int64_t rows;
+    std::int64_t cols;
+    DataType label_type;
+    float feature_scale;
+    std::uint64_t features_offset;
+    std::uint64_t labels_offset;
+    std::uint64_t reserved;
+};
+
+static_assert(sizeof(DatasetHeader) == 64, "the dataset header is 64 bytes on disk");
+
+const char DATASET_MAGIC[8] = {'C', 'N', 'N', 'D', 'S', 'E', 'T', '\0'};
+const std::uint32_t DATASET_VERSION = 1;
+const std::uint64_t DATASET_ALIGNMENT = 64;
+
+std::uint64_t dataset_align(std::uint64_t offset){
+    return (offset + DATASET_ALIGNMENT - 1) / DATASET_ALIGNMENT * DATASET_ALIGNMENT;
+}
+
+class MappedDataset{
+    /*
+    Dataset file mapped in memory. Nothing is parsed nor copied when opening it: batches of a float32 dataset
+    are views on the mapping (features().slice_rows(begin, end)), pages being read by the kernel on first use.
+    uint8 datasets are four times smaller on disk and are converted to float batch by batch with copy_features.
+    */
+    public:
+        explicit MappedDataset(const std::string& path);
+
+        int rows() const { return header.rows; }
+        int cols() const { return header.cols; }
+        DataType feature_type() const { return header.feature_type; }
+        float feature_scale() const { return header.feature_scale; }
+        bool has_labels() const { return header.label_type != DataType::none; }
+
+        // zero-copy views; features() needs a float32 dataset with a scale of 1, raw_features() a uint8 one
+        ConstTensorView features() const;
+        BasicTensorView<const std::uint8_t> raw_features() const;
+        ConstLabelView labels() const;
+
+        // writes the scaled features of rows [begin, end) into output, whatever the stored type
+        void copy_features(int begin, int end, const TensorView output) const;
+
+    private:
+        MappedFile file;
+        DatasetHeader header;
+};
+
+MappedDataset::MappedDataset(const std::string& path) : file(path){
+    if (file.size() < sizeof(DatasetHeader)){
+        throw std::runtime_error("MappedDataset: " + path + " is too small to be a dataset");
+    }
+    std::memcpy(&header, file.data(), sizeof(DatasetHeader));
+    if (std::memcmp(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC)) != 0){
+        throw std::runtime_error("MappedDataset: " + path + " is not a dataset file");
+    }
+    if (header.version != DATASET_VERSION){
+        throw std::runtime_error("MappedDataset: unsupported version " + std::to_string(header.version) + " in " + path);
+    }
+    if (header.feature_type != DataType::uint8 && header.feature_type != DataType::float32){
+        throw std::runtime_error("MappedDataset: unsupported feature type in " + path);
+    }
+    if (header.label_type != DataType::none && header.label_type != DataType::int32){
+        throw std::runtime_error("MappedDataset: unsupported label type in " + path);
+    }
+    if (header.rows < 0 || header.cols < 0 || header.rows > INT32_MAX || header.cols > INT32_MAX){
+        throw std::runtime_error("MappedDataset: invalid shape in " + path);
+    }
+
+    const std::uint64_t features_end = header.features_offset + header.rows * header.cols * data_type_size(header.feature_type);
+    const std::uint64_t labels_end = header.labels_offset + header.rows * data_type_size(header.label_type);
+    if (header.features_offset % DATASET_ALIGNMENT != 0 || header.labels_offset % DATASET_ALIGNMENT != 0
+        || header.features_offset < sizeof(DatasetHeader) || features_end > file.size() || (has_labels() && labels_end > file.size())){
+        throw std::runtime_error("MappedDataset: " + path + " is truncated or corrupted");
+    }
+}
+
+ConstTensorView MappedDataset::features() const{
+    if (header.feature_type != DataType::float32 || header.feature_scale != 1.f){
+        throw std::logic_error("MappedDataset: features are not stored as float32, use copy_features");
+    }
+    return ConstTensorView(reinterpret_cast<const float*>(file.data() + header.features_offset), rows(), cols());
+}
+
+BasicTensorView<const std::uint8_t> MappedDataset::raw_features() const{
+    if (header.feature_type != DataType::uint8){
+        throw std::logic_error("MappedDataset: features are not stored as uint8");
+    }
+    return BasicTensorView<const std::uint8_t>(file.data() + header.features_offset, rows(), cols());
+}
+
+ConstLabelView MappedDataset::labels() const{
+    if (!has_labels()){
+        throw std::logic_error("MappedDataset: the dataset has no labels");
+    }
+    return ConstLabelView(reinterpret_cast<const int*>(file.data() + header.labels_offset), rows(), 1);
+}
+
+void MappedDataset::copy_features(int begin, int end, const TensorView output) const{
+    if (begin < 0 || end > rows() || begin > end || output.rows() != end - begin || output.cols() != cols()){
+        throw std::invalid_argument("MappedDataset: invalid rows or output shape");
+    }
+    const float scale = header.feature_scale;
+    for (int r = begin; r < end; ++r){
+        float* destination = output.row_data(r - begin);
+        if (header.feature_type == DataType::uint8){
+            const std::uint8_t* source = file.data() + header.features_offset + static_cast<std::size_t>(r) * cols();
+            for (int c = 0; c < cols(); ++c){
+                destination[c] = source[c] * scale;
+            }
+        }
+        else {
+            const float* source = reinterpret_cast<const float*>(file.data() + header.features_offset) + static_cast<std::size_t>(r) * cols();
+            for (int c = 0; c < cols(); ++c){
+                destination[c] = source[c] * scale;
+            }
+        }
+    }
+}
+
+// ----- writing -----
+
+void write_block(std::FILE* file, const void* data, std::size_t bytes, std::uint64_t& offset){
+    if (bytes > 0 && std::fwrite(data, 1, bytes, file) != bytes){
+        throw std::runtime_error(std::string("write_dataset: write failed: ") + std::strerror(errno));
+    }
+    offset += bytes;
+}
+
+void write_padding(std::FILE* file, std::uint64_t& offset){
+    static const char zeros[DATASET_ALIGNMENT] = {};
+    write_block(file, zeros, dataset_align(offset) - offset, offset);
+}
+
+template <typename T>
+void write_dataset_file(const std::string& path, DataType feature_type, float feature_scale, const BasicTensorView<const T> features, const ConstLabelView labels){
+    if (!labels.empty() && (labels.rows() != features.rows() || labels.cols() != 1)){
+        throw std::invalid_argument("write_dataset: labels must be a rows x 1 tensor");
+    }
+
+    DatasetHeader header{};
+    std::memcpy(header.magic, DATASET_MAGIC, sizeof(DATASET_MAGIC));
+    header.version = DATASET_VERSION;
+    header.feature_type = feature_type;
+    header.rows = features.rows();
+    header.cols = features.cols();
+    header.label_type = labels.empty() ? DataType::none : DataType::int32;
+    header.feature_scale = feature_scale;
+    header.features_offset = dataset_align(sizeof(DatasetHeader));
+    header.labels_offset = labels.empty() ? 0 : dataset_align(header.features_offset + features.size() * sizeof(T));
+
+    // written next to the destination and renamed, so an interrupted write never leaves a truncated dataset behind
+    const std::string temporary_path = path + ".tmp";
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(temporary_path.c_str(), "wb"), &std::fclose);
+    if (!file){
+        throw std::runtime_error("write_dataset: cannot open " + temporary_path + ": " + std::strerror(errno));
+    }
+    std::uint64_t offset = 0;
+    write_block(file.get(), &header, sizeof(DatasetHeader), offset);
+    write_padding(file.get(), offset);
+    for (int r = 0; r < features.rows(); ++r){
+        write_block(file.get(), features.row_data(r), features.cols() * sizeof(T), offset);
+    }
+    if (!labels.empty()){
+        write_padding(file.get(), offset);
+        for (int r = 0; r < labels.rows(); ++r){
+            write_block(file.get(), labels.row_data(r), sizeof(int), offset);
+        }
+    }
+    if (std::fflush(file.get()) != 0 || std::fclose(file.release()) != 0){
+        throw std::runtime_error("write_dataset: cannot write " + temporary_path + ": " + std::strerror(errno));
+    }
+    if (std::rename(temporary_path.c_str(), path.c_str()) != 0){
+        throw std::runtime_error("write_dataset: cannot rename " + temporary_path + " to " + path + ": " + std::strerror(errno));
+    }
+}
+
+void write_dataset(const std::string& path, const ConstTensorView features, const ConstLabelView labels = ConstLabelView()){
+    write_dataset_file<float>(path, DataType::float32, 1.f, features, labels);
+}
+
+void write_dataset(const std::string& path, const BasicTensorView<const std::uint8_t> features, float feature_scale, const ConstLabelView labels = ConstLabelView()){
+    write_dataset_file<std::uint8_t>(path, DataType::uint8, feature_scale, features, labels);
+}
+
+// ----- CSV conversion -----
+
+std::string read_file(const std::string& path){
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> file(std::fopen(path.c_str(), "rb"), &std::fclose);
+    if (!file){
+        throw std::runtime_error("read_file: cannot open " + path + ": " + std::strerror(errno));
+    }
+    std::string content;
+    char buffer[1 << 16];
+    std::size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file.get())) > 0){
+        content.append(buffer, read);
+    }
+    return content;
+}
+
+void convert_csv_dataset(const std::string& csv_path, const std::string& dataset_path, DataType feature_type, float feature_scale){
+    /*
+    Converts a CSV file with one sample per line, "label,feature_1,...,feature_n" (the MNIST CSV layout),
+    into a dataset file. With uint8 storage the raw values are kept and feature_scale is stored in the header,
+    with float32 storage the values are scaled once here.
+    */
+    if (feature_type != DataType::uint8 && feature_type != DataType::float32){
+        throw std::invalid_argument("convert_csv_dataset: features are stored as uint8 or float32");
+    }
+    const std::string content = read_file(csv_path);
+    const char* position = content.data();
+    const char* const content_end = position + content.size();
+
+    std::vector<float> float_values;
+    std::vector<std::uint8_t> byte_values;
+    std::vector<int> labels;
+    int num_cols = -1;
+
+    while (position < content_end){
+        const char* line_end = static_cast<const char*>(std::memchr(position, '\n', content_end - position));
+        if (!line_end){
+            line_end = content_end;
+        }
+        const char* last = line_end;
+        if (last > position && last[-1] == '\r'){
+            --last;
+        }
+        if (last > position){
+            const int line_number = labels.size() + 1;
+            int label = 0;
+            auto parsed_label = std::from_chars(position, last, label);
+            if (parsed_label.ec != std::errc()){
+                throw std::runtime_error("convert_csv_dataset: invalid label on line " + std::to_string(line_number));
+            }
+            labels.push_back(label);
+
+            int cols = 0;
+            for (const char* field = parsed_label.ptr; field < last; ++cols){
+                if (*field != ','){
+                    throw std::runtime_error("convert_csv_dataset: expected ',' on line " + std::to_string(line_number));
+                }
+                float value = 0.f;
+                auto parsed = std::from_chars(field + 1, last, value);
+                if (parsed.ec != std::errc()){
+                    throw std::runtime_error("convert_csv_dataset: invalid value on line " + std::to_string(line_number));
+                }
+                if (feature_type == DataType::uint8){
+                    if (value < 0.f || value > 255.f || value != static_cast<int>(value)){
+                        throw std::runtime_error("convert_csv_dataset: value does not fit in uint8 on line " + std::to_string(line_number));
+                    }
+                    byte_values.push_back(static_cast<std::uint8_t>(value));
+                }
+                else {
+                    float_values.push_back(value * feature_scale);
+                }
+                field = parsed.ptr;
+            }
+            if (num_cols < 0){
+                num_cols = cols;
+            }
+            else if (cols != num_cols){
+                throw std::runtime_error("convert_csv_dataset: line " + std::to_string(line_number) + " has " + std::to_string(cols) + " features instead of " + std::to_string(num_cols));
+            }
+        }
+        position = line_end + 1;
+    }
+
+    const int num_rows = labels.size();
+    num_cols = std::max(num_cols, 0);
+    const ConstLabelView label_view(labels.data(), num_rows, 1);
+    if (feature_type == DataType::uint8){
+        write_dataset(dataset_path, BasicTensorView<const std::uint8_t>(byte_values.data(), num_rows, num_cols), feature_scale, label_view);
+    }
+    else {
+        write_dataset(dataset_path, ConstTensorView(float_values.data(), num_rows, num_cols), label_view);
+    }
+}
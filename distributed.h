@@ -0,0 +1,641 @@
+# pragma once
+
+# include <vector>
+# include <deque>
+# include <string>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <atomic>
+# include <chrono>
+# include <memory>
+# include <utility>
+# include <algorithm>
+# include <exception>
+# include <stdexcept>
+# include <cstring>
+# include <cerrno>
+# include <cstdint>
+# include <unistd.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <sched.h>
+# include <netdb.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+# include <netinet/tcp.h>
+
+# include "tensor.h"
+
+/*
+Multi-process data-parallel training. Every process (rank) trains the same model on its own part of the
+data; after each backward pass the weight gradients are summed over the ranks by an allreduce, so every
+rank applies the same update and the models stay identical.
+
+Two transports are provided: TcpRingCommunicator (ranks on one or several hosts, ring allreduce over TCP)
+and SharedMemoryCommunicator (ranks on one host, reduction through a POSIX shared memory segment).
+GradientAllreduce groups the gradients in buckets and reduces each one on a background thread as soon as
+the backward pass has produced it, while the backward pass of the earlier layers continues.
+*/
+
+class Communicator{
+    /*
+    Collective operations between the "size" ranks of a group. Every rank must make the same calls, in the same
+    order, with the same sizes. A communicator is used by one thread at a time.
+    */
+    public:
+        virtual ~Communicator() {};
+
+        int rank() const { return group_rank; }
+        int size() const { return group_size; }
+
+        // data[i] = sum over the ranks of data[i]
+        virtual void allreduce(float* data, std::size_t n) = 0;
+        virtual void barrier() = 0;
+        // data = data of rank "root"
+        void broadcast(float* data, std::size_t n, int root = 0);
+
+    protected:
+        int group_rank = 0;
+        int group_size = 1;
+};
+
+void Communicator::broadcast(float* data, std::size_t n, int root){
+    // a sum where every other rank contributes zeros
+    if (rank() != root){
+        std::fill(data, data + n, 0.f);
+    }
+    allreduce(data, n);
+}
+
+// rows [begin, end) of a dataset of "rows" rows owned by "rank"; every rank gets rows / size rows (the remainder is
+// dropped) so that all ranks run the same number of steps
+std::pair<int, int> shard_range(int rows, int rank, int size){
+    const int rows_per_rank = rows / size;
+    return {rank * rows_per_rank, (rank + 1) * rows_per_rank};
+}
+
+// ----- TCP ring -----
+
+class TcpRingCommunicator : public Communicator{
+    /*
+    Ranks form a ring: rank r connects to rank r + 1 and accepts a connection from rank r - 1.
+    "addresses" holds the "host:port" of every rank (e.g. 127.0.0.1:29500, 127.0.0.1:29501 on one host);
+    rank r listens on the port of addresses[r]. The constructor waits up to "timeout" for the neighbours.
+    Allreduce is the bandwidth-optimal ring algorithm: a reduce-scatter then an allgather, each of
+    size - 1 steps moving n / size values, sending to the next rank while receiving from the previous one.
+    */
+    public:
+        TcpRingCommunicator(int rank_, const std::vector<std::string>& addresses, std::chrono::milliseconds timeout = std::chrono::seconds(60));
+        ~TcpRingCommunicator();
+        TcpRingCommunicator(const TcpRingCommunicator&) = delete;
+        TcpRingCommunicator& operator=(const TcpRingCommunicator&) = delete;
+
+        void allreduce(float* data, std::size_t n);
+        void barrier();
+
+    protected:
+        // sends "send_bytes" to the next rank while receiving "receive_bytes" from the previous one
+        void exchange(const void* send_data, std::size_t send_bytes, void* receive_data, std::size_t receive_bytes);
+
+        int next_fd;
+        int previous_fd;
+        std::vector<float> receive_buffer;
+};
+
+std::pair<std::string, std::string> split_address(const std::string& address){
+    const std::size_t colon = address.rfind(':');
+    if (colon == std::string::npos){
+        throw std::invalid_argument("TcpRingCommunicator: address without a port: " + address);
+    }
+    return {address.substr(0, colon), address.substr(colon + 1)};
+}
+
+void set_socket_options(int fd){
+    const int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+TcpRingCommunicator::TcpRingCommunicator(int rank_, const std::vector<std::string>& addresses, std::chrono::milliseconds timeout)
+    : next_fd(-1), previous_fd(-1){
+    group_rank = rank_;
+    group_size = addresses.size();
+    if (group_rank < 0 || group_rank >= group_size){
+        throw std::invalid_argument("TcpRingCommunicator: rank out of range");
+    }
+    if (group_size == 1){
+        return;
+    }
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+
+    // listen on our own port
+    const std::pair<std::string, std::string> own = split_address(addresses[group_rank]);
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* listen_info = nullptr;
+    if (::getaddrinfo(nullptr, own.second.c_str(), &hints, &listen_info) != 0){
+        throw std::runtime_error("TcpRingCommunicator: invalid port in " + addresses[group_rank]);
+    }
+    const int listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    const int one = 1;
+    ::setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    const bool listening = listen_fd >= 0 && ::bind(listen_fd, listen_info->ai_addr, listen_info->ai_addrlen) == 0 && ::listen(listen_fd, 1) == 0;
+    const int listen_error = errno;
+    ::freeaddrinfo(listen_info);
+    if (!listening){
+        if (listen_fd >= 0){
+            ::close(listen_fd);
+        }
+        throw std::runtime_error("TcpRingCommunicator: cannot listen on " + addresses[group_rank] + ": " + std::strerror(listen_error));
+    }
+
+    // connect to the next rank, retrying until it listens
+    const std::string& next_address = addresses[(group_rank + 1) % group_size];
+    const std::pair<std::string, std::string> next = split_address(next_address);
+    hints.ai_flags = 0;
+    addrinfo* next_info = nullptr;
+    if (::getaddrinfo(next.first.c_str(), next.second.c_str(), &hints, &next_info) != 0){
+        ::close(listen_fd);
+        throw std::runtime_error("TcpRingCommunicator: cannot resolve " + next_address);
+    }
+    while (next_fd < 0){
+        const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (::connect(fd, next_info->ai_addr, next_info->ai_addrlen) == 0){
+            next_fd = fd;
+            break;
+        }
+        ::close(fd);
+        if (std::chrono::steady_clock::now() > deadline){
+            ::freeaddrinfo(next_info);
+            ::close(listen_fd);
+            throw std::runtime_error("TcpRingCommunicator: cannot connect to " + next_address);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    ::freeaddrinfo(next_info);
+
+    // accept the previous rank
+    pollfd waiting{listen_fd, POLLIN, 0};
+    const int remaining = std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+    if (::poll(&waiting, 1, remaining) == 1){
+        previous_fd = ::accept(listen_fd, nullptr, nullptr);
+    }
+    ::close(listen_fd);
+    if (previous_fd < 0){
+        ::close(next_fd);
+        throw std::runtime_error("TcpRingCommunicator: the previous rank did not connect");
+    }
+    set_socket_options(next_fd);
+    set_socket_options(previous_fd);
+}
+
+TcpRingCommunicator::~TcpRingCommunicator(){
+    if (next_fd >= 0){
+        ::close(next_fd);
+    }
+    if (previous_fd >= 0){
+        ::close(previous_fd);
+    }
+}
+
+void TcpRingCommunicator::exchange(const void* send_data, std::size_t send_bytes, void* receive_data, std::size_t receive_bytes){
+    const char* send_ptr = static_cast<const char*>(send_data);
+    char* receive_ptr = static_cast<char*>(receive_data);
+    while (send_bytes > 0 || receive_bytes > 0){
+        pollfd fds[2] = {{next_fd, static_cast<short>(send_bytes > 0 ? POLLOUT : 0), 0},
+                         {previous_fd, static_cast<short>(receive_bytes > 0 ? POLLIN : 0), 0}};
+        if (::poll(fds, 2, -1) < 0){
+            if (errno == EINTR){
+                continue;
+            }
+            throw std::runtime_error(std::string("TcpRingCommunicator: poll failed: ") + std::strerror(errno));
+        }
+        if (send_bytes > 0 && (fds[0].revents & (POLLOUT | POLLERR | POLLHUP))){
+            const ssize_t sent = ::send(next_fd, send_ptr, send_bytes, MSG_NOSIGNAL);
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                throw std::runtime_error(std::string("TcpRingCommunicator: send failed: ") + std::strerror(errno));
+            }
+            if (sent > 0){
+                send_ptr += sent;
+                send_bytes -= sent;
+            }
+        }
+        if (receive_bytes > 0 && (fds[1].revents & (POLLIN | POLLERR | POLLHUP))){
+            const ssize_t received = ::recv(previous_fd, receive_ptr, receive_bytes, 0);
+            if (received == 0){
+                throw std::runtime_error("TcpRingCommunicator: the previous rank closed the connection");
+            }
+            if (received < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+                throw std::runtime_error(std::string("TcpRingCommunicator: recv failed: ") + std::strerror(errno));
+            }
+            if (received > 0){
+                receive_ptr += received;
+                receive_bytes -= received;
+            }
+        }
+    }
+}
+
+void TcpRingCommunicator::allreduce(float* data, std::size_t n){
+    const int p = group_size;
+    if (p == 1 || n == 0){
+        return;
+    }
+    // segment s is [s * n / p, (s + 1) * n / p)
+    auto segment_begin = [&](int s){ return static_cast<std::size_t>(static_cast<unsigned long long>(n) * s / p); };
+    receive_buffer.resize(n / p + 1);
+
+    // reduce-scatter: after step k, rank r holds the sum over k + 2 ranks of segment (r - k - 1) mod p
+    for (int k = 0; k < p - 1; ++k){
+        const int send_segment = ((group_rank - k) % p + p) % p;
+        const int receive_segment = ((group_rank - k - 1) % p + p) % p;
+        const std::size_t send_begin = segment_begin(send_segment), send_end = segment_begin(send_segment + 1);
+        const std::size_t receive_begin = segment_begin(receive_segment), receive_end = segment_begin(receive_segment + 1);
+        exchange(data + send_begin, (send_end - send_begin) * sizeof(float), receive_buffer.data(), (receive_end - receive_begin) * sizeof(float));
+        float* target = data + receive_begin;
+        for (std::size_t i = 0; i < receive_end - receive_begin; ++i){
+            target[i] += receive_buffer[i];
+        }
+    }
+    // allgather: rank r owns the full sum of segment (r + 1) mod p and passes the sums around the ring
+    for (int k = 0; k < p - 1; ++k){
+        const int send_segment = ((group_rank + 1 - k) % p + p) % p;
+        const int receive_segment = ((group_rank - k) % p + p) % p;
+        const std::size_t send_begin = segment_begin(send_segment), send_end = segment_begin(send_segment + 1);
+        const std::size_t receive_begin = segment_begin(receive_segment), receive_end = segment_begin(receive_segment + 1);
+        exchange(data + send_begin, (send_end - send_begin) * sizeof(float), data + receive_begin, (receive_end - receive_begin) * sizeof(float));
+    }
+}
+
+void TcpRingCommunicator::barrier(){
+    if (group_size == 1){
+        return;
+    }
+    // a token around the ring twice: the second round starts once every rank has entered
+    char token = 0;
+    for (int round = 0; round < 2; ++round){
+        if (group_rank == 0){
+            exchange(&token, 1, nullptr, 0);
+            exchange(nullptr, 0, &token, 1);
+        }
+        else {
+            exchange(nullptr, 0, &token, 1);
+            exchange(&token, 1, nullptr, 0);
+        }
+    }
+}
+
+// ----- shared memory -----
+
+class SharedMemoryCommunicator : public Communicator{
+    /*
+    Ranks of one host share the POSIX shared memory segment "name" (e.g. "/classif_nn_job"), created by
+    rank 0 (replacing a stale one) and removed when rank 0 is destroyed. Every rank has a slot of
+    "capacity" floats: an allreduce copies each chunk into its slot, each rank then sums one segment of
+    the chunk over all the slots, and every rank gathers the summed segments. Ranks synchronize with a
+    barrier on process-shared atomics, spinning then yielding; a barrier throws after "timeout".
+    "job" is a token shared by the ranks of one job and no other (e.g. the launcher's pid): ranks other than 0
+    only use a segment initialized for their job, never one left behind under the same name by a crashed job.
+    */
+    public:
+        SharedMemoryCommunicator(const std::string& name_, int rank_, int size_, std::uint64_t job_, std::size_t capacity_ = 1 << 20,
+                                 std::chrono::milliseconds timeout_ = std::chrono::seconds(60));
+        ~SharedMemoryCommunicator();
+        SharedMemoryCommunicator(const SharedMemoryCommunicator&) = delete;
+        SharedMemoryCommunicator& operator=(const SharedMemoryCommunicator&) = delete;
+
+        void allreduce(float* data, std::size_t n);
+        void barrier();
+
+    protected:
+        struct Header{
+            std::atomic<std::uint32_t> ready;  // SHARED_MEMORY_READY once rank 0 has initialized the segment
+            std::atomic<int> arrived;          // ranks waiting in the current barrier
+            std::atomic<int> generation;       // barriers completed
+            std::atomic<std::uint64_t> job;    // token of the job rank 0 initialized the segment for
+        };
+        static const std::uint32_t SHARED_MEMORY_READY = 0x434E4E31;
+        static_assert(std::atomic<int>::is_always_lock_free && std::atomic<std::uint32_t>::is_always_lock_free
+                      && std::atomic<std::uint64_t>::is_always_lock_free, "process-shared atomics must be lock free");
+
+        float* slot(int r) { return slots + static_cast<std::size_t>(r) * capacity; }
+        void barrier(std::chrono::steady_clock::time_point deadline);
+
+        std::string name;
+        std::uint64_t job;
+        std::chrono::milliseconds timeout;
+        std::size_t capacity;
+        std::size_t mapped_bytes;
+        void* mapping;
+        Header* header;
+        float* slots;
+};
+
+SharedMemoryCommunicator::SharedMemoryCommunicator(const std::string& name_, int rank_, int size_, std::uint64_t job_, std::size_t capacity_, std::chrono::milliseconds timeout_)
+    : name(name_), job(job_), timeout(timeout_), capacity(capacity_), mapping(MAP_FAILED), header(nullptr), slots(nullptr){
+    group_rank = rank_;
+    group_size = size_;
+    if (group_size < 1 || group_rank < 0 || group_rank >= group_size || capacity < 1){
+        throw std::invalid_argument("SharedMemoryCommunicator: invalid rank, size or capacity");
+    }
+    // slots start on a cache line
+    const std::size_t header_bytes = (sizeof(Header) + 63) / 64 * 64;
+    capacity = (capacity + 15) / 16 * 16;
+    mapped_bytes = header_bytes + group_size * capacity * sizeof(float);
+    const std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+
+    if (group_rank == 0){
+        ::shm_unlink(name.c_str());
+        const int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+        if (fd < 0 || ::ftruncate(fd, mapped_bytes) != 0){
+            const int error = errno;
+            if (fd >= 0){
+                ::close(fd);
+            }
+            throw std::runtime_error("SharedMemoryCommunicator: cannot create " + name + ": " + std::strerror(error));
+        }
+        mapping = ::mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        const int error = errno;
+        ::close(fd);
+        if (mapping == MAP_FAILED){
+            throw std::runtime_error("SharedMemoryCommunicator: cannot map " + name + ": " + std::strerror(error));
+        }
+        header = static_cast<Header*>(mapping);
+        new (&header->arrived) std::atomic<int>(0);
+        new (&header->generation) std::atomic<int>(0);
+        new (&header->job) std::atomic<std::uint64_t>(job);
+        new (&header->ready) std::atomic<std::uint32_t>(0);
+        header->ready.store(SHARED_MEMORY_READY, std::memory_order_release);
+    }
+    else {
+        // wait for rank 0 to create, size and initialize the segment of this job; until rank 0 replaces it, the name
+        // may still lead to the (ready) segment of a crashed job, which is mapped then released again
+        while (true){
+            struct stat status;
+            const int fd = ::shm_open(name.c_str(), O_RDWR, 0600);
+            if (fd >= 0 && ::fstat(fd, &status) == 0 && status.st_size >= static_cast<off_t>(mapped_bytes)){
+                mapping = ::mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            }
+            if (fd >= 0){
+                ::close(fd);
+            }
+            if (mapping != MAP_FAILED){
+                header = static_cast<Header*>(mapping);
+                if (header->ready.load(std::memory_order_acquire) == SHARED_MEMORY_READY && header->job.load(std::memory_order_relaxed) == job){
+                    break;
+                }
+                ::munmap(mapping, mapped_bytes);
+                mapping = MAP_FAILED;
+                header = nullptr;
+            }
+            if (std::chrono::steady_clock::now() > deadline){
+                throw std::runtime_error("SharedMemoryCommunicator: rank 0 did not initialize " + name + " for this job");
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    slots = reinterpret_cast<float*>(static_cast<char*>(mapping) + header_bytes);
+
+    // every rank has mapped the segment before rank 0 may remove its name
+    try {
+        barrier(deadline);
+    }
+    catch (...) {
+        ::munmap(mapping, mapped_bytes);
+        mapping = MAP_FAILED;
+        if (group_rank == 0){
+            ::shm_unlink(name.c_str());
+        }
+        throw;
+    }
+}
+
+SharedMemoryCommunicator::~SharedMemoryCommunicator(){
+    if (mapping != MAP_FAILED){
+        ::munmap(mapping, mapped_bytes);
+    }
+    if (group_rank == 0){
+        ::shm_unlink(name.c_str());
+    }
+}
+
+void SharedMemoryCommunicator::barrier(){
+    barrier(std::chrono::steady_clock::now() + timeout);
+}
+
+void SharedMemoryCommunicator::barrier(std::chrono::steady_clock::time_point deadline){
+    const int generation = header->generation.load(std::memory_order_acquire);
+    if (header->arrived.fetch_add(1, std::memory_order_acq_rel) == group_size - 1){
+        header->arrived.store(0, std::memory_order_relaxed);
+        header->generation.fetch_add(1, std::memory_order_acq_rel);
+        return;
+    }
+    for (long spin = 0; header->generation.load(std::memory_order_acquire) == generation; ++spin){
+        if (spin > 1000){
+            // a rank that died or never came would otherwise leave the others spinning forever
+            if (spin % 1024 == 0 && std::chrono::steady_clock::now() > deadline){
+                throw std::runtime_error("SharedMemoryCommunicator: barrier timed out on " + name);
+            }
+            sched_yield();
+        }
+    }
+}
+
+void SharedMemoryCommunicator::allreduce(float* data, std::size_t n){
+    if (group_size == 1){
+        return;
+    }
+    for (std::size_t chunk = 0; chunk < n; chunk += capacity){
+        const std::size_t length = std::min(capacity, n - chunk);
+        std::memcpy(slot(group_rank), data + chunk, length * sizeof(float));
+        barrier();
+
+        // this rank sums its segment of the chunk over every slot, in rank order, into its own slot
+        const std::size_t begin = length * group_rank / group_size, end = length * (group_rank + 1) / group_size;
+        float* sum = slot(group_rank);
+        for (int r = 0; r < group_size; ++r){
+            if (r == group_rank){
+                continue;
+            }
+            const float* other = slot(r);
+            for (std::size_t i = begin; i < end; ++i){
+                sum[i] += other[i];
+            }
+        }
+        barrier();
+
+        for (int r = 0; r < group_size; ++r){
+            const std::size_t segment_begin = length * r / group_size, segment_end = length * (r + 1) / group_size;
+            std::memcpy(data + chunk + segment_begin, slot(r) + segment_begin, (segment_end - segment_begin) * sizeof(float));
+        }
+        // the slots are overwritten by the next chunk or allreduce
+        barrier();
+    }
+}
+
+// ----- bucketed gradient allreduce, overlapped with the backward pass -----
+
+class GradientAllreduce{
+    /*
+    Reduces the parameter gradients of a model, given per layer, in buckets of about "bucket_size" floats.
+    Buckets are filled in reverse layer order, the order in which backward produces the gradients:
+    once layer_ready has been called for every layer of a bucket, a background thread packs its gradients,
+    runs the allreduce, and writes the mean over the ranks back, while the caller goes on with the backward
+    pass of earlier layers. wait() returns once every bucket is reduced.
+    */
+    public:
+        GradientAllreduce(Communicator& communicator_, const std::vector<std::vector<TensorView>>& gradients_, std::size_t bucket_size);
+        ~GradientAllreduce();
+        GradientAllreduce(const GradientAllreduce&) = delete;
+        GradientAllreduce& operator=(const GradientAllreduce&) = delete;
+
+        // the gradients of "layer" are final for this step
+        void layer_ready(int layer);
+        // blocks until the gradients of every layer are reduced (rethrows a communication error)
+        void wait();
+
+    protected:
+        struct Bucket{
+            std::vector<TensorView> gradients;
+            std::vector<float> buffer;
+            int first_layer;  // the bucket holds layers [first_layer, last_layer]
+            int last_layer;
+            int pending;      // layers of the bucket not ready yet in this step
+        };
+
+        void communicate();
+        // every layer of every bucket pending again
+        void reset_pending();
+
+        Communicator& communicator;
+        std::vector<Bucket> buckets;
+        std::vector<int> bucket_of_layer;  // -1 for layers without parameters
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<int> ready;  // buckets to reduce, in order
+        int reduced;            // buckets reduced in this step
+        bool stopping;
+        std::exception_ptr error;
+        std::thread worker;
+};
+
+GradientAllreduce::GradientAllreduce(Communicator& communicator_, const std::vector<std::vector<TensorView>>& gradients, std::size_t bucket_size)
+    : communicator(communicator_), bucket_of_layer(gradients.size(), -1), reduced(0), stopping(false){
+    for (int layer = gradients.size() - 1; layer >= 0; --layer){
+        std::size_t layer_size = 0;
+        for (const TensorView& gradient : gradients[layer]){
+            layer_size += gradient.size();
+        }
+        if (layer_size == 0){
+            continue;
+        }
+        // a layer is never split; it starts a new bucket when the current one is full
+        if (buckets.empty() || buckets.back().buffer.size() >= bucket_size){
+            buckets.emplace_back();
+            buckets.back().last_layer = layer;
+        }
+        Bucket& bucket = buckets.back();
+        bucket.first_layer = layer;
+        bucket.gradients.insert(bucket.gradients.end(), gradients[layer].begin(), gradients[layer].end());
+        bucket.buffer.resize(bucket.buffer.size() + layer_size);
+        bucket_of_layer[layer] = buckets.size() - 1;
+    }
+    reset_pending();
+    worker = std::thread(&GradientAllreduce::communicate, this);
+}
+
+GradientAllreduce::~GradientAllreduce(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    worker.join();
+}
+
+void GradientAllreduce::layer_ready(int layer){
+    const int b = bucket_of_layer[layer];
+    if (b < 0){
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--buckets[b].pending > 0){
+            return;
+        }
+        ready.push_back(b);
+    }
+    condition.notify_all();
+}
+
+void GradientAllreduce::wait(){
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this]{ return reduced == buckets.size() || error; });
+    // ready for the next step
+    reduced = 0;
+    reset_pending();
+    if (error){
+        std::exception_ptr thrown = error;
+        error = nullptr;
+        ready.clear();
+        std::rethrow_exception(thrown);
+    }
+}
+
+void GradientAllreduce::reset_pending(){
+    for (Bucket& bucket : buckets){
+        bucket.pending = 0;
+        for (int layer = bucket.first_layer; layer <= bucket.last_layer; ++layer){
+            bucket.pending += bucket_of_layer[layer] >= 0;
+        }
+    }
+}
+
+void GradientAllreduce::communicate(){
+    const float mean = 1.f / communicator.size();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true){
+        condition.wait(lock, [this]{ return stopping || !ready.empty(); });
+        if (stopping){
+            return;
+        }
+        Bucket& bucket = buckets[ready.front()];
+        ready.pop_front();
+        lock.unlock();
+
+        try{
+            std::size_t offset = 0;
+            for (const TensorView& gradient : bucket.gradients){
+                for (int r = 0; r < gradient.rows(); ++r){
+                    std::copy(gradient.row_data(r), gradient.row_data(r) + gradient.cols(), bucket.buffer.data() + offset);
+                    offset += gradient.cols();
+                }
+            }
+            communicator.allreduce(bucket.buffer.data(), bucket.buffer.size());
+            offset = 0;
+            for (const TensorView& gradient : bucket.gradients){
+                for (int r = 0; r < gradient.rows(); ++r){
+                    float* row = gradient.row_data(r);
+                    for (int c = 0; c < gradient.cols(); ++c){
+                        row[c] = bucket.buffer[offset + c] * mean;
+                    }
+                    offset += gradient.cols();
+                }
+            }
+            lock.lock();
+        }
+        catch (...){
+            lock.lock();
+            error = std::current_exception();
+        }
+        ++reduced;
+        condition.notify_all();
+    }
+}
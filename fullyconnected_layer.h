@@ -18,24 +18,33 @@ class FullyConnectedLayer : public WeightedLayer{
         FullyConnectedLayer(int, int, bool);
         FullyConnectedLayer(int, int, std::string);
         FullyConnectedLayer(int, int, bool, std::string);
-
-        std::vector<std::vector<float>> call(const std::vector<std::vector<float>>);
-        std::vector<std::vector<float>> apply_gradients(const std::vector<std::vector<float>>, std::unique_ptr<Optimizer> & optimizer);
+        // weights and bias drawn by "initializer" (Glorot uniform for the other constructors)
+        FullyConnectedLayer(int, int, bool, std::string, const Initializer& initializer);
+        // layer on existing parameters (e.g. loaded from a checkpoint); an empty bias means no bias
+        FullyConnectedLayer(Tensor weights, Tensor bias, std::unique_ptr<Activation> activation);
+
+        void forward(const ConstTensorView, const TensorView, LayerCache*);
+        void backward(const ConstTensorView, const LayerCache&, const std::vector<TensorView>&, const TensorView, float);
+        // only reads the weight rows of the non-zero inputs; always uses the fp32 weights
+        void forward_sparse(const ConstCSRView, const TensorView, LayerCache*);
+        std::size_t workspace_size(int batch_size) const;
+        ProfileCost forward_cost(int batch_size) const;
+        ProfileCost backward_cost(int batch_size) const;
 
     protected:
-        std::vector<float> apply_weights(const std::vector<float>);
+        void apply_weights(const ConstTensorView, const TensorView);
+        // input . weights (fp32 or bf16 copy, following the precision), then the epilogue
+        void multiply_weights(const ConstTensorView, const TensorView, const GemmEpilogue&);
 };
 
 FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_){
     input_dim = input_dim_;
     output_dim = output_dim_;
-    std::vector<std::vector<float>> weights_init_values(matrix_2d_glorot_uniform_init(input_dim, output_dim));
-    std::transform(weights_init_values.begin(), weights_init_values.end(), std::back_insert_iterator(weights), [](std::vector<float> x){return x; }) ;
+    weights = matrix_2d_glorot_uniform_init(input_dim, output_dim);
 
     use_bias = true;
 
-    std::vector<float> bias_init_values(vector_glorot_uniform_init(input_dim, output_dim));
-    std::transform(bias_init_values.begin(), bias_init_values.end(), std::back_insert_iterator(bias), [](float x){return x; });
+    bias = vector_glorot_uniform_init(input_dim, output_dim);
 
     activation = std::make_unique<IdentityActivation>();
 }
@@ -43,15 +52,12 @@ FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_){
 FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_, bool use_bias_){
     input_dim = input_dim_;
     output_dim = output_dim_;
-    std::vector<std::vector<float>> weights_init_values(matrix_2d_glorot_uniform_init(input_dim, output_dim));
-
-    std::transform(weights_init_values.begin(), weights_init_values.end(), std::back_insert_iterator(weights), [](std::vector<float> x){return x; }) ;
+    weights = matrix_2d_glorot_uniform_init(input_dim, output_dim);
 
     use_bias = use_bias_;
 
     if (use_bias){
-        std::vector<float> bias_init_values(vector_glorot_uniform_init(input_dim, output_dim));
-        std::transform(bias_init_values.begin(), bias_init_values.end(), std::back_insert_iterator(bias), [](float x){return x; });
+        bias = vector_glorot_uniform_init(input_dim, output_dim);
     }
     activation = std::make_unique<IdentityActivation>();
 }
@@ -60,13 +66,11 @@ FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_, bool u
 FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_, std::string activation_name){
     input_dim = input_dim_;
     output_dim = output_dim_;
-    std::vector<std::vector<float>> weights_init_values(matrix_2d_glorot_uniform_init(input_dim, output_dim));
-    std::transform(weights_init_values.begin(), weights_init_values.end(), std::back_insert_iterator(weights), [](std::vector<float> x){return x; }) ;
+    weights = matrix_2d_glorot_uniform_init(input_dim, output_dim);
 
     use_bias = true;
 
-    std::vector<float> bias_init_values(vector_glorot_uniform_init(input_dim, output_dim));
-    std::transform(bias_init_values.begin(), bias_init_values.end(), std::back_insert_iterator(bias), [](float x){return x; });
+    bias = vector_glorot_uniform_init(input_dim, output_dim);
 
     activation = activation_from_str(activation_name);
 }
@@ -74,84 +78,177 @@ FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_, std::s
 FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_, bool use_bias_, std::string activation_name){
     input_dim = input_dim_;
     output_dim = output_dim_;
-    std::vector<std::vector<float>> weights_init_values(matrix_2d_glorot_uniform_init(input_dim, output_dim));
-    std::transform(weights_init_values.begin(), weights_init_values.end(), std::back_insert_iterator(weights), [](std::vector<float> x){return x; }) ;
+    weights = matrix_2d_glorot_uniform_init(input_dim, output_dim);
 
     use_bias = use_bias_;
 
     if (use_bias){
-        std::vector<float> bias_init_values(vector_glorot_uniform_init(input_dim, output_dim));
-        std::transform(bias_init_values.begin(), bias_init_values.end(), std::back_insert_iterator(bias), [](float x){return x; });
+        bias = vector_glorot_uniform_init(input_dim, output_dim);
     }
     activation = activation_from_str(activation_name);
 }
 
-std::vector<std::vector<float>> FullyConnectedLayer::apply_gradients(const std::vector<std::vector<float>> gradient_signal, std::unique_ptr<Optimizer> & optimizer){
-    
-    std::vector<std::vector<float>> mean_w_gradients(weights.size(), std::vector<float>(weights[0].size(), 0.));
-    std::vector<float> mean_b_gradients(bias.size(), 0.);
+FullyConnectedLayer::FullyConnectedLayer(int input_dim_, int output_dim_, bool use_bias_, std::string activation_name, const Initializer& initializer){
+    input_dim = input_dim_;
+    output_dim = output_dim_;
+    weights = initialized_tensor(input_dim, output_dim, initializer, input_dim, output_dim);
 
-    std::vector<std::vector<float>> grad_in;
+    use_bias = use_bias_;
 
-    std::vector<std::vector<float>> input_gradients;
+    if (use_bias){
+        bias = initialized_tensor(1, output_dim, initializer, input_dim, output_dim);
+    }
+    activation = activation_from_str(activation_name);
+}
 
-    for (int b = 0; b < gradient_signal.size(); ++b){
-        std::vector<float> g = element_wise_vector_multiplication(activation_gradients[b], gradient_signal[b]);
+FullyConnectedLayer::FullyConnectedLayer(Tensor weights_, Tensor bias_, std::unique_ptr<Activation> activation_){
+    if (!bias_.empty() && (bias_.rows() != 1 || bias_.cols() != weights_.cols())){
+        throw std::invalid_argument("FullyConnected: the bias must be a 1 x output_dim tensor");
+    }
+    input_dim = weights_.rows();
+    output_dim = weights_.cols();
+    weights = std::move(weights_);
+    use_bias = !bias_.empty();
+    bias = std::move(bias_);
+    activation = std::move(activation_);
+}
 
-        std::vector<std::vector<float>> grad_w(outer_product(weights_gradients[b], g));
+void FullyConnectedLayer::backward(const ConstTensorView gradient_signal, const LayerCache& cache_, const std::vector<TensorView>& parameter_gradients_, const TensorView grad_in, float scale){
+    if (gradient_signal.rows() != cache_.activation_gradients.rows() || gradient_signal.cols() != output_dim){
+        throw std::invalid_argument("FullyConnected: gradient signal does not match the forward pass");
+    }
 
-        // compute input gradient
-        // compute weight gradient: outet_product(gradient_signal,)
-        // compute bias gradient: gradient_signal
-        
-        mean_w_gradients = matrix_addition(mean_w_gradients, grad_w); // make a matrix addition in linear algebra
+    // gradient at the pre-activation, for the whole batch
+    TensorView g = cache_.workspace->allocate(gradient_signal.rows(), output_dim);
+    element_wise_vector_multiplication(cache_.activation_gradients, gradient_signal, g);
 
-        if (use_bias){
-            mean_b_gradients = vector_addition(mean_b_gradients, gradient_signal[b]);
+    // input gradient: dX = G . W^T (not needed for the first layer)
+    if (!grad_in.empty()){
+        if (precision == Precision::bf16){
+            gemm(g, false, weights_bf16, true, grad_in);
+        }
+        else {
+            gemm(g, false, weights, true, grad_in);
         }
+    }
 
-        //std::vector<float> grad_in(vector_matrix_multiplication(g, matrix_transpose(weights)));
-        grad_in.push_back(vector_matrix_multiplication(g, matrix_transpose(weights)));
+    // weight gradient: dW += scale * X^T . G, only on the rows of the non-zero inputs for a sparse batch
+    if (!cache_.sparse_input.empty()){
+        csr_transpose_multiply_accumulate(cache_.sparse_input, g, parameter_gradients_[0], scale);
+    }
+    else {
+        gemm(cache_.input, true, g, false, parameter_gradients_[0], scale, 1.);
     }
 
-    int batch_size = gradient_signal.size();
+    if (use_bias){
+        // bias gradient: column reduction of G
+        add_matrix_column_sum(g, parameter_gradients_[1], scale);
+    }
+}
 
-    std::transform(mean_w_gradients.begin(), mean_w_gradients.end(), mean_w_gradients.begin(), [&](std::vector<float> v){return vector_scalar_multiplication(1./batch_size, v);});
-    mean_b_gradients = vector_scalar_multiplication(1./batch_size, mean_b_gradients);
+std::size_t FullyConnectedLayer::workspace_size(int batch_size) const{
+    // activation derivatives (forward) and pre-activation gradient (backward)
+    return 2 * Workspace::allocation_size(batch_size, output_dim);
+}
 
-    weights = optimizer->apply_gradient(weights, mean_w_gradients);
+ProfileCost FullyConnectedLayer::forward_cost(int batch_size) const{
+    // X . W, then bias and activation on the output; X and W read, output and derivatives written
+    const double batch = batch_size, weight_bytes = precision == Precision::bf16 ? sizeof(bfloat16) : sizeof(float);
+    ProfileCost cost;
+    cost.flops = 2. * batch * input_dim * output_dim + 2. * batch * output_dim;
+    cost.bytes = sizeof(float) * (batch * input_dim + 2. * batch * output_dim + output_dim) + weight_bytes * input_dim * output_dim;
+    return cost;
+}
 
-    if (use_bias){
-        bias = optimizer->apply_gradient(bias, mean_b_gradients);
+ProfileCost FullyConnectedLayer::backward_cost(int batch_size) const{
+    // G = derivative * signal, dX = G . W^T, dW += X^T . G, bias gradient
+    const double batch = batch_size, weight_bytes = precision == Precision::bf16 ? sizeof(bfloat16) : sizeof(float);
+    ProfileCost cost;
+    cost.flops = 4. * batch * input_dim * output_dim + 2. * batch * output_dim;
+    cost.bytes = sizeof(float) * (3. * batch * output_dim + 2. * batch * input_dim + 2. * input_dim * output_dim + output_dim)
+                 + weight_bytes * input_dim * output_dim;
+    return cost;
+}
+
+void FullyConnectedLayer::apply_weights(const ConstTensorView input, const TensorView output){
+    // one matrix-matrix product for the whole batch, bias added in the same pass
+    if (input.cols() != input_dim){
+        throw std::invalid_argument("FullyConnected: invalid shape for multiplication");
     }
+    GemmEpilogue epilogue;
+    epilogue.bias = use_bias ? bias.data() : nullptr;
+    multiply_weights(input, output, epilogue);
+}
 
-    return grad_in;
+void FullyConnectedLayer::multiply_weights(const ConstTensorView input, const TensorView output, const GemmEpilogue& epilogue){
+    if (precision == Precision::bf16){
+        gemm(input, false, weights_bf16, false, output, 1., 0., epilogue);
+    }
+    else {
+        gemm(input, false, weights, false, output, 1., 0., epilogue);
+    }
 }
 
-std::vector<float> FullyConnectedLayer::apply_weights(const std::vector<float> input){
-    if (input.size() != input_dim){
+void FullyConnectedLayer::forward(const ConstTensorView input, const TensorView output, LayerCache* cache_){
+    if (input.cols() != input_dim){
         throw std::invalid_argument("FullyConnected: invalid shape for multiplication");
     }
-    std::vector<float> input_mult_w(vector_matrix_multiplication(input, weights));
-    
-    std::vector<float> after_bias = use_bias ? vector_addition(input_mult_w, bias) : input_mult_w;
 
-    // compute gradients
-    weights_gradients.push_back(input);
-    std::vector<float>  output(call_activation(after_bias));
-    activation_gradients.push_back(activation->get_gradients());
+    // without a cache (inference) no derivative is computed and nothing is kept
+    TensorView derivatives;
+    if (cache_){
+        if (!cache_->workspace){
+            throw std::logic_error("FullyConnected: a training forward pass needs a workspace");
+        }
+        cache_->input = input;
+        cache_->sparse_input = ConstCSRView();
+        cache_->activation_gradients = cache_->workspace->allocate(input.rows(), output_dim);
+        derivatives = cache_->activation_gradients;
+    }
 
-    return output;
+    if (is_elementwise(activation->get_kind())){
+        // bias, activation and derivative are all computed by the GEMM epilogue, in one pass over each output tile
+        GemmEpilogue epilogue;
+        epilogue.bias = use_bias ? bias.data() : nullptr;
+        epilogue.activation = activation->get_kind();
+        epilogue.activation_parameter = activation->get_parameter();
+        epilogue.derivatives = derivatives.empty() ? nullptr : derivatives.data();
+        epilogue.ldd = derivatives.stride();
+        multiply_weights(input, output, epilogue);
+    }
+    else {
+        apply_weights(input, output);
+        call_activation(output, derivatives);
+    }
 }
 
-std::vector<std::vector<float>> FullyConnectedLayer::call(const std::vector<std::vector<float>> input){
-    std::vector<std::vector<float>> output(input.size());
-    weights_gradients.clear();
-    activation_gradients.clear();
-    // weights_gradients = input;
-    for (int b = 0; b < input.size(); ++b){
-        output[b] = apply_weights(input[b]);
+void FullyConnectedLayer::forward_sparse(const ConstCSRView input, const TensorView output, LayerCache* cache_){
+    if (input.cols() != input_dim){
+        throw std::invalid_argument("FullyConnected: invalid shape for multiplication");
     }
-    return output;
-}
 
+    TensorView derivatives;
+    if (cache_){
+        if (!cache_->workspace){
+            throw std::logic_error("FullyConnected: a training forward pass needs a workspace");
+        }
+        cache_->input = ConstTensorView();
+        cache_->sparse_input = input;
+        cache_->activation_gradients = cache_->workspace->allocate(input.rows(), output_dim);
+        derivatives = cache_->activation_gradients;
+    }
+
+    GemmEpilogue epilogue;
+    epilogue.bias = use_bias ? bias.data() : nullptr;
+    if (is_elementwise(activation->get_kind())){
+        epilogue.activation = activation->get_kind();
+        epilogue.activation_parameter = activation->get_parameter();
+        epilogue.derivatives = derivatives.empty() ? nullptr : derivatives.data();
+        epilogue.ldd = derivatives.stride();
+        csr_multiply(input, weights, output, epilogue);
+    }
+    else {
+        csr_multiply(input, weights, output, epilogue);
+        call_activation(output, derivatives);
+    }
+}
@@ -0,0 +1,386 @@
+# pragma once
+
+# include <vector>
+# include <string>
+# include <algorithm>
+# include <stdexcept>
+# include <immintrin.h>
+
+# include "tensor.h"
+# include "cpu_dispatch.h"
+# include "bfloat16.h"
+# include "activation_kernels.h"
+
+/*
+Single precision GEMM engine: C = activation(alpha * op(A) . op(B) + beta * C + bias on every row).
+
+The structure follows the classic packed-panel design:
+    - op(B) is packed into KC x NC blocks (kept in L2/L3), cut into NR-wide column panels,
+    - op(A) is packed into MC x KC blocks (kept in L2), cut into MR-high row panels,
+    - a register-blocked MR x NR micro-kernel multiplies one A panel by one B panel (L1).
+Transposed operands are handled by the packing routines, so no transposed copy is ever made.
+B can also be bf16 (mixed precision weights): it is packed as bf16 and widened to fp32 by the micro-kernel
+as it is loaded, so the accumulation stays in fp32 and both B and its packed panels take half the bytes.
+
+The micro-kernel (scalar, AVX2/FMA or AVX-512) is chosen once at startup from cpuid, so the same
+binary uses the widest instruction set available on each machine.
+*/
+
+struct GemmEpilogue{
+    /*
+    Applied to each output tile once its last KC block has been accumulated, while the tile is still in cache:
+    bias add, then an element-wise activation, whose derivative is written to "derivatives" (if not null,
+    same layout as C with leading dimension "ldd").
+    */
+    const float* bias = nullptr;
+    ActivationKind activation = ActivationKind::identity;
+    float activation_parameter = 0.;
+    float* derivatives = nullptr;
+    int ldd = 0;
+};
+
+typedef void (*GemmMicroKernel)(int kc, const float* a_panel, const float* b_panel, float* c, int ldc, bool accumulate);
+typedef void (*GemmMicroKernelBF16)(int kc, const float* a_panel, const bfloat16* b_panel, float* c, int ldc, bool accumulate);
+
+struct GemmKernel{
+    std::string name;
+    int mr;
+    int nr;
+    int mc;
+    int kc;
+    int nc;
+    GemmMicroKernel micro_kernel;
+    GemmMicroKernelBF16 micro_kernel_bf16;  // same tile, bf16 B panels
+};
+
+// ----- micro-kernels -----
+
+// loads of B values as fp32, from float or bf16 panels
+float gemm_widen(float value){
+    return value;
+}
+
+float gemm_widen(bfloat16 value){
+    return bf16_to_float(value);
+}
+
+__attribute__((target("avx2")))
+__m256 gemm_load_avx2(const float* b){
+    return _mm256_load_ps(b);
+}
+
+__attribute__((target("avx2")))
+__m256 gemm_load_avx2(const bfloat16* b){
+    const __m256i widened = _mm256_cvtepu16_epi32(_mm_load_si128(reinterpret_cast<const __m128i*>(b)));
+    return _mm256_castsi256_ps(_mm256_slli_epi32(widened, 16));
+}
+
+__attribute__((target("avx512f")))
+__m512 gemm_load_avx512(const float* b){
+    return _mm512_load_ps(b);
+}
+
+__attribute__((target("avx512f")))
+__m512 gemm_load_avx512(const bfloat16* b){
+    const __m512i widened = _mm512_cvtepu16_epi32(_mm256_load_si256(reinterpret_cast<const __m256i*>(b)));
+    return _mm512_castsi512_ps(_mm512_slli_epi32(widened, 16));
+}
+
+template <int MR, int NR, typename TB>
+void gemm_micro_kernel_scalar(int kc, const float* a_panel, const TB* b_panel, float* c, int ldc, bool accumulate){
+    float acc[MR][NR] = {};
+    for (int p = 0; p < kc; ++p){
+        for (int i = 0; i < MR; ++i){
+            const float a_ip = a_panel[p * MR + i];
+            for (int j = 0; j < NR; ++j){
+                acc[i][j] += a_ip * gemm_widen(b_panel[p * NR + j]);
+            }
+        }
+    }
+    for (int i = 0; i < MR; ++i){
+        for (int j = 0; j < NR; ++j){
+            c[i * ldc + j] = accumulate ? c[i * ldc + j] + acc[i][j] : acc[i][j];
+        }
+    }
+}
+
+template <typename TB>
+__attribute__((target("avx2,fma")))
+void gemm_micro_kernel_avx2(int kc, const float* a_panel, const TB* b_panel, float* c, int ldc, bool accumulate){
+    // 6 x 16 tile: 12 ymm accumulators, 2 for the B row, 1 for the broadcast A value
+    __m256 acc[6][2];
+    #pragma GCC unroll 6
+    for (int i = 0; i < 6; ++i){
+        acc[i][0] = _mm256_setzero_ps();
+        acc[i][1] = _mm256_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p){
+        const __m256 b0 = gemm_load_avx2(b_panel);
+        const __m256 b1 = gemm_load_avx2(b_panel + 8);
+        #pragma GCC unroll 6
+        for (int i = 0; i < 6; ++i){
+            const __m256 a_ip = _mm256_broadcast_ss(a_panel + i);
+            acc[i][0] = _mm256_fmadd_ps(a_ip, b0, acc[i][0]);
+            acc[i][1] = _mm256_fmadd_ps(a_ip, b1, acc[i][1]);
+        }
+        a_panel += 6;
+        b_panel += 16;
+    }
+    #pragma GCC unroll 6
+    for (int i = 0; i < 6; ++i){
+        float* c_row = c + i * ldc;
+        if (accumulate){
+            acc[i][0] = _mm256_add_ps(acc[i][0], _mm256_loadu_ps(c_row));
+            acc[i][1] = _mm256_add_ps(acc[i][1], _mm256_loadu_ps(c_row + 8));
+        }
+        _mm256_storeu_ps(c_row, acc[i][0]);
+        _mm256_storeu_ps(c_row + 8, acc[i][1]);
+    }
+}
+
+template <typename TB>
+__attribute__((target("avx512f")))
+void gemm_micro_kernel_avx512(int kc, const float* a_panel, const TB* b_panel, float* c, int ldc, bool accumulate){
+    // 12 x 32 tile: 24 zmm accumulators, 2 for the B row, 1 for the broadcast A value
+    __m512 acc[12][2];
+    #pragma GCC unroll 12
+    for (int i = 0; i < 12; ++i){
+        acc[i][0] = _mm512_setzero_ps();
+        acc[i][1] = _mm512_setzero_ps();
+    }
+    for (int p = 0; p < kc; ++p){
+        const __m512 b0 = gemm_load_avx512(b_panel);
+        const __m512 b1 = gemm_load_avx512(b_panel + 16);
+        #pragma GCC unroll 12
+        for (int i = 0; i < 12; ++i){
+            const __m512 a_ip = _mm512_set1_ps(a_panel[i]);
+            acc[i][0] = _mm512_fmadd_ps(a_ip, b0, acc[i][0]);
+            acc[i][1] = _mm512_fmadd_ps(a_ip, b1, acc[i][1]);
+        }
+        a_panel += 12;
+        b_panel += 32;
+    }
+    #pragma GCC unroll 12
+    for (int i = 0; i < 12; ++i){
+        float* c_row = c + i * ldc;
+        if (accumulate){
+            acc[i][0] = _mm512_add_ps(acc[i][0], _mm512_loadu_ps(c_row));
+            acc[i][1] = _mm512_add_ps(acc[i][1], _mm512_loadu_ps(c_row + 16));
+        }
+        _mm512_storeu_ps(c_row, acc[i][0]);
+        _mm512_storeu_ps(c_row + 16, acc[i][1]);
+    }
+}
+
+// ----- runtime dispatch -----
+
+GemmKernel gemm_scalar_kernel(){
+    return GemmKernel{"scalar", 4, 8, 128, 256, 2048, gemm_micro_kernel_scalar<4, 8, float>, gemm_micro_kernel_scalar<4, 8, bfloat16>};
+}
+
+GemmKernel gemm_avx2_kernel(){
+    return GemmKernel{"avx2", 6, 16, 120, 256, 2048, gemm_micro_kernel_avx2<float>, gemm_micro_kernel_avx2<bfloat16>};
+}
+
+GemmKernel gemm_avx512_kernel(){
+    return GemmKernel{"avx512", 12, 32, 144, 256, 4096, gemm_micro_kernel_avx512<float>, gemm_micro_kernel_avx512<bfloat16>};
+}
+
+GemmKernel select_gemm_kernel(){
+    // widest micro-kernel the CPU supports (see cpu_dispatch.h)
+    switch (active_isa()){
+        case Isa::avx512: return gemm_avx512_kernel();
+        case Isa::avx2: return gemm_avx2_kernel();
+        default: return gemm_scalar_kernel();
+    }
+}
+
+const GemmKernel& gemm_kernel(){
+    static const GemmKernel kernel = select_gemm_kernel();
+    return kernel;
+}
+
+// ----- packing -----
+
+void gemm_pack_a(bool transpose_a, const float* a, int lda, int row_start, int rows, int k_start, int depth, float alpha, int mr, float* packed){
+    // MR-high panels, stored column after column; rows past the end of A are zero padded
+    for (int panel = 0; panel < rows; panel += mr){
+        const int panel_rows = std::min(mr, rows - panel);
+        for (int p = 0; p < depth; ++p){
+            for (int i = 0; i < panel_rows; ++i){
+                const int row = row_start + panel + i;
+                const int col = k_start + p;
+                const float value = transpose_a ? a[static_cast<std::size_t>(col) * lda + row] : a[static_cast<std::size_t>(row) * lda + col];
+                packed[i] = alpha * value;
+            }
+            for (int i = panel_rows; i < mr; ++i){
+                packed[i] = 0.f;
+            }
+            packed += mr;
+        }
+    }
+}
+
+template <typename TB>
+void gemm_pack_b(bool transpose_b, const TB* b, int ldb, int k_start, int depth, int col_start, int cols, int nr, TB* packed){
+    // NR-wide panels, stored row after row; columns past the end of B are zero padded
+    for (int panel = 0; panel < cols; panel += nr){
+        const int panel_cols = std::min(nr, cols - panel);
+        for (int p = 0; p < depth; ++p){
+            const int row = k_start + p;
+            if (!transpose_b){
+                const TB* b_row = b + static_cast<std::size_t>(row) * ldb + col_start + panel;
+                std::copy(b_row, b_row + panel_cols, packed);
+            }
+            else {
+                for (int j = 0; j < panel_cols; ++j){
+                    packed[j] = b[static_cast<std::size_t>(col_start + panel + j) * ldb + row];
+                }
+            }
+            std::fill(packed + panel_cols, packed + nr, TB{});
+            packed += nr;
+        }
+    }
+}
+
+// ----- driver -----
+
+void gemm_run_micro_kernel(const GemmKernel& kernel, int kc, const float* a_panel, const float* b_panel, float* c, int ldc, bool accumulate){
+    kernel.micro_kernel(kc, a_panel, b_panel, c, ldc, accumulate);
+}
+
+void gemm_run_micro_kernel(const GemmKernel& kernel, int kc, const float* a_panel, const bfloat16* b_panel, float* c, int ldc, bool accumulate){
+    kernel.micro_kernel_bf16(kc, a_panel, b_panel, c, ldc, accumulate);
+}
+
+void gemm_apply_epilogue(float* c, int ldc, int rows, int cols, int row_start, int col_start, const GemmEpilogue& epilogue){
+    const bool has_activation = epilogue.activation != ActivationKind::identity || epilogue.derivatives;
+    for (int i = 0; i < rows; ++i){
+        float* c_row = c + static_cast<std::size_t>(i) * ldc;
+        if (epilogue.bias){
+            const float* bias = epilogue.bias + col_start;
+            for (int j = 0; j < cols; ++j){
+                c_row[j] += bias[j];
+            }
+        }
+        if (has_activation){
+            float* derivatives = epilogue.derivatives ? epilogue.derivatives + static_cast<std::size_t>(row_start + i) * epilogue.ldd + col_start : nullptr;
+            activation_kernel(epilogue.activation, epilogue.activation_parameter, c_row, derivatives, cols);
+        }
+    }
+}
+
+template <typename TB>
+void gemm(bool transpose_a, bool transpose_b, int m, int n, int k, float alpha, const float* a, int lda, const TB* b, int ldb, float beta, float* c, int ldc, const GemmEpilogue& epilogue = GemmEpilogue()){
+    /*
+    C (m x n) = alpha * op(A) . op(B) + beta * C, then the epilogue.
+    op(A) is m x k (A is k x m when transpose_a), op(B) is k x n (B is n x k when transpose_b).
+    B is float or bfloat16.
+    */
+    if (!is_elementwise(epilogue.activation)){
+        throw std::invalid_argument("gemm: only element-wise activations can be fused in the epilogue");
+    }
+    if (m <= 0 || n <= 0){
+        return;
+    }
+    const GemmKernel& kernel = gemm_kernel();
+
+    if (beta != 0.f && beta != 1.f){
+        for (int i = 0; i < m; ++i){
+            std::transform(c + static_cast<std::size_t>(i) * ldc, c + static_cast<std::size_t>(i) * ldc + n, c + static_cast<std::size_t>(i) * ldc, [&](float x){return beta * x; });
+        }
+    }
+    if (k <= 0){
+        if (beta == 0.f){
+            for (int i = 0; i < m; ++i){
+                std::fill(c + static_cast<std::size_t>(i) * ldc, c + static_cast<std::size_t>(i) * ldc + n, 0.f);
+            }
+        }
+        gemm_apply_epilogue(c, ldc, m, n, 0, 0, epilogue);
+        return;
+    }
+
+    // packing buffers are reused across calls, so steady state GEMMs do not allocate
+    thread_local std::vector<float, AlignedAllocator<float, TENSOR_ALIGNMENT>> packed_a;
+    thread_local std::vector<TB, AlignedAllocator<TB, TENSOR_ALIGNMENT>> packed_b;
+    const int mr = kernel.mr;
+    const int nr = kernel.nr;
+    packed_a.resize(static_cast<std::size_t>(kernel.mc + mr) * kernel.kc);
+    packed_b.resize(static_cast<std::size_t>(kernel.nc + nr) * kernel.kc);
+
+    float edge_tile[32 * 32];
+
+    for (int jc = 0; jc < n; jc += kernel.nc){
+        const int nc = std::min(kernel.nc, n - jc);
+
+        for (int pc = 0; pc < k; pc += kernel.kc){
+            const int kc = std::min(kernel.kc, k - pc);
+            const bool accumulate = pc > 0 || beta != 0.f;
+            const bool last_block = pc + kc >= k;
+
+            gemm_pack_b(transpose_b, b, ldb, pc, kc, jc, nc, nr, packed_b.data());
+
+            for (int ic = 0; ic < m; ic += kernel.mc){
+                const int mc = std::min(kernel.mc, m - ic);
+
+                gemm_pack_a(transpose_a, a, lda, ic, mc, pc, kc, alpha, mr, packed_a.data());
+
+                for (int jr = 0; jr < nc; jr += nr){
+                    const int tile_cols = std::min(nr, nc - jr);
+                    const TB* b_panel = packed_b.data() + static_cast<std::size_t>(jr) * kc;
+
+                    for (int ir = 0; ir < mc; ir += mr){
+                        const int tile_rows = std::min(mr, mc - ir);
+                        const float* a_panel = packed_a.data() + static_cast<std::size_t>(ir) * kc;
+                        float* c_tile = c + static_cast<std::size_t>(ic + ir) * ldc + jc + jr;
+
+                        if (tile_rows == mr && tile_cols == nr){
+                            gemm_run_micro_kernel(kernel, kc, a_panel, b_panel, c_tile, ldc, accumulate);
+                        }
+                        else {
+                            // partial tile on the border of C: compute into a full tile, then copy the valid part
+                            gemm_run_micro_kernel(kernel, kc, a_panel, b_panel, edge_tile, nr, false);
+                            for (int i = 0; i < tile_rows; ++i){
+                                float* c_row = c_tile + static_cast<std::size_t>(i) * ldc;
+                                for (int j = 0; j < tile_cols; ++j){
+                                    c_row[j] = accumulate ? c_row[j] + edge_tile[i * nr + j] : edge_tile[i * nr + j];
+                                }
+                            }
+                        }
+
+                        if (last_block){
+                            gemm_apply_epilogue(c_tile, ldc, tile_rows, tile_cols, ic + ir, jc + jr, epilogue);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <typename TB>
+void gemm_views(const ConstTensorView a, bool transpose_a, const BasicTensorView<const TB> b, bool transpose_b, const TensorView c, float alpha, float beta, const GemmEpilogue& epilogue){
+    const int m = transpose_a ? a.cols() : a.rows();
+    const int k = transpose_a ? a.rows() : a.cols();
+    const int k_b = transpose_b ? b.cols() : b.rows();
+    const int n = transpose_b ? b.rows() : b.cols();
+    if (k != k_b){
+        throw std::invalid_argument("gemm: inner dimensions do not match!");
+    }
+    if (c.rows() != m || c.cols() != n){
+        throw std::invalid_argument("gemm: invalid output shape!");
+    }
+    gemm(transpose_a, transpose_b, m, n, k, alpha, a.data(), a.stride(), b.data(), b.stride(), beta, c.data(), c.stride(), epilogue);
+}
+
+void gemm(const ConstTensorView a, bool transpose_a, const ConstTensorView b, bool transpose_b, const TensorView c, float alpha = 1.f, float beta = 0.f, const GemmEpilogue& epilogue = GemmEpilogue()){
+    /*
+    View-based GEMM: c = alpha * op(a) . op(b) + beta * c, with shape checks.
+    */
+    gemm_views(a, transpose_a, b, transpose_b, c, alpha, beta, epilogue);
+}
+
+void gemm(const ConstTensorView a, bool transpose_a, const ConstBF16TensorView b, bool transpose_b, const TensorView c, float alpha = 1.f, float beta = 0.f, const GemmEpilogue& epilogue = GemmEpilogue()){
+    // same with bf16 weights
+    gemm_views(a, transpose_a, b, transpose_b, c, alpha, beta, epilogue);
+}
@@ -0,0 +1,498 @@
+# pragma once
+
+# include <vector>
+# include <deque>
+# include <string>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <future>
+# include <memory>
+# include <atomic>
+# include <chrono>
+# include <algorithm>
+# include <exception>
+# include <stdexcept>
+# include <cstring>
+# include <cerrno>
+# include <cstdint>
+# include <unistd.h>
+# include <sys/socket.h>
+# include <sys/un.h>
+
+# include "tensor.h"
+# include "model.h"
+
+/*
+In-process inference service: clients submit single samples from any thread and get a future; a scheduler
+thread gathers pending requests into one batch, runs a single Model::predict on it and scatters the rows
+back. A batch starts as soon as max_batch_size requests are waiting, or when the oldest one has waited
+max_delay, so a lone request is never delayed by more than max_delay plus one forward pass.
+
+UnixSocketFrontend serves the same requests over a local stream socket, and generate_load measures the
+latency percentiles and throughput reached by a number of closed-loop clients.
+*/
+
+struct InferenceServerOptions{
+    int max_batch_size = 64;
+    std::chrono::microseconds max_delay = std::chrono::microseconds(500);
+};
+
+struct InferenceServerStats{
+    long requests = 0;
+    long batches = 0;
+};
+
+class InferenceServer{
+    /*
+    The scheduler thread is the only user of the model while the server runs: the model must not be
+    trained or called from elsewhere until stop. Samples are input_dim floats, results output_dim floats.
+    */
+    public:
+        InferenceServer(Model& model_, InferenceServerOptions options_ = InferenceServerOptions());
+        ~InferenceServer();
+        InferenceServer(const InferenceServer&) = delete;
+        InferenceServer& operator=(const InferenceServer&) = delete;
+
+        // thread-safe; the sample is copied before returning
+        std::future<std::vector<float>> submit(const float* sample);
+        std::future<std::vector<float>> submit(std::vector<float> sample);
+        // answers the pending requests, then joins the scheduler; later submissions throw
+        void stop();
+
+        int input_dim() const { return n_inputs; }
+        int output_dim() const { return n_outputs; }
+        const InferenceServerOptions& get_options() const { return options; }
+        InferenceServerStats get_stats() const;
+
+    protected:
+        using clock = std::chrono::steady_clock;
+
+        struct Request{
+            std::vector<float> input;
+            std::promise<std::vector<float>> result;
+            clock::time_point arrival;
+        };
+
+        void schedule();
+        void run_batch(std::vector<Request>& requests);
+
+        Model& model;
+        InferenceServerOptions options;
+        int n_inputs;
+        int n_outputs;
+
+        std::mutex mutex;
+        std::condition_variable condition;
+        std::deque<Request> queue;
+        bool stopping;
+        std::atomic<long> n_requests;
+        std::atomic<long> n_batches;
+
+        Tensor batch;  // max_batch_size x input_dim, reused by every batch
+        std::thread scheduler;
+};
+
+InferenceServer::InferenceServer(Model& model_, InferenceServerOptions options_)
+    : model(model_), options(options_), stopping(false), n_requests(0), n_batches(0){
+    if (model.get_layers().empty()){
+        throw std::invalid_argument("InferenceServer: the model has no layer");
+    }
+    if (options.max_batch_size < 1 || options.max_delay.count() < 0){
+        throw std::invalid_argument("InferenceServer: max_batch_size must be positive and max_delay non-negative");
+    }
+    n_inputs = model.get_layers().front()->input_dim;
+    n_outputs = model.get_layers().back()->output_dim;
+    batch = Tensor(options.max_batch_size, n_inputs);
+    scheduler = std::thread(&InferenceServer::schedule, this);
+}
+
+InferenceServer::~InferenceServer(){
+    stop();
+}
+
+std::future<std::vector<float>> InferenceServer::submit(const float* sample){
+    return submit(std::vector<float>(sample, sample + n_inputs));
+}
+
+std::future<std::vector<float>> InferenceServer::submit(std::vector<float> sample){
+    if (sample.size() != n_inputs){
+        throw std::invalid_argument("InferenceServer: a sample has " + std::to_string(sample.size()) + " values instead of " + std::to_string(n_inputs));
+    }
+    Request request;
+    request.input = std::move(sample);
+    request.arrival = clock::now();
+    std::future<std::vector<float>> result = request.result.get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping){
+            throw std::logic_error("InferenceServer: submit after stop");
+        }
+        queue.push_back(std::move(request));
+    }
+    condition.notify_one();
+    return result;
+}
+
+void InferenceServer::stop(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_one();
+    if (scheduler.joinable()){
+        scheduler.join();
+    }
+}
+
+InferenceServerStats InferenceServer::get_stats() const{
+    InferenceServerStats stats;
+    stats.requests = n_requests.load(std::memory_order_relaxed);
+    stats.batches = n_batches.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void InferenceServer::schedule(){
+    std::vector<Request> requests;
+    requests.reserve(options.max_batch_size);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true){
+        condition.wait(lock, [this]{ return stopping || !queue.empty(); });
+        if (queue.empty()){
+            return;  // stopping, nothing left to answer
+        }
+        // wait for a full batch until the oldest request reaches its deadline
+        const clock::time_point deadline = queue.front().arrival + options.max_delay;
+        condition.wait_until(lock, deadline, [this]{ return stopping || queue.size() >= options.max_batch_size; });
+
+        const int batch_size = std::min<std::size_t>(queue.size(), options.max_batch_size);
+        for (int i = 0; i < batch_size; ++i){
+            requests.push_back(std::move(queue.front()));
+            queue.pop_front();
+        }
+        lock.unlock();
+        run_batch(requests);
+        requests.clear();
+        lock.lock();
+    }
+}
+
+void InferenceServer::run_batch(std::vector<Request>& requests){
+    const int batch_size = requests.size();
+    try{
+        for (int i = 0; i < batch_size; ++i){
+            std::copy(requests[i].input.begin(), requests[i].input.end(), batch.data() + static_cast<std::size_t>(i) * n_inputs);
+        }
+        const Tensor outputs = model.predict(ConstTensorView(batch).slice_rows(0, batch_size));
+        for (int i = 0; i < batch_size; ++i){
+            const float* row = outputs.data() + static_cast<std::size_t>(i) * n_outputs;
+            requests[i].result.set_value(std::vector<float>(row, row + n_outputs));
+        }
+    }
+    catch (...){
+        // every request of the batch fails with the same error
+        for (Request& request : requests){
+            try{
+                request.result.set_exception(std::current_exception());
+            }
+            catch (const std::future_error&){
+                // already answered
+            }
+        }
+    }
+    n_requests.fetch_add(batch_size, std::memory_order_relaxed);
+    n_batches.fetch_add(1, std::memory_order_relaxed);
+}
+
+// ----- Unix socket front end -----
+
+/*
+Protocol: on connection the server sends two int32, input_dim and output_dim. The client then sends samples
+of input_dim floats and receives, in order, output_dim floats for each (native byte order, no framing).
+*/
+
+bool socket_write_all(int fd, const void* data, std::size_t size){
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0){
+        const ssize_t written = ::send(fd, bytes, size, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR){
+            continue;
+        }
+        if (written <= 0){
+            return false;
+        }
+        bytes += written;
+        size -= written;
+    }
+    return true;
+}
+
+bool socket_read_all(int fd, void* data, std::size_t size){
+    char* bytes = static_cast<char*>(data);
+    while (size > 0){
+        const ssize_t read = ::recv(fd, bytes, size, 0);
+        if (read < 0 && errno == EINTR){
+            continue;
+        }
+        if (read <= 0){
+            return false;  // error, or connection closed
+        }
+        bytes += read;
+        size -= read;
+    }
+    return true;
+}
+
+sockaddr_un unix_socket_address(const std::string& path){
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)){
+        throw std::invalid_argument("Unix socket path too long: " + path);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return address;
+}
+
+class UnixSocketFrontend{
+    /*
+    Listens on "path" and serves every connection on its own thread, each request going through
+    InferenceServer::submit, so requests of concurrent connections are batched together. The threads of closed
+    connections are joined when the next connection is accepted.
+    A stale socket file at "path" is replaced.
+    */
+    public:
+        UnixSocketFrontend(InferenceServer& server_, const std::string& path_);
+        ~UnixSocketFrontend();
+        UnixSocketFrontend(const UnixSocketFrontend&) = delete;
+        UnixSocketFrontend& operator=(const UnixSocketFrontend&) = delete;
+
+        // closes the listening socket and every connection, then joins the threads
+        void stop();
+        const std::string& get_path() const { return path; }
+
+    protected:
+        void accept_connections();
+        void serve(int connection);
+        // joins the threads of closed connections; called with "mutex" held
+        void join_finished_workers();
+
+        InferenceServer& server;
+        std::string path;
+        int listen_fd;
+        std::atomic<bool> stopping;
+        std::mutex mutex;
+        std::vector<int> connections;
+        std::vector<std::thread> workers;
+        std::vector<std::thread::id> finished_workers;  // threads done serving, not joined yet
+        std::thread acceptor;
+};
+
+UnixSocketFrontend::UnixSocketFrontend(InferenceServer& server_, const std::string& path_)
+    : server(server_), path(path_), listen_fd(-1), stopping(false){
+    const sockaddr_un address = unix_socket_address(path);
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0){
+        throw std::runtime_error(std::string("UnixSocketFrontend: cannot create a socket: ") + std::strerror(errno));
+    }
+    ::unlink(path.c_str());
+    if (::bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listen_fd, 128) < 0){
+        const int error = errno;
+        ::close(listen_fd);
+        throw std::runtime_error("UnixSocketFrontend: cannot listen on " + path + ": " + std::strerror(error));
+    }
+    acceptor = std::thread(&UnixSocketFrontend::accept_connections, this);
+}
+
+UnixSocketFrontend::~UnixSocketFrontend(){
+    stop();
+}
+
+void UnixSocketFrontend::stop(){
+    if (stopping.exchange(true)){
+        return;
+    }
+    // shutdown wakes up the threads blocked in accept and recv
+    ::shutdown(listen_fd, SHUT_RDWR);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int connection : connections){
+            ::shutdown(connection, SHUT_RDWR);
+        }
+    }
+    acceptor.join();
+    for (std::thread& worker : workers){
+        worker.join();
+    }
+    ::close(listen_fd);
+    ::unlink(path.c_str());
+}
+
+void UnixSocketFrontend::accept_connections(){
+    while (!stopping.load()){
+        const int connection = ::accept(listen_fd, nullptr, nullptr);
+        if (connection < 0){
+            if (errno == EINTR || errno == ECONNABORTED){
+                continue;
+            }
+            return;  // listening socket shut down
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopping.load()){
+            ::close(connection);
+            return;
+        }
+        join_finished_workers();
+        connections.push_back(connection);
+        workers.emplace_back(&UnixSocketFrontend::serve, this, connection);
+    }
+}
+
+void UnixSocketFrontend::join_finished_workers(){
+    // a finished thread only has to return from serve, which no longer takes the lock
+    for (std::thread::id id : finished_workers){
+        auto worker = std::find_if(workers.begin(), workers.end(), [&](const std::thread& thread){ return thread.get_id() == id; });
+        worker->join();
+        workers.erase(worker);
+    }
+    finished_workers.clear();
+}
+
+void UnixSocketFrontend::serve(int connection){
+    const std::int32_t dims[2] = {server.input_dim(), server.output_dim()};
+    std::vector<float> sample(server.input_dim());
+    if (socket_write_all(connection, dims, sizeof(dims))){
+        while (socket_read_all(connection, sample.data(), sample.size() * sizeof(float))){
+            std::vector<float> result;
+            try{
+                result = server.submit(sample).get();
+            }
+            catch (const std::exception&){
+                break;  // server stopped or forward pass failed: the client sees the connection close
+            }
+            if (!socket_write_all(connection, result.data(), result.size() * sizeof(float))){
+                break;
+            }
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    connections.erase(std::find(connections.begin(), connections.end(), connection));
+    ::close(connection);
+    finished_workers.push_back(std::this_thread::get_id());
+}
+
+class UnixSocketClient{
+    /*
+    Blocking client of UnixSocketFrontend, for one thread at a time.
+    */
+    public:
+        UnixSocketClient(const std::string& path);
+        ~UnixSocketClient();
+        UnixSocketClient(const UnixSocketClient&) = delete;
+        UnixSocketClient& operator=(const UnixSocketClient&) = delete;
+
+        std::vector<float> predict(const float* sample);
+        int input_dim() const { return n_inputs; }
+        int output_dim() const { return n_outputs; }
+
+    protected:
+        int fd;
+        int n_inputs;
+        int n_outputs;
+};
+
+UnixSocketClient::UnixSocketClient(const std::string& path){
+    const sockaddr_un address = unix_socket_address(path);
+    fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0){
+        throw std::runtime_error(std::string("UnixSocketClient: cannot create a socket: ") + std::strerror(errno));
+    }
+    std::int32_t dims[2];
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0 || !socket_read_all(fd, dims, sizeof(dims))){
+        const int error = errno;
+        ::close(fd);
+        throw std::runtime_error("UnixSocketClient: cannot connect to " + path + ": " + std::strerror(error));
+    }
+    n_inputs = dims[0];
+    n_outputs = dims[1];
+}
+
+UnixSocketClient::~UnixSocketClient(){
+    ::close(fd);
+}
+
+std::vector<float> UnixSocketClient::predict(const float* sample){
+    std::vector<float> result(n_outputs);
+    if (!socket_write_all(fd, sample, n_inputs * sizeof(float)) || !socket_read_all(fd, result.data(), n_outputs * sizeof(float))){
+        throw std::runtime_error("UnixSocketClient: connection lost");
+    }
+    return result;
+}
+
+// ----- load generator -----
+
+struct LoadReport{
+    int clients;
+    long requests;
+    double seconds;
+    double throughput;  // requests per second
+    double p50_us;      // latency percentiles, in microseconds
+    double p99_us;
+};
+
+template <typename MakeClient>
+LoadReport generate_load(MakeClient make_client, const ConstTensorView samples, int clients, double seconds){
+    /*
+    Closed loop: "clients" threads each send one request, wait for its result and send the next, cycling over
+    the rows of "samples", for "seconds". make_client() is called once on each thread and returns the
+    callable sending one request: std::vector<float>(const float* sample).
+    */
+    using clock = std::chrono::steady_clock;
+    std::vector<std::vector<double>> latencies(clients);
+    std::vector<std::thread> threads;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    const clock::time_point start = clock::now();
+    const clock::time_point end = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(seconds));
+
+    for (int c = 0; c < clients; ++c){
+        threads.emplace_back([&, c](){
+            try{
+                auto client = make_client();
+                for (long i = c; clock::now() < end; i += clients){
+                    const clock::time_point sent = clock::now();
+                    client(samples.row_data(i % samples.rows()));
+                    latencies[c].push_back(std::chrono::duration<double, std::micro>(clock::now() - sent).count());
+                }
+            }
+            catch (...){
+                std::lock_guard<std::mutex> lock(error_mutex);
+                error = std::current_exception();
+            }
+        });
+    }
+    for (std::thread& thread : threads){
+        thread.join();
+    }
+    if (error){
+        std::rethrow_exception(error);
+    }
+
+    std::vector<double> all;
+    for (const std::vector<double>& client_latencies : latencies){
+        all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+    }
+    LoadReport report;
+    report.clients = clients;
+    report.requests = all.size();
+    report.seconds = std::chrono::duration<double>(clock::now() - start).count();
+    report.throughput = report.requests / report.seconds;
+    report.p50_us = 0.;
+    report.p99_us = 0.;
+    if (!all.empty()){
+        std::sort(all.begin(), all.end());
+        report.p50_us = all[all.size() / 2];
+        report.p99_us = all[std::min(all.size() - 1, all.size() * 99 / 100)];
+    }
+    return report;
+}
@@ -2,41 +2,152 @@
 
 # include <vector>
 # include <memory>
+# include "tensor.h"
+# include "bfloat16.h"
+# include "sparse.h"
 # include "activations.h"
 # include "optimizers.h"
+# include "workspace.h"
+# include "profiler.h"
+
+struct LayerCache{
+    /*
+    What a layer keeps from a forward pass for the matching backward pass.
+    The caller owns the caches, so several threads can run the same layer on different shards.
+    Buffers of the cache and temporaries of backward are allocated from "workspace", which must not be reset
+    between a forward pass and its backward pass.
+    */
+    ConstTensorView input;            // input of the forward pass, must stay alive until backward
+    ConstCSRView sparse_input;        // input of a sparse forward pass (then "input" is empty)
+    TensorView activation_gradients;  // derivative of the activation at the pre-activation values
+    Workspace* workspace = nullptr;
+};
 
 class Layer{
     // Abstract Layer class
     public:
+        virtual ~Layer() {};
+
         int input_dim;
         int output_dim;
 
-        virtual std::vector<std::vector<float>> call(const std::vector<std::vector<float>> input) = 0;
+        // forward pass of a batch into "output" (batch x output_dim), keeping what backward needs in "cache";
+        // without a cache (inference) nothing is kept and no derivative is computed
+        virtual void forward(const ConstTensorView input, const TensorView output, LayerCache* cache) = 0;
+        // backward pass: writes dL/dinput into "grad_in" (skipped when empty) and adds scale * dL/dparameter
+        // into "parameter_gradients_" (same order as parameters())
+        virtual void backward(const ConstTensorView gradient_signal, const LayerCache& cache, const std::vector<TensorView>& parameter_gradients_, const TensorView grad_in, float scale) = 0;
+        // forward pass of a CSR batch, for a first layer with mostly-zero inputs; throws unless the layer supports it
+        virtual void forward_sparse(const ConstCSRView input, const TensorView output, LayerCache* cache);
 
-        std::vector<std::vector<float>> get_gradients();
-        std::vector<std::vector<float>> get_activation_gradients();
-        std::vector<float> call_activation(const std::vector<float>);
+        // single threaded forward/backward, with the cache kept in the layer
+        Tensor call(const ConstTensorView input);
+        Tensor apply_gradients(const ConstTensorView, std::unique_ptr<Optimizer> & optimizer);
 
-        virtual std::vector<std::vector<float>> apply_gradients(const std::vector<std::vector<float>>, std::unique_ptr<Optimizer> & optimizer) = 0;
+        Tensor get_gradients();
+        Tensor get_activation_gradients();
+        const Activation& get_activation() const;
+        void call_activation(const TensorView, const TensorView);
+
+        // trainable parameters, updated in place by the optimizer
+        virtual std::vector<TensorView> parameters();
+        // called once the optimizer has updated parameters(), so copies derived from them follow
+        virtual void sync_parameters();
+        // storage used by the forward and backward GEMMs; the parameters themselves always stay fp32
+        virtual void set_precision(Precision precision_);
+
+        // floats the layer allocates from the cache workspace for one forward and backward pass of a batch
+        virtual std::size_t workspace_size(int batch_size) const;
+        // estimated work of forward and backward on a batch, for the profiler
+        virtual ProfileCost forward_cost(int batch_size) const;
+        virtual ProfileCost backward_cost(int batch_size) const;
 
     protected:
         std::unique_ptr<Activation> activation;
 
-        std::vector<std::vector<float>> gradients;
-        std::vector<std::vector<float>> activation_gradients;
+        // state of the single threaded call / apply_gradients
+        Tensor cached_input;
+        LayerCache cache;
+        Workspace workspace;
+        Tensor gradients;  // input gradient of the last apply_gradients
+        std::vector<Tensor> parameter_gradients;  // mean parameter gradients of the last apply_gradients
 };
 
-std::vector<float> Layer::call_activation(const std::vector<float> input){
-    return activation->call(input);
+void Layer::call_activation(const TensorView values, const TensorView gradients_){
+    activation->call(values, gradients_);
+}
+
+Tensor Layer::call(const ConstTensorView input){
+    CLASSIF_NN_PROFILE_SCOPE("Layer::call", "layer", -1, forward_cost(input.rows()));
+    // the input is copied, the caller does not have to keep it alive until apply_gradients
+    cached_input = Tensor(input);
+    workspace.reset();
+    cache.workspace = &workspace;
+    Tensor output(input.rows(), output_dim);
+    forward(cached_input, output, &cache);
+    return output;
+}
+
+Tensor Layer::apply_gradients(const ConstTensorView gradient_signal, std::unique_ptr<Optimizer> & optimizer){
+    CLASSIF_NN_PROFILE_SCOPE("Layer::apply_gradients", "layer", -1, backward_cost(gradient_signal.rows()));
+    std::vector<TensorView> parameters_list = parameters();
+
+    parameter_gradients.clear();
+    std::vector<TensorView> parameter_gradients_views;
+    for (TensorView parameter : parameters_list){
+        parameter_gradients.emplace_back(parameter.rows(), parameter.cols(), 0.);
+    }
+    for (Tensor& parameter_gradient : parameter_gradients){
+        parameter_gradients_views.push_back(parameter_gradient);
+    }
+
+    gradients = Tensor(gradient_signal.rows(), input_dim);
+    backward(gradient_signal, cache, parameter_gradients_views, gradients, 1. / gradient_signal.rows());
+
+    for (int i = 0; i < parameters_list.size(); ++i){
+        CLASSIF_NN_PROFILE_SCOPE("Optimizer::apply_gradient", "optimizer", -1, optimizer->update_cost(parameters_list[i].size()));
+        optimizer->apply_gradient(parameters_list[i], parameter_gradients[i]);
+    }
+    sync_parameters();
+
+    return gradients;
+}
+
+std::vector<TensorView> Layer::parameters(){
+    return {};
+}
+
+void Layer::forward_sparse(const ConstCSRView, const TensorView, LayerCache*){
+    throw std::logic_error("This layer does not accept sparse inputs");
+}
+
+void Layer::sync_parameters(){}
+
+void Layer::set_precision(Precision){}
+
+std::size_t Layer::workspace_size(int) const{
+    return 0;
+}
+
+ProfileCost Layer::forward_cost(int) const{
+    return ProfileCost();
 }
 
-std::vector<std::vector<float>> Layer::get_gradients(){
-    std::vector<std::vector<float>> output(gradients);
+ProfileCost Layer::backward_cost(int) const{
+    return ProfileCost();
+}
+
+Tensor Layer::get_gradients(){
+    Tensor output(gradients);
     return output;
 }
 
-std::vector<std::vector<float>> Layer::get_activation_gradients(){
-    std::vector<std::vector<float>> output(activation_gradients);
+const Activation& Layer::get_activation() const{
+    return *activation;
+}
+
+Tensor Layer::get_activation_gradients(){
+    Tensor output(cache.activation_gradients);
     return output;
 }
 
@@ -50,47 +161,94 @@ std::vector<std::vector<float>> Layer::get_activation_gradients(){
 
 class WeightedLayer : public Layer{
     public:
-        std::vector<std::vector<float>> get_weights();
-        std::vector<float> get_bias();
+        Tensor get_weights();
+        Tensor get_bias();
+
+        Tensor get_weights_gradients();
+        Tensor get_bias_gradients();
+        bool has_bias() const;
 
-        std::vector<std::vector<float>> get_weights_gradients();
-        std::vector<float> get_bias_gradients();
+        std::vector<TensorView> parameters();
+        void sync_parameters();
+        // with bf16, the GEMMs read a bf16 copy of the weights (half the bytes), refreshed from the fp32
+        // weights by sync_parameters; the bias stays fp32
+        void set_precision(Precision precision_);
+        Precision get_precision() const;
 
     protected:
-        virtual std::vector<float> apply_weights(const std::vector<float>) = 0;
+        // pre-activation values of a batch: input . weights + bias
+        virtual void apply_weights(const ConstTensorView input, const TensorView output) = 0;
 
         bool use_bias;
 
-        std::vector<std::vector<float>> weights;
-        std::vector<float> bias;
-        
+        // weights: input_dim x output_dim, bias: 1 x output_dim
+        Tensor weights;
+        Tensor bias;
 
-        std::vector<std::vector<float>> weights_gradients;
-        std::vector<float> bias_gradients;
+        Precision precision = Precision::fp32;
+        BF16Tensor weights_bf16;  // rounded copy of the weights, only with Precision::bf16
 };
 
-std::vector<std::vector<float>> WeightedLayer::get_weights_gradients(){
-    return weights_gradients;
+std::vector<TensorView> WeightedLayer::parameters(){
+    if (use_bias){
+        return {weights, bias};
+    }
+    return {weights};
+}
+
+Tensor WeightedLayer::get_weights_gradients(){
+    if (parameter_gradients.empty()){
+        throw std::logic_error("Cannot call \"get_weights_gradients\" before \"apply_gradients\"");
+    }
+    return parameter_gradients[0];
 }
 
-std::vector<float> WeightedLayer::get_bias_gradients(){
+Tensor WeightedLayer::get_bias_gradients(){
     if (!use_bias){
         throw std::logic_error("Cannot call \"get_bias\" if \"use_bias=False\"");
     }
-    return bias_gradients;
+    if (parameter_gradients.size() < 2){
+        throw std::logic_error("Cannot call \"get_bias_gradients\" before \"apply_gradients\"");
+    }
+    return parameter_gradients[1];
+}
+
+void WeightedLayer::sync_parameters(){
+    if (precision == Precision::bf16){
+        convert_to_bf16(weights, weights_bf16);
+    }
+}
+
+void WeightedLayer::set_precision(Precision precision_){
+    precision = precision_;
+    if (precision == Precision::bf16){
+        weights_bf16 = BF16Tensor(weights.rows(), weights.cols());
+    }
+    else {
+        weights_bf16 = BF16Tensor();
+    }
+    sync_parameters();
+}
+
+Precision WeightedLayer::get_precision() const{
+    return precision;
+}
+
+bool WeightedLayer::has_bias() const{
+    return use_bias;
 }
 
-std::vector<std::vector<float>> WeightedLayer::get_weights(){
-    std::vector<std::vector<float>> output(weights);
+Tensor WeightedLayer::get_weights(){
+    Tensor output(weights);
     return output;
 }
 
-std::vector<float> WeightedLayer::get_bias(){
+Tensor WeightedLayer::get_bias(){
     if (!use_bias){
         throw std::logic_error("Cannot call \"get_bias\" if \"use_bias=False\"");
     }
 
-    std::vector<float> output(bias);
+    Tensor output(bias);
     return output;
 }
 
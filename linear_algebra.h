@@ -5,98 +5,164 @@
 # include <algorithm>
 # include <iostream>
 
-std::vector<float> vector_scalar_multiplication(const float scalar, const std::vector<float> vector_a){
-    std::vector<float> output;
-    std::transform(vector_a.begin(), vector_a.end(), std::back_inserter(output), [&](float x){return x * scalar; });
+# include "tensor.h"
+# include "gemm.h"
+
+bool same_shape(const ConstTensorView a, const ConstTensorView b){
+    return a.rows() == b.rows() && a.cols() == b.cols();
+}
+
+Tensor vector_scalar_multiplication(const float scalar, const ConstTensorView vector_a){
+    Tensor output(vector_a.rows(), vector_a.cols());
+    for (int r = 0; r < vector_a.rows(); ++r){
+        std::transform(vector_a.row_data(r), vector_a.row_data(r) + vector_a.cols(), output.view().row_data(r), [&](float x){return x * scalar; });
+    }
 
     return output;
 }
 
-std::vector<float>  element_wise_vector_multiplication(const std::vector<float> vector_a, const std::vector<float> vector_b){
-    if (vector_a.size() != vector_b.size()){
+void element_wise_vector_multiplication(const ConstTensorView vector_a, const ConstTensorView vector_b, const TensorView output){
+    if (!same_shape(vector_a, vector_b) || !same_shape(vector_a, output)){
         throw std::invalid_argument("vectors need to be the same size for scalar product!");
     }
-    std::vector<float> output(vector_a.size());
-    for (int i = 0; i < vector_a.size(); ++i){
-        output[i] = vector_a[i] * vector_b[i];
+    for (int r = 0; r < vector_a.rows(); ++r){
+        for (int i = 0; i < vector_a.cols(); ++i){
+            output(r, i) = vector_a(r, i) * vector_b(r, i);
+        }
     }
+}
+
+Tensor element_wise_vector_multiplication(const ConstTensorView vector_a, const ConstTensorView vector_b){
+    Tensor output(vector_a.rows(), vector_a.cols());
+    element_wise_vector_multiplication(vector_a, vector_b, output);
     return output;
 }
 
-std::vector<float> vector_addition(const std::vector<float> vector_a, const std::vector<float> vector_b){
-    if (vector_a.size() != vector_b.size()){
+Tensor vector_addition(const ConstTensorView vector_a, const ConstTensorView vector_b){
+    if (!same_shape(vector_a, vector_b)){
         throw std::invalid_argument("vectors need to be the same size for addition!");
     }
-    std::vector<float> output(vector_a.size());
-    for (int i = 0; i < vector_a.size(); ++i){
-        output[i] = vector_a[i] + vector_b[i];
+    Tensor output(vector_a.rows(), vector_a.cols());
+    for (int r = 0; r < vector_a.rows(); ++r){
+        for (int i = 0; i < vector_a.cols(); ++i){
+            output(r, i) = vector_a(r, i) + vector_b(r, i);
+        }
     }
     return output;
 }
 
-float vector_scalar_product(const std::vector<float> vector_a, const std::vector<float> vector_b){
-    if (vector_a.size() != vector_b.size()){
+float vector_scalar_product(const ConstTensorView vector_a, const ConstTensorView vector_b){
+    if (vector_a.size() != vector_b.size() || vector_a.rows() != 1 || vector_b.rows() != 1){
         throw std::invalid_argument("vectors need to be the same size for scalar product!");
     }
     float output = 0;
-    for (int i = 0; i < vector_a.size(); ++i){
-        output += vector_a[i] * vector_b[i];
+    for (int i = 0; i < vector_a.cols(); ++i){
+        output += vector_a(0, i) * vector_b(0, i);
     }
     return output;
 }
 
-std::vector<float> vector_matrix_multiplication(const std::vector<float> vector, const std::vector<std::vector<float>> matrix){
-    if (vector.size() != matrix.size()){
-        std::cerr << "ERROR: invalid shapes" << std::endl;
-        std::cerr << "ERROR: invalid shapes. Size Matrix:" << matrix.size() << "Size vector: " << vector.size() << std::endl;
+Tensor vector_matrix_multiplication(const ConstTensorView vector, const ConstTensorView matrix){
+    if (vector.rows() != 1 || vector.cols() != matrix.rows()){
+        std::cerr << "ERROR: invalid shapes. Size Matrix:" << matrix.rows() << "Size vector: " << vector.cols() << std::endl;
         throw std::invalid_argument("matrix must have same first dimensiosn as vector for scalar product!");
     }
 
-    std::vector<float> output(matrix[0].size());
+    Tensor output(1, matrix.cols());
+    gemm(vector, false, matrix, false, output);
 
-    for (int i = 0; i < matrix[0].size(); ++i) {
-        for (int j = 0; j < vector.size(); ++j) {
-            output[i] += vector[j] * matrix[j][i];
+    return output;
+}
+
+Tensor matrix_transpose(const ConstTensorView matrix){
+    Tensor output(matrix.cols(), matrix.rows());
+    for (int i =0; i < matrix.rows(); ++i){
+        for (int j = 0; j < matrix.cols(); ++j){
+            output(j, i) = matrix(i, j);
         }
     }
+    return output;
+}
+
+Tensor outer_product(const ConstTensorView vector_a, const ConstTensorView vector_b) {
+    if (vector_a.rows() != 1 || vector_b.rows() != 1){
+        throw std::invalid_argument("outer product is only defined for vectors!");
+    }
+    Tensor output(vector_a.cols(), vector_b.cols());
+
+    // a^T . b with an inner dimension of 1
+    gemm(vector_a, true, vector_b, false, output);
 
     return output;
 }
 
-std::vector<std::vector<float>> matrix_transpose(const std::vector<std::vector<float>> matrix){
-    std::vector<std::vector<float>> output(matrix[0].size(), std::vector<float>(matrix.size()));
-    for (int i =0; i < matrix.size(); ++i){
-        for (int j = 0; j < matrix[0].size(); ++j){
-            output[j][i] = matrix[i][j];
+Tensor matrix_addition(const ConstTensorView matrix_a, const ConstTensorView matrix_b) {
+    if (matrix_a.rows() != matrix_b.rows()){
+        throw std::invalid_argument("Outer dimension must be the same size for mat addition!");
+    }
+    if (matrix_a.cols() != matrix_b.cols()){
+        throw std::invalid_argument("Inner dimension must be the same size for mat addition!");
+    }
+    Tensor output(matrix_a.rows(), matrix_a.cols());
+    for (int i = 0; i < matrix_a.rows(); ++i){
+        for (int j = 0; j < matrix_a.cols(); ++j){
+            output(i, j) = matrix_a(i, j) + matrix_b(i, j);
         }
     }
     return output;
 }
 
-std::vector<std::vector<float>> outer_product(const std::vector<float> vector_a, const std::vector<float> vector_b) {
-    std::vector<std::vector<float>> output(vector_a.size(), std::vector<float>(vector_b.size()));
+void matrix_multiplication(const ConstTensorView matrix_a, const ConstTensorView matrix_b, const TensorView output, const ConstTensorView bias = ConstTensorView()){
+    /*
+    output = matrix_a . matrix_b (+ bias added to every row), for a whole batch at once.
+    The bias is added by the GEMM epilogue, while each output tile is still in cache.
+    */
+    if (matrix_a.cols() != matrix_b.rows()){
+        throw std::invalid_argument("matrix multiplication: inner dimensions do not match!");
+    }
+    if (output.rows() != matrix_a.rows() || output.cols() != matrix_b.cols()){
+        throw std::invalid_argument("matrix multiplication: invalid output shape!");
+    }
+    if (!bias.empty() && (bias.rows() != 1 || bias.cols() != output.cols())){
+        throw std::invalid_argument("matrix multiplication: bias must be a 1 x n vector!");
+    }
+
+    GemmEpilogue epilogue;
+    epilogue.bias = bias.empty() ? nullptr : bias.data();
+    gemm(matrix_a, false, matrix_b, false, output, 1.f, 0.f, epilogue);
+}
 
-    for (size_t i = 0; i < vector_a.size(); ++i) {
-        for (size_t j = 0; j < vector_b.size(); ++j) {
-            output[i][j] = vector_a[i] * vector_b[j];
+void add_matrix_column_sum(const ConstTensorView matrix, const TensorView output, const float scale = 1.){
+    // output += scale * sum over the rows of matrix (e.g. the bias gradient of a batch)
+    if (output.rows() != 1 || output.cols() != matrix.cols()){
+        throw std::invalid_argument("column sum: output must be a 1 x cols vector!");
+    }
+    float* out = output.data();
+    for (int i = 0; i < matrix.rows(); ++i){
+        const float* matrix_row = matrix.row_data(i);
+        for (int j = 0; j < matrix.cols(); ++j){
+            out[j] += scale * matrix_row[j];
         }
     }
+}
 
+Tensor matrix_column_sum(const ConstTensorView matrix, const float scale = 1.){
+    // scale * sum over the rows of matrix, as a 1 x cols vector
+    Tensor output(1, matrix.cols(), 0.);
+    add_matrix_column_sum(matrix, output, scale);
     return output;
 }
 
-std::vector<std::vector<float>> matrix_addition(const std::vector<std::vector<float>> matrix_a, const std::vector<std::vector<float>> matrix_b) {
-    if (matrix_a.size() != matrix_b.size()){
-        throw std::invalid_argument("Outer dimension must be the same size for mat addition!");
+void matrix_accumulate(const TensorView output, const ConstTensorView matrix){
+    // output += matrix, in place
+    if (!same_shape(output, matrix)){
+        throw std::invalid_argument("matrix accumulate: shapes must be the same!");
     }
-    if (matrix_a[0].size() != matrix_b[0].size()){
-        throw std::invalid_argument("Inner dimension must be the same size for mat addition!");
-    }
-    std::vector<std::vector<float>> output(matrix_a.size(), std::vector<float>(matrix_a[0].size()));
-    for (int i = 0; i < matrix_a.size(); ++i){
-        for (int j = 0; j < matrix_a[0].size(); ++j){
-            output[i][j] = matrix_a[i][j] + matrix_b[i][j];
+    for (int i = 0; i < matrix.rows(); ++i){
+        float* out = output.row_data(i);
+        const float* matrix_row = matrix.row_data(i);
+        for (int j = 0; j < matrix.cols(); ++j){
+            out[j] += matrix_row[j];
         }
     }
-    return output;
-}
\ No newline at end of file
+}
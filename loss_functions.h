@@ -5,25 +5,62 @@
 #include <cmath>
 #include <stdexcept>
 #include <memory>
+#include <string>
+
+#include "tensor.h"
+#include "activation_kernels.h"
 
 class LossFunction{
 public:
-    virtual float call(const std::vector<float> y_true, const std::vector<float> y_pred) = 0;
-    std::vector<float> get_loss_gradient();
+    // returns the loss averaged over every element of the batch, and stores its gradient
+    virtual float call(const ConstTensorView y_true, const ConstTensorView y_pred) = 0;
+    // same with integer class labels (batch x 1); by default they are expanded to one-hot rows
+    virtual float call(const ConstLabelView labels, const ConstTensorView y_pred);
+    Tensor get_loss_gradient();
+    // the stored gradient without a copy, valid until the next call
+    ConstTensorView loss_gradient_view() const;
     virtual std::unique_ptr<LossFunction> clone() = 0;
 
 protected:
-    std::vector<float> loss_gradient;
+    // both are resized in place, so calls on batches of the same size do not allocate
+    Tensor loss_gradient;
+    Tensor one_hot_labels;
 };
 
-std::vector<float> LossFunction::get_loss_gradient(){
+Tensor LossFunction::get_loss_gradient(){
+    return loss_gradient;
+}
+
+ConstTensorView LossFunction::loss_gradient_view() const{
     return loss_gradient;
 }
 
+void check_labels(const ConstLabelView labels, const ConstTensorView y_pred){
+    if (labels.rows() != y_pred.rows() || labels.cols() != 1) {
+        throw std::invalid_argument("labels must be a batch x 1 tensor with one label per row of y_pred.");
+    }
+    for (int b = 0; b < labels.rows(); ++b) {
+        if (labels(b, 0) < 0 || labels(b, 0) >= y_pred.cols()) {
+            throw std::invalid_argument("label out of range.");
+        }
+    }
+}
+
+float LossFunction::call(const ConstLabelView labels, const ConstTensorView y_pred){
+    check_labels(labels, y_pred);
+    one_hot_labels.resize(y_pred.rows(), y_pred.cols());
+    one_hot_labels.fill(0.);
+    for (int b = 0; b < labels.rows(); ++b) {
+        one_hot_labels(b, labels(b, 0)) = 1.;
+    }
+    return call(one_hot_labels, y_pred);
+}
+
 class BinaryCrossEntropyLoss : public LossFunction{
 public:
     BinaryCrossEntropyLoss() {};
-    float call(const std::vector<float> y_true, const std::vector<float> y_pred);
+    using LossFunction::call;
+    float call(const ConstTensorView y_true, const ConstTensorView y_pred);
     std::unique_ptr<LossFunction> clone();
 };
 
@@ -31,23 +68,24 @@ std::unique_ptr<LossFunction> BinaryCrossEntropyLoss::clone(){
     return std::make_unique<BinaryCrossEntropyLoss>(*this);
 }
 
-float BinaryCrossEntropyLoss::call(const std::vector<float> y_true, const std::vector<float> y_pred){
-    if (y_true.size() != y_pred.size()) {
+float BinaryCrossEntropyLoss::call(const ConstTensorView y_true, const ConstTensorView y_pred){
+    if (y_true.rows() != y_pred.rows() || y_true.cols() != y_pred.cols()) {
         throw std::invalid_argument("y_true and y_pred must be the same size.");
     }
 
     const float epsilon = 1e-8f;
     float loss = 0.0f;
-    loss_gradient.clear();
+    loss_gradient.resize(y_pred.rows(), y_pred.cols());
 
-    for (size_t i = 0; i < y_true.size(); ++i) {
-        float y = y_true[i];
-        float y_hat = std::min(0.999f, std::max(epsilon, y_pred[i]));
+    for (int b = 0; b < y_true.rows(); ++b) {
+        for (int i = 0; i < y_true.cols(); ++i) {
+            float y = y_true(b, i);
+            float y_hat = std::min(0.999f, std::max(epsilon, y_pred(b, i)));
 
-        loss += -y * std::log(y_hat) - (1.0f - y) * std::log(1.0f - y_hat);
+            loss += -y * std::log(y_hat) - (1.0f - y) * std::log(1.0f - y_hat);
 
-        float grad = -(y / y_hat) + ((1.0f - y) / (1.0f - y_hat));
-        loss_gradient.push_back(grad);
+            loss_gradient(b, i) = -(y / y_hat) + ((1.0f - y) / (1.0f - y_hat));
+        }
     }
 
     loss /= y_true.size();
@@ -58,7 +96,8 @@ float BinaryCrossEntropyLoss::call(const std::vector<float> y_true, const std::v
 class CategoricalCrossEntropyLoss : public LossFunction{
 public:
     CategoricalCrossEntropyLoss() {};
-    float call(const std::vector<float> y_true, const std::vector<float> y_pred);
+    using LossFunction::call;
+    float call(const ConstTensorView y_true, const ConstTensorView y_pred);
     std::unique_ptr<LossFunction> clone();
 };
 
@@ -66,33 +105,111 @@ std::unique_ptr<LossFunction> CategoricalCrossEntropyLoss::clone(){
     return std::make_unique<CategoricalCrossEntropyLoss>(*this);
 }
 
-float CategoricalCrossEntropyLoss::call(const std::vector<float> y_true, const std::vector<float> y_pred){
-    if (y_true.size() != y_pred.size()) {
+float CategoricalCrossEntropyLoss::call(const ConstTensorView y_true, const ConstTensorView y_pred){
+    if (y_true.rows() != y_pred.rows() || y_true.cols() != y_pred.cols()) {
         throw std::invalid_argument("y_true and y_pred must be the same size.");
     }
 
     const float epsilon = 1e-8f;
     float loss = 0.0f;
-    loss_gradient.clear();
+    loss_gradient.resize(y_pred.rows(), y_pred.cols());
 
-    for (size_t i = 0; i < y_true.size(); ++i) {
-        float y_hat = std::min(0.999f, std::max(epsilon, y_pred[i]));
-        loss += -y_true[i] * std::log(y_hat);
+    for (int b = 0; b < y_true.rows(); ++b) {
+        for (int i = 0; i < y_true.cols(); ++i) {
+            float y_hat = std::min(0.999f, std::max(epsilon, y_pred(b, i)));
+            loss += -y_true(b, i) * std::log(y_hat);
 
-        // gradient: y_hat - y_true
-        loss_gradient.push_back(y_hat - y_true[i]);
+            // gradient: y_hat - y_true
+            loss_gradient(b, i) = y_hat - y_true(b, i);
+        }
     }
 
     loss /= y_true.size();
     return loss;
 }
 
+// --- Softmax + categorical crossentropy, on logits ---
+class SoftmaxCrossEntropyLoss : public LossFunction{
+    /*
+    Fused output head: takes the logits of the last layer (use an "identity" activation) and computes
+    softmax, cross entropy and its gradient (p - y) in a single pass per row, for the whole batch.
+    The log-sum-exp form keeps it stable for any logits, no clamping is needed.
+    The loss is the mean over the batch of the per-sample cross entropy.
+    */
+public:
+    SoftmaxCrossEntropyLoss() {};
+    float call(const ConstTensorView y_true, const ConstTensorView logits);
+    float call(const ConstLabelView labels, const ConstTensorView logits);
+    std::unique_ptr<LossFunction> clone();
+
+protected:
+    // softmax of one row of logits into "probabilities", returns log(sum(exp(logits)))
+    float log_softmax_row(const float* logits, float* probabilities, int n);
+};
+
+std::unique_ptr<LossFunction> SoftmaxCrossEntropyLoss::clone(){
+    return std::make_unique<SoftmaxCrossEntropyLoss>(*this);
+}
+
+float SoftmaxCrossEntropyLoss::log_softmax_row(const float* logits, float* probabilities, int n){
+    const float max_logit = *std::max_element(logits, logits + n);
+    std::copy(logits, logits + n, probabilities);
+    exp_shifted(probabilities, n, max_logit);
+    float sum = 0.f;
+    for (int i = 0; i < n; ++i) {
+        sum += probabilities[i];
+    }
+    const float inverse_sum = 1.f / sum;
+    for (int i = 0; i < n; ++i) {
+        probabilities[i] *= inverse_sum;
+    }
+    return max_logit + std::log(sum);
+}
+
+float SoftmaxCrossEntropyLoss::call(const ConstTensorView y_true, const ConstTensorView logits){
+    if (y_true.rows() != logits.rows() || y_true.cols() != logits.cols()) {
+        throw std::invalid_argument("y_true and logits must be the same size.");
+    }
+    loss_gradient.resize(logits.rows(), logits.cols());
+
+    float loss = 0.f;
+    for (int b = 0; b < logits.rows(); ++b) {
+        const float* z = logits.row_data(b);
+        const float* y = y_true.row_data(b);
+        float* gradient = loss_gradient.view().row_data(b);
+        const float log_sum_exp = log_softmax_row(z, gradient, logits.cols());
+        // -sum(y * log p) with log p = z - lse; gradient p - y
+        for (int i = 0; i < logits.cols(); ++i) {
+            loss += y[i] * (log_sum_exp - z[i]);
+            gradient[i] -= y[i];
+        }
+    }
+    return loss / logits.rows();
+}
+
+float SoftmaxCrossEntropyLoss::call(const ConstLabelView labels, const ConstTensorView logits){
+    check_labels(labels, logits);
+    loss_gradient.resize(logits.rows(), logits.cols());
+
+    float loss = 0.f;
+    for (int b = 0; b < logits.rows(); ++b) {
+        const int label = labels(b, 0);
+        float* gradient = loss_gradient.view().row_data(b);
+        const float log_sum_exp = log_softmax_row(logits.row_data(b), gradient, logits.cols());
+        loss += log_sum_exp - logits(b, label);
+        gradient[label] -= 1.f;
+    }
+    return loss / logits.rows();
+}
+
 // --- Factory function ---
 std::unique_ptr<LossFunction> loss_function_from_str(std::string name){
     if (name == "binary_crossentropy" || name == "binarycrossentropy"){
         return std::make_unique<BinaryCrossEntropyLoss>();
     } else if (name == "categorical_crossentropy" || name == "categoricalcrossentropy") {
         return std::make_unique<CategoricalCrossEntropyLoss>();
+    } else if (name == "softmax_crossentropy" || name == "softmaxcrossentropy" || name == "sparse_categorical_crossentropy") {
+        return std::make_unique<SoftmaxCrossEntropyLoss>();
     }
     throw std::invalid_argument("unknown loss function name");
 }
@@ -0,0 +1,219 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include "tensor.h"
+#include "cpu_dispatch.h"
+#include "linear_algebra.h"
+#include "layers.h"
+#include "optimizers.h"
+#include "fullyconnected_layer.h"
+
+// Microbenchmarks of the linear_algebra.h kernels and of the fully connected layer.
+// usage: main_benchmark [--json results.json] [--min-time seconds] [--quick]
+
+struct Measurement {
+    std::string name;
+    std::string shape;
+    double seconds;   // median time of one call
+    double flops;     // floating point operations of one call
+    double bytes;     // bytes read and written by one call (compulsory traffic)
+};
+
+struct LayerMeasurement {
+    std::string activation;
+    int input_dim;
+    int output_dim;
+    int batch_size;
+    double call_samples_per_s;           // Layer::call
+    double training_samples_per_s;       // Layer::call then Layer::apply_gradients
+};
+
+// median over 5 runs of the mean time of one call, each run repeating the call for at least "min_time" / 5
+double time_call(const std::function<void()>& function, double min_time) {
+    using clock = std::chrono::steady_clock;
+    function(); // warm up caches and lazy initializations
+
+    std::vector<double> runs;
+    for (int run = 0; run < 5; ++run) {
+        long iterations = 0;
+        const auto start = clock::now();
+        double elapsed = 0.;
+        do {
+            function();
+            ++iterations;
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        } while (elapsed < min_time / 5);
+        runs.push_back(elapsed / iterations);
+    }
+    std::sort(runs.begin(), runs.end());
+    return runs[runs.size() / 2];
+}
+
+Tensor random_tensor(int rows, int cols, std::mt19937& generator) {
+    std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+    Tensor output(rows, cols);
+    for (int i = 0; i < rows; ++i) {
+        for (int j = 0; j < cols; ++j) {
+            output(i, j) = distribution(generator);
+        }
+    }
+    return output;
+}
+
+std::string shape_name(std::initializer_list<int> dims) {
+    std::string output;
+    for (int dim : dims) {
+        output += (output.empty() ? "" : "x") + std::to_string(dim);
+    }
+    return output;
+}
+
+std::vector<Measurement> benchmark_kernels(const std::vector<int>& sizes, double min_time) {
+    std::mt19937 generator(0);
+    std::vector<Measurement> results;
+    const double f = sizeof(float);
+
+    for (int n : sizes) {
+        // vector . matrix: 1 x n times n x n
+        Tensor vector = random_tensor(1, n, generator);
+        Tensor matrix = random_tensor(n, n, generator);
+        double seconds = time_call([&]() { vector_matrix_multiplication(vector, matrix); }, min_time);
+        results.push_back({"vector_matrix_multiplication", shape_name({1, n, n}), seconds, 2. * n * n, f * (n + n * static_cast<double>(n) + n)});
+
+        // outer product of two n vectors
+        Tensor other_vector = random_tensor(1, n, generator);
+        seconds = time_call([&]() { outer_product(vector, other_vector); }, min_time);
+        results.push_back({"outer_product", shape_name({n, n}), seconds, static_cast<double>(n) * n, f * (2. * n + static_cast<double>(n) * n)});
+
+        // transpose and addition of n x n matrices
+        seconds = time_call([&]() { matrix_transpose(matrix); }, min_time);
+        results.push_back({"matrix_transpose", shape_name({n, n}), seconds, 0., f * 2. * n * n});
+
+        Tensor other_matrix = random_tensor(n, n, generator);
+        seconds = time_call([&]() { matrix_addition(matrix, other_matrix); }, min_time);
+        results.push_back({"matrix_addition", shape_name({n, n}), seconds, static_cast<double>(n) * n, f * 3. * n * n});
+
+        // batched product, what the layers use: n x n times n x n
+        Tensor product(n, n);
+        seconds = time_call([&]() { matrix_multiplication(matrix, other_matrix, product); }, min_time);
+        results.push_back({"matrix_multiplication", shape_name({n, n, n}), seconds, 2. * n * n * static_cast<double>(n), f * 3. * n * n});
+    }
+    return results;
+}
+
+std::vector<LayerMeasurement> benchmark_layers(const std::vector<std::string>& activations, const std::vector<int>& batch_sizes,
+                                               const std::vector<std::pair<int, int>>& dims, double min_time) {
+    std::mt19937 generator(0);
+    std::vector<LayerMeasurement> results;
+    std::unique_ptr<Optimizer> optimizer = std::make_unique<SGDOptimizer>(0.f, "categorical_crossentropy"); // learning rate 0: weights stay the same
+
+    for (const std::pair<int, int>& dim : dims) {
+        for (const std::string& activation : activations) {
+            FullyConnectedLayer layer(dim.first, dim.second, true, activation);
+            for (int batch_size : batch_sizes) {
+                Tensor input = random_tensor(batch_size, dim.first, generator);
+                Tensor gradient_signal = random_tensor(batch_size, dim.second, generator);
+
+                const double call_seconds = time_call([&]() { layer.call(input); }, min_time);
+                const double training_seconds = time_call([&]() {
+                    layer.call(input);
+                    layer.apply_gradients(gradient_signal, optimizer);
+                }, min_time);
+                results.push_back({activation, dim.first, dim.second, batch_size, batch_size / call_seconds, batch_size / training_seconds});
+            }
+        }
+    }
+    return results;
+}
+
+void write_json(std::ostream& stream, const std::vector<Measurement>& kernels, const std::vector<LayerMeasurement>& layers) {
+    stream << "{\n";
+    stream << "  \"isa\": \"" << isa_name(active_isa()) << "\",\n";
+    stream << "  \"kernels\": [\n";
+    for (int i = 0; i < kernels.size(); ++i) {
+        const Measurement& m = kernels[i];
+        stream << "    {\"name\": \"" << m.name << "\", \"shape\": \"" << m.shape << "\", \"ns\": " << m.seconds * 1e9
+               << ", \"gflops\": " << m.flops / m.seconds * 1e-9 << ", \"gbps\": " << m.bytes / m.seconds * 1e-9 << "}"
+               << (i + 1 < kernels.size() ? "," : "") << "\n";
+    }
+    stream << "  ],\n";
+    stream << "  \"layers\": [\n";
+    for (int i = 0; i < layers.size(); ++i) {
+        const LayerMeasurement& m = layers[i];
+        stream << "    {\"layer\": \"fully_connected\", \"activation\": \"" << m.activation << "\", \"input_dim\": " << m.input_dim
+               << ", \"output_dim\": " << m.output_dim << ", \"batch_size\": " << m.batch_size
+               << ", \"call_samples_per_s\": " << m.call_samples_per_s << ", \"training_samples_per_s\": " << m.training_samples_per_s << "}"
+               << (i + 1 < layers.size() ? "," : "") << "\n";
+    }
+    stream << "  ]\n";
+    stream << "}\n";
+}
+
+int main(int argc, char** argv) {
+    std::string json_path;
+    double min_time = 0.5;
+    bool quick = false;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        }
+        else if (argument == "--min-time" && i + 1 < argc) {
+            min_time = std::atof(argv[++i]);
+        }
+        else if (argument == "--quick") {
+            quick = true;
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--json results.json] [--min-time seconds] [--quick]" << std::endl;
+            return 1;
+        }
+    }
+    if (quick) {
+        min_time = std::min(min_time, 0.05);
+    }
+
+    const std::vector<int> sizes = quick ? std::vector<int>{64, 256} : std::vector<int>{64, 128, 256, 512, 1024, 2048};
+    const std::vector<int> batch_sizes = quick ? std::vector<int>{1, 32} : std::vector<int>{1, 8, 32, 128, 512};
+    const std::vector<std::string> activations = {"identity", "relu", "leakyrelu", "sigmoid", "softmax"};
+    const std::vector<std::pair<int, int>> dims = quick ? std::vector<std::pair<int, int>>{{784, 128}}
+                                                        : std::vector<std::pair<int, int>>{{784, 128}, {1024, 1024}};
+
+    std::cout << "ISA: " << isa_name(active_isa()) << std::endl << std::endl;
+
+    std::vector<Measurement> kernels = benchmark_kernels(sizes, min_time);
+    std::cout << "kernel                        shape            time (us)    GFLOP/s     GB/s" << std::endl;
+    for (const Measurement& m : kernels) {
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-29s %-16s %10.2f %10.2f %8.2f", m.name.c_str(), m.shape.c_str(), m.seconds * 1e6, m.flops / m.seconds * 1e-9, m.bytes / m.seconds * 1e-9);
+        std::cout << line << std::endl;
+    }
+
+    std::vector<LayerMeasurement> layers = benchmark_layers(activations, batch_sizes, dims, min_time);
+    std::cout << std::endl << "fully_connected     activation  batch   call (samples/s)   call + apply_gradients (samples/s)" << std::endl;
+    for (const LayerMeasurement& m : layers) {
+        char line[160];
+        std::snprintf(line, sizeof(line), "%-19s %-11s %5d %18.0f %20.0f", shape_name({m.input_dim, m.output_dim}).c_str(), m.activation.c_str(), m.batch_size, m.call_samples_per_s, m.training_samples_per_s);
+        std::cout << line << std::endl;
+    }
+
+    if (!json_path.empty()) {
+        std::ofstream file(json_path);
+        if (!file) {
+            std::cerr << "cannot write " << json_path << std::endl;
+            return 1;
+        }
+        write_json(file, kernels, layers);
+        std::cout << std::endl << "Results written to " << json_path << std::endl;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#include <iostream>
+#include <string>
+#include "dataset.h"
+
+// Converts the MNIST CSV files ("label,pixel_1,...,pixel_784") into the binary dataset format.
+// usage: convert_mnist input.csv output.bin [--uint8]
+//   float32 (default): pixels normalized to [0, 1], batches are zero-copy views on the mapped file
+//   --uint8: raw pixels, four times smaller, normalized when batches are copied
+int main(int argc, char** argv) {
+    if (argc != 3 && !(argc == 4 && std::string(argv[3]) == "--uint8")) {
+        std::cerr << "usage: " << argv[0] << " input.csv output.bin [--uint8]" << std::endl;
+        return 1;
+    }
+    const DataType feature_type = argc == 4 ? DataType::uint8 : DataType::float32;
+
+    try {
+        convert_csv_dataset(argv[1], argv[2], feature_type, 1.0f / 255.0f);
+        MappedDataset dataset(argv[2]);
+        std::cout << argv[2] << ": " << dataset.rows() << " samples of " << dataset.cols() << " features" << std::endl;
+    }
+    catch (const std::exception& error) {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
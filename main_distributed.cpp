@@ -0,0 +1,153 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "dataset.h"
+#include "model.h"
+#include "layers.h"
+#include "optimizers.h"
+#include "fullyconnected_layer.h"
+#include "distributed.h"
+
+// Data-parallel MNIST training over several processes, each training on its own shard of the dataset.
+// usage: main_distributed [--ranks n] [--transport shm|tcp] [--epochs e] [--batch-size b]
+//                         [--rank r --addresses host:port,host:port,...]
+// Without --rank, the n ranks are forked on this host (tcp then uses 127.0.0.1, ports 29500 + rank).
+// With --rank, only that rank runs, over TCP between the given addresses (one per rank, e.g. one per host).
+// Reads MNIST_train.bin and MNIST_test.bin, written by main_mnist or main_convert_mnist.
+
+struct Options {
+    int ranks = 2;
+    std::string transport = "shm";
+    int epochs = 5;
+    int batch_size = 64;
+    int rank = -1;
+    std::vector<std::string> addresses;
+    std::uint64_t job = 0;  // shared by the forked ranks of this run only
+};
+
+int train(int rank, const Options& options) {
+    std::unique_ptr<Communicator> communicator;
+    if (options.transport == "shm") {
+        communicator = std::make_unique<SharedMemoryCommunicator>("/classif_nn_distributed", rank, options.ranks, options.job);
+    }
+    else {
+        communicator = std::make_unique<TcpRingCommunicator>(rank, options.addresses);
+    }
+
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.push_back(std::make_unique<FullyConnectedLayer>(784, 128, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(128, 64, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(64, 10, false, "identity"));
+    Model model(std::move(layers), std::make_unique<AdamOptimizer>(0.001, "softmax_crossentropy"));
+    model.set_communicator(communicator.get());
+    model.synchronize_parameters(); // every rank starts from the weights of rank 0
+    model.set_shuffle_seed(rank);   // each rank shuffles its own shard
+
+    // the file is mapped: each rank only reads the pages of its shard
+    MappedDataset train_set("MNIST_train.bin");
+    const std::pair<int, int> shard = shard_range(train_set.features().rows(), rank, communicator->size());
+    ConstTensorView x_train = train_set.features().slice_rows(shard.first, shard.second);
+    ConstLabelView y_train = train_set.labels().slice_rows(shard.first, shard.second);
+
+    const auto start = std::chrono::steady_clock::now();
+    for (int epoch = 0; epoch < options.epochs; ++epoch) {
+        model.fit(x_train, y_train, 1, options.batch_size);
+        if (rank == 0) {
+            std::cout << "Epoch " << epoch << " done" << std::endl;
+        }
+    }
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    if (rank == 0) {
+        MappedDataset test_set("MNIST_test.bin");
+        Tensor predictions = model.predict(test_set.features());
+        int correct = 0;
+        for (int i = 0; i < predictions.rows(); ++i) {
+            const float* row = predictions.row(i).data();
+            if (std::max_element(row, row + predictions.cols()) - row == test_set.labels()(i, 0)) correct++;
+        }
+        std::cout << communicator->size() << " ranks (" << options.transport << "): " << seconds << " s, "
+                  << communicator->size() * x_train.rows() * options.epochs / seconds << " samples/s, test accuracy "
+                  << 100.f * correct / predictions.rows() << "%" << std::endl;
+    }
+    communicator->barrier();
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--ranks" && i + 1 < argc) {
+            options.ranks = std::atoi(argv[++i]);
+        }
+        else if (argument == "--transport" && i + 1 < argc) {
+            options.transport = argv[++i];
+        }
+        else if (argument == "--epochs" && i + 1 < argc) {
+            options.epochs = std::atoi(argv[++i]);
+        }
+        else if (argument == "--batch-size" && i + 1 < argc) {
+            options.batch_size = std::atoi(argv[++i]);
+        }
+        else if (argument == "--rank" && i + 1 < argc) {
+            options.rank = std::atoi(argv[++i]);
+        }
+        else if (argument == "--addresses" && i + 1 < argc) {
+            const std::string list = argv[++i];
+            for (std::size_t begin = 0, end; begin <= list.size(); begin = end + 1) {
+                end = std::min(list.find(',', begin), list.size());
+                options.addresses.push_back(list.substr(begin, end - begin));
+            }
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--ranks n] [--transport shm|tcp] [--epochs e] [--batch-size b] [--rank r --addresses host:port,...]" << std::endl;
+            return 1;
+        }
+    }
+
+    if (options.rank >= 0) {
+        // one rank of a multi-host job
+        options.transport = "tcp";
+        options.ranks = options.addresses.size();
+        return train(options.rank, options);
+    }
+
+    if (options.transport == "tcp") {
+        for (int rank = 0; rank < options.ranks; ++rank) {
+            options.addresses.push_back("127.0.0.1:" + std::to_string(29500 + rank));
+        }
+    }
+    options.job = static_cast<std::uint64_t>(getpid()) << 32 ^ std::chrono::steady_clock::now().time_since_epoch().count();
+    std::vector<pid_t> children;
+    for (int rank = 0; rank < options.ranks; ++rank) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            int status = 1;
+            try {
+                status = train(rank, options);
+            }
+            catch (const std::exception& error) {
+                std::cerr << "rank " << rank << ": " << error.what() << std::endl;
+            }
+            std::cout.flush();
+            _exit(status);
+        }
+        children.push_back(pid);
+    }
+    int failures = 0;
+    for (pid_t child : children) {
+        int status = 0;
+        waitpid(child, &status, 0);
+        failures += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -1,60 +1,63 @@
+// with -DCLASSIF_NN_PROFILE, allocations are counted by the operator new of profiler.h (this file only)
+#define CLASSIF_NN_PROFILE_COUNT_ALLOCATIONS
 #include <iostream>
 #include <vector>
-#include <fstream>
-#include <sstream>
 #include <string>
+#include <thread>
+#include <algorithm>
+#include "dataset.h"
 #include "model.h"
 #include "layers.h"
 #include "optimizers.h"
 #include "fullyconnected_layer.h"
-
-// Function to read MNIST CSV files
-void load_mnist(const std::string& filename, std::vector<std::vector<float>>& images, std::vector<std::vector<float>>& labels) {
-    std::ifstream file(filename);
-    if (!file.is_open()) {
-        std::cerr << "Failed to open " << filename << std::endl;
-        exit(1);
-    }
-
-    std::string line;
-    while (std::getline(file, line)) {
-        std::stringstream ss(line);
-        std::string item;
-        std::vector<float> image(784);
-        std::vector<float> label(10, 0.0f);
-
-        // First value is the label
-        std::getline(ss, item, ',');
-        int label_val = std::stoi(item);
-        label[label_val] = 1.0f;  // one-hot encode
-
-        // Next 784 values are pixel values
-        for (int i = 0; i < 784; ++i) {
-            std::getline(ss, item, ',');
-            image[i] = std::stof(item) / 255.0f; // normalize
+#include "checkpoint.h"
+#include "quantization.h"
+#include "static_model.h"
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include <sys/stat.h>
+
+// Opens "<name>.bin", (re)converting it from the CSV file "<name>.txt" when it is missing, older than the CSV file
+// or not a valid dataset
+MappedDataset load_mnist(const std::string& name) {
+    const std::string csv_path = name + ".txt", binary_path = name + ".bin";
+    struct stat csv_status, binary_status;
+    const bool stale = stat(binary_path.c_str(), &binary_status) != 0
+                       || (stat(csv_path.c_str(), &csv_status) == 0 && csv_status.st_mtime > binary_status.st_mtime);
+    if (!stale) {
+        try {
+            return MappedDataset(binary_path);
+        }
+        catch (const std::runtime_error& error) {
+            std::cout << error.what() << std::endl;
         }
-
-        images.push_back(image);
-        labels.push_back(label);
     }
+    std::cout << "Converting " << csv_path << " to " << binary_path << std::endl;
+    convert_csv_dataset(csv_path, binary_path, DataType::float32, 1.0f / 255.0f); // normalize
+    return MappedDataset(binary_path);
 }
 
 int main() {
     FullyConnectedLayer* fc1 = new FullyConnectedLayer(784, 128, true, "relu"); // hidden layer
     FullyConnectedLayer* fc2 = new FullyConnectedLayer(128, 64, true, "relu");  // hidden layer
-    FullyConnectedLayer* fc3 = new FullyConnectedLayer(64, 10, false, "softmax"); // output 10 classes
+    FullyConnectedLayer* fc3 = new FullyConnectedLayer(64, 10, false, "identity"); // logits of the 10 classes
 
     std::vector<Layer*> layers = {fc1, fc2, fc3};
 
-    SGDOptimizer optimizer(0.01, "categorical_crossentropy"); // learning rate 0.01
+    AdamOptimizer optimizer(0.001, "softmax_crossentropy"); // learning rate 0.001, softmax fused in the loss
 
     Model model(layers, optimizer);
+    model.set_num_threads(std::max(1u, std::thread::hardware_concurrency())); // one shard per core
+    model.set_micro_batch_size(2048); // the full-batch steps below only keep the activations of 2048 samples per shard
 
-    std::vector<std::vector<float>> x_train, y_train;
-    std::vector<std::vector<float>> x_test, y_test;
-
-    load_mnist("MNIST_train.txt", x_train, y_train);
-    load_mnist("MNIST_test.txt", x_test, y_test);
+    // the datasets are mapped, not parsed: x and y are views on the files
+    MappedDataset train = load_mnist("MNIST_train");
+    MappedDataset test = load_mnist("MNIST_test");
+    ConstTensorView x_train = train.features();
+    ConstLabelView y_train = train.labels();
+    ConstTensorView x_test = test.features();
+    ConstLabelView y_test = test.labels();
 
     int epochs = 50;
     for (int epoch = 0; epoch < epochs; ++epoch) {
@@ -64,17 +67,62 @@ int main() {
         }
     }
 
-    auto predictions = model.call(x_test);
+    Tensor predictions = model.predict(x_test); // inference mode, nothing cached
     int correct = 0;
-    for (size_t i = 0; i < predictions.size(); ++i) {
-        int predicted_label = std::distance(predictions[i].begin(), std::max_element(predictions[i].begin(), predictions[i].end()));
-        int true_label = std::distance(y_test[i].begin(), std::max_element(y_test[i].begin(), y_test[i].end()));
-        if (predicted_label == true_label) correct++;
+    for (int i = 0; i < predictions.rows(); ++i) {
+        const float* predicted_row = predictions.row(i).data();
+        // softmax is monotonic, the largest logit is the predicted class
+        int predicted_label = std::distance(predicted_row, std::max_element(predicted_row, predicted_row + predictions.cols()));
+        if (predicted_label == y_test(i, 0)) correct++;
     }
 
-    float accuracy = static_cast<float>(correct) / predictions.size();
+    float accuracy = static_cast<float>(correct) / predictions.rows();
     std::cout << "\nTest Accuracy: " << accuracy * 100.0f << "%" << std::endl;
 
+    // int8 copy for inference, input ranges calibrated on the first training samples
+    QuantizedModel quantized(model, ActivationQuantization::calibrated);
+    quantized.calibrate(x_train.slice_rows(0, std::min(1000, x_train.rows())));
+    std::cout << std::endl;
+    print_report(compare_quantized(model, quantized, x_test, y_test));
+
+    // same network with its shapes fixed at compile time, for low latency single sample inference
+    using MnistNet = StaticModel<StaticDense<784, 128, ActivationKind::relu>,
+                                 StaticDense<128, 64, ActivationKind::relu>,
+                                 StaticDense<64, 10, ActivationKind::identity, false>>;
+    std::unique_ptr<MnistNet> static_net = std::make_unique<MnistNet>();
+    static_net->load(model);
+    Tensor static_predictions = static_net->predict(x_test);
+    float max_difference = 0.f;
+    for (int i = 0; i < predictions.rows(); ++i) {
+        for (int j = 0; j < predictions.cols(); ++j) {
+            max_difference = std::max(max_difference, std::abs(static_predictions(i, j) - predictions(i, j)));
+        }
+    }
+    const int samples = std::min(1000, x_test.rows());
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < samples; ++i) {
+        model.predict(x_test.slice_rows(i, i + 1));
+    }
+    const double model_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / samples;
+    start = std::chrono::steady_clock::now();
+    int static_correct = 0;
+    for (int i = 0; i < samples; ++i) {
+        const std::array<float, 10> logits = static_net->predict(x_test.row_data(i));
+        if (std::distance(logits.begin(), std::max_element(logits.begin(), logits.end())) == y_test(i, 0)) static_correct++;
+    }
+    const double static_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / samples;
+    std::cout << std::endl << "StaticModel: max |difference| with Model::predict " << max_difference
+              << ", batch 1 latency " << static_us << " us (Model::predict " << model_us << " us), accuracy on the timed samples " << 100.f * static_correct / samples << "%" << std::endl;
+
+#ifdef CLASSIF_NN_PROFILE
+    std::cout << std::endl;
+    Profiler::instance().write_summary(std::cout);
+    Profiler::instance().write_chrome_trace("mnist_trace.json"); // open in chrome://tracing or ui.perfetto.dev
+#endif
+
+    // reload with load_checkpoint("mnist_model.ckpt") to serve or keep training without retraining
+    save_checkpoint(model, "mnist_model.ckpt");
+
     for (Layer* layer : layers) {
         delete layer;
     }
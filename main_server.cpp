@@ -0,0 +1,111 @@
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <chrono>
+#include "model.h"
+#include "layers.h"
+#include "optimizers.h"
+#include "fullyconnected_layer.h"
+#include "checkpoint.h"
+#include "inference_server.h"
+
+// Latency and throughput of the dynamic-batching inference server, in process and over a Unix socket.
+// usage: main_server [--checkpoint mnist_model.ckpt] [--socket path] [--seconds s] [--max-batch n] [--max-delay-us us]
+// Without a checkpoint, a randomly initialized 784-128-64-10 network is served.
+
+Model make_model(const std::string& checkpoint) {
+    if (!checkpoint.empty()) {
+        return load_checkpoint(checkpoint);
+    }
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.push_back(std::make_unique<FullyConnectedLayer>(784, 128, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(128, 64, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(64, 10, false, "identity"));
+    return Model(std::move(layers), std::make_unique<AdamOptimizer>(0.001, "softmax_crossentropy"));
+}
+
+void print_report(const std::string& mode, const LoadReport& report, double mean_batch_size) {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-22s %7d %14.0f %10.1f %10.1f %10.1f", mode.c_str(), report.clients, report.throughput, report.p50_us, report.p99_us, mean_batch_size);
+    std::cout << line << std::endl;
+}
+
+int main(int argc, char** argv) {
+    std::string checkpoint;
+    std::string socket_path = "/tmp/classif_nn_server.sock";
+    double seconds = 1.;
+    InferenceServerOptions options;
+    for (int i = 1; i < argc; ++i) {
+        const std::string argument = argv[i];
+        if (argument == "--checkpoint" && i + 1 < argc) {
+            checkpoint = argv[++i];
+        }
+        else if (argument == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+        }
+        else if (argument == "--seconds" && i + 1 < argc) {
+            seconds = std::atof(argv[++i]);
+        }
+        else if (argument == "--max-batch" && i + 1 < argc) {
+            options.max_batch_size = std::atoi(argv[++i]);
+        }
+        else if (argument == "--max-delay-us" && i + 1 < argc) {
+            options.max_delay = std::chrono::microseconds(std::atol(argv[++i]));
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [--checkpoint path] [--socket path] [--seconds s] [--max-batch n] [--max-delay-us us]" << std::endl;
+            return 1;
+        }
+    }
+
+    Model model = make_model(checkpoint);
+    const int input_dim = model.get_layers().front()->input_dim;
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> distribution(0.f, 1.f);
+    Tensor samples(1024, input_dim);
+    for (int i = 0; i < samples.rows(); ++i) {
+        for (int j = 0; j < input_dim; ++j) {
+            samples(i, j) = distribution(generator);
+        }
+    }
+
+    std::cout << "mode                   clients  throughput/s    p50 us     p99 us  avg batch" << std::endl;
+
+    // baseline: one Model::predict per request, from a single thread
+    LoadReport baseline = generate_load([&]() {
+        return [&](const float* sample) {
+            return model.predict(ConstTensorView(sample, 1, input_dim));
+        };
+    }, samples, 1, seconds);
+    print_report("Model::predict", baseline, 1.);
+
+    InferenceServer server(model, options);
+    const std::vector<int> client_counts = {1, 4, 16, 64, 256};
+    for (int clients : client_counts) {
+        const InferenceServerStats before = server.get_stats();
+        LoadReport report = generate_load([&]() {
+            return [&](const float* sample) { return server.submit(sample).get(); };
+        }, samples, clients, seconds);
+        const InferenceServerStats after = server.get_stats();
+        print_report("in-process", report, static_cast<double>(after.requests - before.requests) / std::max(1l, after.batches - before.batches));
+    }
+
+    UnixSocketFrontend frontend(server, socket_path);
+    for (int clients : client_counts) {
+        const InferenceServerStats before = server.get_stats();
+        LoadReport report = generate_load([&]() {
+            auto client = std::make_shared<UnixSocketClient>(socket_path);
+            return [client](const float* sample) { return client->predict(sample); };
+        }, samples, clients, seconds);
+        const InferenceServerStats after = server.get_stats();
+        print_report("unix socket", report, static_cast<double>(after.requests - before.requests) / std::max(1l, after.batches - before.batches));
+    }
+
+    frontend.stop();
+    server.stop();
+    return 0;
+}
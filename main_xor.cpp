@@ -16,18 +16,18 @@ int main() {
 
     Model model(layers, optimizer);
 
-    std::vector<std::vector<float>> x_train = {
+    Tensor x_train(std::vector<std::vector<float>>{
         {0.0f, 0.0f},
         {0.0f, 1.0f},
         {1.0f, 0.0f},
         {1.0f, 1.0f}
-    };
-    std::vector<std::vector<float>> y_train = {
+    });
+    Tensor y_train(std::vector<std::vector<float>>{
         {0.0f},
         {1.0f},
         {1.0f},
         {0.0f}
-    };
+    });
 
     for (int epoch = 0; epoch < 100000; ++epoch) {
         float loss = model.training_step(x_train, y_train);
@@ -38,10 +38,10 @@ int main() {
 
     auto predictions = model.call(x_train);
     std::cout << "\nPredictions after training:\n";
-    for (size_t i = 0; i < predictions.size(); ++i) {
-        std::cout << "Input: [" << x_train[i][0] << ", " << x_train[i][1] 
-                  << "] -> Predicted: " << predictions[i][0] 
-                  << ", True: " << y_train[i][0] << std::endl;
+    for (int i = 0; i < predictions.rows(); ++i) {
+        std::cout << "Input: [" << x_train(i, 0) << ", " << x_train(i, 1) 
+                  << "] -> Predicted: " << predictions(i, 0) 
+                  << ", True: " << y_train(i, 0) << std::endl;
     }
 
     for (Layer* layer : layers) {
@@ -0,0 +1,104 @@
+# pragma once
+
+# include <string>
+# include <cstddef>
+# include <cstring>
+# include <cerrno>
+# include <stdexcept>
+# include <utility>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+
+class MappedFile{
+    /*
+    Memory mapping of a whole file. Pages are loaded by the kernel on first access
+    and shared with the page cache, so opening a large file costs nothing until it is read.
+    The mapping is read-only, or private copy-on-write: writes then only copy the touched pages into
+    the process and never reach the file. Move-only; the mapping is released with the object.
+    */
+    public:
+        MappedFile() : ptr(nullptr), length(0), writable(false) {};
+        explicit MappedFile(const std::string& path, bool copy_on_write = false);
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile();
+
+        const unsigned char* data() const { return ptr; }
+        std::size_t size() const { return length; }
+        // only for copy-on-write mappings
+        unsigned char* writable_data() const;
+
+        // hints the kernel about the upcoming access pattern (MADV_SEQUENTIAL, MADV_RANDOM, MADV_WILLNEED, ...)
+        void advise(int advice) const;
+
+    private:
+        unsigned char* ptr;
+        std::size_t length;
+        bool writable;
+};
+
+MappedFile::MappedFile(const std::string& path, bool copy_on_write) : ptr(nullptr), length(0), writable(copy_on_write){
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0){
+        throw std::runtime_error("MappedFile: cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat status;
+    if (::fstat(fd, &status) != 0){
+        const int error = errno;
+        ::close(fd);
+        throw std::runtime_error("MappedFile: cannot stat " + path + ": " + std::strerror(error));
+    }
+    length = status.st_size;
+    if (length > 0){
+        const int protection = copy_on_write ? PROT_READ | PROT_WRITE : PROT_READ;
+        void* mapping = ::mmap(nullptr, length, protection, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED){
+            const int error = errno;
+            ::close(fd);
+            throw std::runtime_error("MappedFile: cannot map " + path + ": " + std::strerror(error));
+        }
+        ptr = static_cast<unsigned char*>(mapping);
+    }
+    // the mapping stays valid once the descriptor is closed
+    ::close(fd);
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept : ptr(other.ptr), length(other.length), writable(other.writable){
+    other.ptr = nullptr;
+    other.length = 0;
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept{
+    if (this != &other){
+        if (ptr){
+            ::munmap(ptr, length);
+        }
+        ptr = std::exchange(other.ptr, nullptr);
+        length = std::exchange(other.length, 0);
+        writable = other.writable;
+    }
+    return *this;
+}
+
+MappedFile::~MappedFile(){
+    if (ptr){
+        ::munmap(ptr, length);
+    }
+}
+
+void MappedFile::advise(int advice) const{
+    if (ptr){
+        ::madvise(ptr, length, advice);
+    }
+}
+
+unsigned char* MappedFile::writable_data() const{
+    if (!writable){
+        throw std::logic_error("MappedFile: the mapping is read-only");
+    }
+    return ptr;
+}
@@ -2,114 +2,974 @@
 
 # include <vector>
 # include <memory>
+# include <algorithm>
 # include <stdexcept>
-#include <unistd.h>
+# include <cstdint>
+# include <cstring>
+# include <atomic>
+# include <mutex>
+# include <random>
+# include <numeric>
+# include <functional>
+# include <limits>
 
+# include "tensor.h"
 # include "layers.h"
 # include "optimizers.h"
+# include "thread_pool.h"
+# include "batch_pipeline.h"
+# include "workspace.h"
+# include "profiler.h"
+# include "distributed.h"
+
+struct HogwildProgress{
+    int epoch;
+    long batches;  // batches trained on since the start of fit_hogwild
+    float loss;    // mean loss of the batches since the previous report
+};
+
+struct HogwildOptions{
+    bool shuffle = true;
+    // every "monitor_interval" batches (0: never), "monitor" is called by the worker that finished the batch
+    long monitor_interval = 0;
+    std::function<void(const HogwildProgress&)> monitor;
+};
+
+struct ActivationCheckpointPlan{
+    std::vector<int> checkpoints;     // for Model::set_activation_checkpoints
+    std::size_t workspace_size = 0;   // floats of the workspace of a shard
+    double recompute_flops = 0.;      // forward work run again by every step
+};
 
 class Model{
     public:
-        //Model(std::vector<Layer*>, std::unique_ptr<Optimizer>);
-        Model(std::vector<Layer*> layers, const SGDOptimizer& optimizer_);
+        Model(std::vector<Layer*>, std::unique_ptr<Optimizer>);
+        Model(std::vector<Layer*> layers, const Optimizer& optimizer_);
+        // the model owns these layers (e.g. built by load_checkpoint)
+        Model(std::vector<std::unique_ptr<Layer>> layers, std::unique_ptr<Optimizer>);
+
+        const std::vector<Layer*>& get_layers() const;
+        Optimizer& get_optimizer();
 
-        std::vector<std::vector<float>> call(std::vector<std::vector<float>>);
-        float training_step(std::vector<std::vector<float>>, std::vector<std::vector<float>>);
-        void fit(std::vector<std::vector<float>>, std::vector<std::vector<float>>, int);
-        void fit(std::vector<std::vector<float>> x_train, std::vector<std::vector<float>> y_train, int epochs, int batch_size);
+        Tensor call(const ConstTensorView);
+        // inference only: no layer keeps its input and no activation derivative is computed
+        Tensor predict(const ConstTensorView);
+        float training_step(const ConstTensorView, const ConstTensorView);
+        float training_step(const ConstTensorView, const ConstLabelView);
+        // CSR batches, for a first layer with mostly-zero inputs (see sparse.h): the first layer only reads and
+        // updates the weight rows of the inputs that are non-zero somewhere in the batch
+        Tensor call(const ConstCSRView);
+        Tensor predict(const ConstCSRView);
+        float training_step(const ConstCSRView, const ConstTensorView);
+        float training_step(const ConstCSRView, const ConstLabelView);
+        void fit(const ConstTensorView, const ConstTensorView, int);
+        // mini-batch training; batches are shuffled every epoch and assembled on a background thread
+        void fit(const ConstTensorView x_train, const ConstTensorView y_train, int epochs, int batch_size, bool shuffle = true);
+        void fit(const ConstTensorView x_train, const ConstLabelView labels, int epochs, int batch_size, bool shuffle = true);
+        // Hogwild (asynchronous SGD): every thread of the pool pulls its own mini-batches and applies its optimizer
+        // updates straight to the shared parameters, with no lock and no gradient reduction. Concurrent updates
+        // race on the weights (benignly: a lost update is another stochastic perturbation), so results are not
+        // reproducible. Best for sparse inputs, where workers seldom touch the same weight rows.
+        // Any optimizer works (the races extend to its moment buffers, its step count is atomic); bf16 layers are
+        // rejected, since refreshing their bf16 weights would race with the other workers' GEMMs.
+        // Returns the mean loss of every epoch.
+        std::vector<float> fit_hogwild(const ConstTensorView x_train, const ConstTensorView y_train, int epochs, int batch_size, const HogwildOptions& options = HogwildOptions());
+        std::vector<float> fit_hogwild(const ConstTensorView x_train, const ConstLabelView labels, int epochs, int batch_size, const HogwildOptions& options = HogwildOptions());
+        std::vector<float> fit_hogwild(const ConstCSRView x_train, const ConstTensorView y_train, int epochs, int batch_size, const HogwildOptions& options = HogwildOptions());
+        std::vector<float> fit_hogwild(const ConstCSRView x_train, const ConstLabelView labels, int epochs, int batch_size, const HogwildOptions& options = HogwildOptions());
+        // Gradient accumulation: every shard runs forward and backward on at most "micro_batch_size" samples at a
+        // time, adding their gradients up before the single optimizer update of the step. The update is the one
+        // of the whole batch, while activations and caches only take the memory of a micro-batch.
+        // 0 (default): each shard processes its whole slice of the batch at once.
+        void set_micro_batch_size(int micro_batch_size_);
+        int get_micro_batch_size() const { return micro_batch_size; }
+        // Activation checkpointing: the forward pass only keeps the outputs of the layers in "checkpoints"
+        // (increasing indices, the last layer excluded). The layers between two checkpoints run forward again, with
+        // their caches, right before their backward pass, so the workspace holds the checkpoints and the caches of
+        // one segment instead of the caches of every layer. Gradients are unchanged. Empty (default): none.
+        void set_activation_checkpoints(const std::vector<int>& checkpoints);
+        const std::vector<int>& get_activation_checkpoints() const { return activation_checkpoints; }
+        // checkpoints of the smallest workspace for a shard running forward and backward on "rows" samples at once
+        // (its slice of the batch, or the micro-batch size), among those recomputing at most "recompute_budget"
+        // forward passes per step (0: no checkpoint, 1: no limit)
+        ActivationCheckpointPlan plan_activation_checkpoints(int rows, double recompute_budget) const;
+        // seed of the permutations drawn by fit
+        void set_shuffle_seed(std::uint64_t seed);
+        // mixed precision: with bf16, every layer streams bf16 weights through its GEMMs while the optimizer
+        // keeps updating the fp32 master weights
+        void set_precision(Precision precision);
+
+        // Data-parallel training: every step is split in one shard per thread, run on a persistent thread pool.
+        // Results are bit-reproducible for a given number of threads.
+        void set_num_threads(int num_threads, bool pin_threads = false);
+        void set_num_threads(int num_threads, const std::vector<int>& cores);
+        int get_num_threads();
+
+        // Multi-process data parallelism (see distributed.h): every training step averages the weight gradients
+        // over the ranks of "communicator", in buckets of about "bucket_size" floats reduced while the backward
+        // pass goes on. Every rank runs the same steps with the same batch size on its own data, and
+        // training_step returns the loss of the local batch. nullptr goes back to a single process.
+        void set_communicator(Communicator* communicator_, std::size_t bucket_size = 1 << 18);
+        // copies the parameters of rank 0 to every rank (not the optimizer state), before training
+        void synchronize_parameters();
 
     protected:
+        struct Shard{
+            // forward/backward state of one slice of a batch, used by a single worker
+            std::unique_ptr<LossFunction> loss_function;
+            Workspace workspace;                // per step buffers: outputs, caches, signals and layer temporaries
+            std::vector<TensorView> outputs;    // output of each layer
+            std::vector<LayerCache> caches;     // forward state of each layer
+            std::vector<TensorView> signals;    // gradient of the loss w.r.t. the input of each layer
+            std::vector<std::vector<Tensor>> gradients;  // gradient of each parameter of each layer
+            std::vector<std::vector<TensorView>> gradients_views;
+            ConstTensorView loss_gradient;
+            float loss;
+            int num_samples;
+        };
+
+        struct HogwildWorker{
+            // mini-batch gathered by one Hogwild worker, and the first layer's weight rows it touches
+            Tensor x;
+            CSRTensor x_sparse;
+            Tensor values;
+            LabelTensor labels;
+            std::vector<int> sparse_rows;
+            std::vector<char> sparse_seen;
+            bool first_gradients_clear = false;
+        };
+
         std::unique_ptr<Optimizer> optimizer;
-        void backpropagation();
-        float compute_loss(const std::vector<std::vector<float>> y_true, const std::vector<std::vector<float>> y_pred);
-        
+        std::vector<float> fit_hogwild(const Inputs&, const Targets&, int epochs, int batch_size, const HogwildOptions& options);
+        float hogwild_step(const Inputs& x_train, const Targets& y_train, const int* samples, int num_samples, Shard& shard, HogwildWorker& worker);
+        void forward_segment(const Inputs& x_batch, Shard& shard, int begin, int end, bool training);
+        void backpropagation(Shard& shard, int begin, int end, const ConstTensorView signal, float scale);
+        float training_step(const ConstTensorView, const Targets&);
+        float training_step(const Inputs&, const Targets&);
+        Tensor predict(const Inputs&);
+        void fit(const ConstTensorView, const Targets&, int epochs, int batch_size, bool shuffle);
+        float compute_loss(const Targets& y_true, const ConstTensorView y_pred, Shard& shard);
+        void compute_gradients(const Inputs& x_batch, const Targets& y_batch, Shard& shard, float scale);
+        void accumulate_gradients(const Inputs& x_batch, const Targets& y_batch, Shard& shard, float scale, bool overlap);
+        void reduce_gradients();
+        void apply_gradients();
+        void prepare_shards(int num_shards);
+        void prepare_workspaces(int batch_size);
+        std::size_t workspace_size(const std::vector<int>& checkpoints, int rows) const;
+        void run_parallel(int num_tasks, const TaskRef task);
+
         std::vector<Layer*> layers_list;
+        std::vector<std::unique_ptr<Layer>> owned_layers;
+        std::vector<std::vector<TensorView>> parameters_list;  // parameters of each layer, queried once
+        std::vector<Shard> shards;
+        std::unique_ptr<ThreadPool> thread_pool;
+        std::uint64_t shuffle_seed = 0;
+        int micro_batch_size = 0;
+        std::vector<int> activation_checkpoints;
+
+        // sparse steps: the first layer's weight gradients are only non-zero on "sparse_rows", and are
+        // zeroed back on those rows once applied
+        bool sparse_step = false;
 
-        std::vector<std::vector<float>> loss_gradient;
+        Communicator* communicator = nullptr;
+        std::size_t allreduce_bucket_size = 0;
+        std::unique_ptr<GradientAllreduce> gradient_allreduce;  // on the gradients of shards[0]
+        bool overlap_allreduce = false;                         // backpropagation launches the buckets (last backward of a step, single shard)
+        bool first_gradients_clear = false;
+        std::vector<int> sparse_rows;
+        std::vector<char> sparse_seen;
 };
 
 
-// This does not work yet
-//Model::Model(std::vector<Layer*> layers, std::unique_ptr<Optimizer> opt)
-//    : layers_list(std::move(layers)), optimizer(std::move(opt)) {}
+Model::Model(std::vector<Layer*> layers, std::unique_ptr<Optimizer> opt)
+    : optimizer(std::move(opt)), layers_list(std::move(layers)) {
+    // allocate the optimizer state of every parameter once, instead of during the first step
+    for (Layer* layer : layers_list) {
+        parameters_list.push_back(layer->parameters());
+        for (TensorView parameter : parameters_list.back()) {
+            optimizer->register_parameter(parameter);
+        }
+    }
+}
+
+Model::Model(std::vector<Layer*> layers, const Optimizer& optimizer_) : Model(layers, optimizer_.clone()) {}
+
+Model::Model(std::vector<std::unique_ptr<Layer>> layers, std::unique_ptr<Optimizer> opt)
+    : Model(std::vector<Layer*>(), std::move(opt)) {
+    owned_layers = std::move(layers);
+    for (std::unique_ptr<Layer>& layer : owned_layers) {
+        layers_list.push_back(layer.get());
+        parameters_list.push_back(layer->parameters());
+        for (TensorView parameter : parameters_list.back()) {
+            optimizer->register_parameter(parameter);
+        }
+    }
+}
 
-Model::Model(std::vector<Layer*> layers, const SGDOptimizer& optimizer_) {
-    layers_list = layers;
-    optimizer = std::make_unique<SGDOptimizer>(optimizer_);
-    optimizer->loss_function = optimizer_.loss_function->clone();
+const std::vector<Layer*>& Model::get_layers() const {
+    return layers_list;
 }
 
-float Model::compute_loss(const std::vector<std::vector<float>> y_true, const std::vector<std::vector<float>> y_pred){
-    float loss = 0.;
-    loss_gradient.clear();
-    for (int b = 0; b < y_true.size(); ++b){
-        if (!optimizer->loss_function){
-            throw std::logic_error("Loss function undefined");
+Optimizer& Model::get_optimizer() {
+    return *optimizer;
+}
+
+void Model::set_num_threads(int num_threads, bool pin_threads) {
+    thread_pool = num_threads > 1 || pin_threads ? std::make_unique<ThreadPool>(num_threads, pin_threads) : nullptr;
+}
+
+void Model::set_num_threads(int num_threads, const std::vector<int>& cores) {
+    thread_pool = std::make_unique<ThreadPool>(num_threads, cores);
+}
+
+void Model::set_shuffle_seed(std::uint64_t seed) {
+    shuffle_seed = seed;
+}
+
+int Model::get_num_threads() {
+    return thread_pool ? thread_pool->size() : 1;
+}
+
+void Model::set_communicator(Communicator* communicator_, std::size_t bucket_size) {
+    gradient_allreduce = nullptr;
+    communicator = communicator_;
+    allreduce_bucket_size = bucket_size;
+}
+
+void Model::synchronize_parameters() {
+    if (!communicator) {
+        throw std::logic_error("synchronize_parameters: no communicator");
+    }
+    for (int i = 0; i < layers_list.size(); ++i) {
+        for (TensorView parameter : parameters_list[i]) {
+            communicator->broadcast(parameter.data(), parameter.size(), 0);
+        }
+        layers_list[i]->sync_parameters();
+    }
+}
+
+void Model::set_micro_batch_size(int micro_batch_size_) {
+    if (micro_batch_size_ < 0) {
+        throw std::invalid_argument("The micro-batch size must be positive, or 0 to disable micro-batching");
+    }
+    micro_batch_size = micro_batch_size_;
+}
+
+void Model::set_activation_checkpoints(const std::vector<int>& checkpoints) {
+    for (int k = 0; k < checkpoints.size(); ++k) {
+        if (checkpoints[k] < 0 || checkpoints[k] >= static_cast<int>(layers_list.size()) - 1 || (k > 0 && checkpoints[k] <= checkpoints[k - 1])) {
+            throw std::invalid_argument("Activation checkpoints must be increasing layer indices, the last layer excluded");
         }
-        loss += optimizer->loss_function->call(y_true[b], y_pred[b]);
-        loss_gradient.push_back(optimizer->loss_function->get_loss_gradient());
     }
-    loss /= y_pred.size();
+    activation_checkpoints = checkpoints;
+}
+
+ActivationCheckpointPlan Model::plan_activation_checkpoints(int rows, double recompute_budget) const {
+    if (rows <= 0 || recompute_budget < 0.) {
+        throw std::invalid_argument("Planning activation checkpoints needs a positive number of rows and budget");
+    }
+    const int num_layers = layers_list.size();
+    // forward flops of the layers before each index: with a checkpoint on layer e - 1, layers [0, e) are recomputed
+    std::vector<double> flops(num_layers + 1, 0.);
+    for (int i = 0; i < num_layers; ++i) {
+        flops[i + 1] = flops[i] + layers_list[i]->forward_cost(rows).flops;
+    }
+    const double budget = recompute_budget * flops[num_layers];
+
+    // workspace of the recomputed segment [b, e): outputs but the checkpoint's, signals but the input's, temporaries
+    std::vector<std::vector<std::size_t>> segment_size(num_layers, std::vector<std::size_t>(num_layers, 0));
+    std::vector<std::size_t> bounds;
+    for (int b = 0; b < num_layers; ++b) {
+        std::size_t size = 0;
+        for (int e = b + 1; e < num_layers; ++e) {
+            size += layers_list[e - 1]->workspace_size(rows);
+            if (e - 1 > b) {
+                size += Workspace::allocation_size(rows, layers_list[e - 2]->output_dim) + Workspace::allocation_size(rows, layers_list[e - 1]->input_dim);
+            }
+            segment_size[b][e] = size;
+            bounds.push_back(size);
+        }
+    }
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+
+    ActivationCheckpointPlan best;
+    best.workspace_size = workspace_size({}, rows);
+    // for every bound on the recomputed segments, the checkpoints of least total size ending on layer e - 1
+    // (dynamic programming over e), of which the one of smallest actual workspace is kept
+    const std::size_t none = std::numeric_limits<std::size_t>::max();
+    for (std::size_t bound : bounds) {
+        std::vector<std::size_t> kept(num_layers, none);
+        std::vector<int> previous(num_layers, -1);
+        kept[0] = 0;
+        for (int e = 1; e < num_layers && flops[e] <= budget; ++e) {
+            for (int b = 0; b < e; ++b) {
+                if (kept[b] != none && segment_size[b][e] <= bound) {
+                    const std::size_t size = kept[b] + Workspace::allocation_size(rows, layers_list[e - 1]->output_dim);
+                    if (size < kept[e]) {
+                        kept[e] = size;
+                        previous[e] = b;
+                    }
+                }
+            }
+            if (kept[e] == none) {
+                continue;
+            }
+            std::vector<int> checkpoints;
+            for (int c = e; c > 0; c = previous[c]) {
+                checkpoints.push_back(c - 1);
+            }
+            std::reverse(checkpoints.begin(), checkpoints.end());
+            const std::size_t size = workspace_size(checkpoints, rows);
+            if (size < best.workspace_size || (size == best.workspace_size && flops[e] < best.recompute_flops)) {
+                best.checkpoints = checkpoints;
+                best.workspace_size = size;
+                best.recompute_flops = flops[e];
+            }
+        }
+    }
+    return best;
+}
+
+void Model::run_parallel(int num_tasks, const TaskRef task) {
+    if (thread_pool) {
+        thread_pool->parallel_for(num_tasks, task);
+    }
+    else {
+        for (int i = 0; i < num_tasks; ++i) {
+            task(i);
+        }
+    }
+}
+
+void Model::prepare_shards(int num_shards) {
+    if (!optimizer->loss_function){
+        throw std::logic_error("Loss function undefined");
+    }
+    if (shards.size() == num_shards) {
+        return;
+    }
+    gradient_allreduce = nullptr;  // built on the gradients of the previous shards
+    shards = std::vector<Shard>(num_shards);
+    for (Shard& shard : shards) {
+        shard.loss_function = optimizer->loss_function->clone();
+        shard.outputs.resize(layers_list.size());
+        shard.caches.resize(layers_list.size());
+        shard.signals.resize(layers_list.size());
+        shard.gradients.resize(layers_list.size());
+        shard.gradients_views.resize(layers_list.size());
+        for (int i = 0; i < layers_list.size(); ++i) {
+            shard.caches[i].workspace = &shard.workspace;
+            for (TensorView parameter : parameters_list[i]) {
+                shard.gradients[i].emplace_back(parameter.rows(), parameter.cols(), 0.);
+            }
+            for (Tensor& gradient : shard.gradients[i]) {
+                shard.gradients_views[i].push_back(gradient);
+            }
+        }
+    }
+}
+
+void Model::prepare_workspaces(int batch_size) {
+    // the largest shard gets ceil(batch_size / num_shards) samples, processed a micro-batch at a time
+    int rows = (batch_size + shards.size() - 1) / shards.size();
+    if (micro_batch_size > 0) {
+        rows = std::min(rows, micro_batch_size);
+    }
+    const std::size_t size = workspace_size(activation_checkpoints, rows);
+    for (Shard& shard : shards) {
+        shard.workspace.reserve(size);
+    }
+}
+
+std::size_t Model::workspace_size(const std::vector<int>& checkpoints, int rows) const {
+    // kept for the whole step: the checkpoints and two buffers for the gradients passed between segments;
+    // then one segment at a time: its outputs (but a checkpoint's), backward signals (but for the segment's
+    // input) and layer temporaries. Without checkpoints, the single segment holds every layer.
+    const int num_layers = layers_list.size();
+    std::size_t kept = 0, segment_peak = 0;
+    int width = 0;
+    int begin = 0;
+    for (int k = 0; k <= checkpoints.size(); ++k) {
+        const int end = k < checkpoints.size() ? checkpoints[k] + 1 : num_layers;
+        std::size_t segment = 0;
+        for (int i = begin; i < end; ++i) {
+            if (i < end - 1 || end == num_layers) {
+                segment += Workspace::allocation_size(rows, layers_list[i]->output_dim);
+            }
+            if (i > begin) {
+                segment += Workspace::allocation_size(rows, layers_list[i]->input_dim);
+            }
+            segment += layers_list[i]->workspace_size(rows);
+        }
+        if (end < num_layers) {
+            kept += Workspace::allocation_size(rows, layers_list[end - 1]->output_dim);
+            width = std::max(width, layers_list[end - 1]->output_dim);
+        }
+        segment_peak = std::max(segment_peak, segment);
+        begin = end;
+    }
+    if (!checkpoints.empty()) {
+        kept += 2 * Workspace::allocation_size(rows, width);
+    }
+    return kept + segment_peak;
+}
+
+float Model::compute_loss(const Targets& y_true, const ConstTensorView y_pred, Shard& shard){
+    CLASSIF_NN_PROFILE_SCOPE("Model::compute_loss", "model");
+    float loss = y_true.labels.empty() ? shard.loss_function->call(y_true.values, y_pred) : shard.loss_function->call(y_true.labels, y_pred);
+    shard.loss_gradient = shard.loss_function->loss_gradient_view();
     return loss;
 }
 
-void Model::backpropagation(){
-    if (loss_gradient.empty()){
+void Model::forward_segment(const Inputs& x_batch, Shard& shard, int begin, int end, bool training){
+    // layers [begin, end) on the batch or on the output of layer begin - 1; the output of a segment ending before
+    // the last layer is a checkpoint, allocated by the caller. Without "training" no cache is filled.
+    ConstTensorView current = begin == 0 ? x_batch.dense : shard.outputs[begin - 1];
+    for (int i = begin; i < end; ++i) {
+        CLASSIF_NN_PROFILE_SCOPE("Layer::forward", "layer", i, layers_list[i]->forward_cost(x_batch.rows()));
+        if (i < end - 1 || end == layers_list.size()) {
+            shard.outputs[i] = shard.workspace.allocate(x_batch.rows(), layers_list[i]->output_dim);
+        }
+        LayerCache* cache = training ? &shard.caches[i] : nullptr;
+        if (i == 0 && x_batch.is_sparse()) {
+            layers_list[i]->forward_sparse(x_batch.sparse, shard.outputs[i], cache);
+        }
+        else {
+            layers_list[i]->forward(current, shard.outputs[i], cache);
+        }
+        current = shard.outputs[i];
+    }
+}
+
+void Model::backpropagation(Shard& shard, int begin, int end, const ConstTensorView signal, float scale){
+    // backward of layers [begin, end) from "signal", the gradient w.r.t. the output of layer end - 1; the gradient
+    // w.r.t. the input of layer begin goes to shard.signals[begin], allocated by the caller
+    CLASSIF_NN_PROFILE_SCOPE("Model::backpropagation", "model");
+    if (signal.empty()){
         throw std::logic_error("Calling function backpropagation before the gradient is initialized.");
     }
 
-    std::vector<std::vector<float>> current_layer_gradient(loss_gradient);
+    ConstTensorView current_layer_gradient = signal;
+
+    for (int i = end - 1; i >= begin; --i) {
+        // the first layer does not need the gradient w.r.t. its input
+        TensorView grad_in;
+        if (i > 0) {
+            if (i > begin) {
+                shard.signals[i] = shard.workspace.allocate(current_layer_gradient.rows(), layers_list[i]->input_dim);
+            }
+            grad_in = shard.signals[i];
+        }
+        CLASSIF_NN_PROFILE_SCOPE("Layer::backward", "layer", i, layers_list[i]->backward_cost(current_layer_gradient.rows()));
+        layers_list[i]->backward(current_layer_gradient, shard.caches[i], shard.gradients_views[i], grad_in, scale);
+        if (overlap_allreduce) {
+            // with a single shard the gradients of layer i are final: reduce them across processes meanwhile
+            gradient_allreduce->layer_ready(i);
+        }
+        current_layer_gradient = grad_in;
+    }
+}
+
+void Model::compute_gradients(const Inputs& x_batch, const Targets& y_batch, Shard& shard, float scale){
+    // forward, loss and backward of one shard; adds scale * gradients into the shard's gradients
+    const int num_layers = layers_list.size();
+    const int rows = x_batch.rows();
+    const std::vector<int>& checkpoints = activation_checkpoints;
+    const int last_begin = checkpoints.empty() ? 0 : checkpoints.back() + 1;  // first layer of the last segment
+    std::size_t last_mark;
+    {
+        CLASSIF_NN_PROFILE_SCOPE("Model::forward", "model");
+        // the gradients w.r.t. the checkpoints alternate between two buffers: the one a segment reads and the
+        // one it writes for the segment before
+        if (!checkpoints.empty()) {
+            int width = 0;
+            for (int checkpoint : checkpoints) {
+                width = std::max(width, layers_list[checkpoint]->output_dim);
+            }
+            const TensorView buffers[2] = {shard.workspace.allocate(rows, width), shard.workspace.allocate(rows, width)};
+            for (int k = 0; k < checkpoints.size(); ++k) {
+                shard.signals[checkpoints[k] + 1] = TensorView(buffers[k % 2].data(), rows, layers_list[checkpoints[k]]->output_dim);
+            }
+        }
+        // segments before the last: only their checkpoint is kept
+        int begin = 0;
+        for (int checkpoint : checkpoints) {
+            shard.outputs[checkpoint] = shard.workspace.allocate(rows, layers_list[checkpoint]->output_dim);
+            const std::size_t mark = shard.workspace.mark();
+            forward_segment(x_batch, shard, begin, checkpoint + 1, false);
+            shard.workspace.rewind(mark);
+            begin = checkpoint + 1;
+        }
+        last_mark = shard.workspace.mark();
+        forward_segment(x_batch, shard, last_begin, num_layers, true);
+    }
+    shard.loss = compute_loss(y_batch, num_layers > 0 ? ConstTensorView(shard.outputs.back()) : x_batch.dense, shard);
+    backpropagation(shard, last_begin, num_layers, shard.loss_gradient, scale);
+    shard.workspace.rewind(last_mark);
+
+    // the other segments from the last: forward again from the previous checkpoint, now with caches, then backward.
+    // The segment's output overwrites its checkpoint, which the next segment's backward pass no longer needs.
+    for (int k = checkpoints.size() - 1; k >= 0; --k) {
+        const int begin = k > 0 ? checkpoints[k - 1] + 1 : 0;
+        {
+            CLASSIF_NN_PROFILE_SCOPE("Model::recompute", "model");
+            forward_segment(x_batch, shard, begin, checkpoints[k] + 1, true);
+        }
+        backpropagation(shard, begin, checkpoints[k] + 1, shard.signals[checkpoints[k] + 1], scale);
+        shard.workspace.rewind(last_mark);
+    }
+}
+
+void Model::accumulate_gradients(const Inputs& x_batch, const Targets& y_batch, Shard& shard, float scale, bool overlap){
+    // the shard's samples, "micro_batch_size" at a time: micro-batches add their gradients into the shard's, every
+    // one scaled by "scale"; shard.loss ends up as the mean loss of all the samples
+    const int rows = x_batch.rows();
+    const int step = micro_batch_size > 0 ? micro_batch_size : std::max(1, rows);
+    float loss = 0.;
+    for (int begin = 0; begin < rows; begin += step) {
+        const int end = std::min(rows, begin + step);
+        shard.workspace.reset();
+        // only the last backward pass of the step produces final gradients
+        if (overlap) {
+            overlap_allreduce = end == rows;
+        }
+        compute_gradients(x_batch.slice_rows(begin, end), y_batch.slice_rows(begin, end), shard, scale);
+        loss += shard.loss * (end - begin);
+    }
+    shard.loss = rows > 0 ? loss / rows : 0.f;
+}
 
-    for (std::vector<Layer*>::reverse_iterator riter = layers_list.rbegin(); riter != layers_list.rend(); ++riter) 
-    { 
-        current_layer_gradient = (*riter)->apply_gradients(current_layer_gradient, optimizer);
-    } 
+void Model::reduce_gradients(){
+    CLASSIF_NN_PROFILE_SCOPE("Model::reduce_gradients", "model");
+    // pairwise tree reduction into the first shard; the order of the sums only depends on the number of shards
+    const int num_shards = shards.size();
+    for (int stride = 1; stride < num_shards; stride *= 2) {
+        // shards 0, 2 * stride, 4 * stride, ... receive the shard "stride" after them
+        const int num_targets = (num_shards - stride + 2 * stride - 1) / (2 * stride);
+        run_parallel(num_targets, [&](int t){
+            Shard& target = shards[2 * stride * t];
+            Shard& source = shards[2 * stride * t + stride];
+            for (int i = 0; i < layers_list.size(); ++i) {
+                for (int p = 0; p < target.gradients[i].size(); ++p) {
+                    if (i == 0 && p == 0 && sparse_step) {
+                        for (int r : sparse_rows) {
+                            matrix_accumulate(target.gradients[i][p].row(r), source.gradients[i][p].row(r));
+                        }
+                    }
+                    else {
+                        matrix_accumulate(target.gradients[i][p], source.gradients[i][p]);
+                    }
+                }
+            }
+        });
+    }
 }
 
-std::vector<std::vector<float>> Model::call(std::vector<std::vector<float>> inputs) {
-    std::vector<std::vector<float>> outputs = inputs;
+void Model::apply_gradients(){
+    for (int i = 0; i < layers_list.size(); ++i) {
+        for (int p = 0; p < parameters_list[i].size(); ++p) {
+            CLASSIF_NN_PROFILE_SCOPE("Optimizer::apply_gradient", "optimizer", i, optimizer->update_cost(parameters_list[i][p].size()));
+            if (i == 0 && p == 0 && sparse_step) {
+                optimizer->apply_gradient_rows(parameters_list[i][p], shards[0].gradients[i][p], sparse_rows);
+            }
+            else {
+                optimizer->apply_gradient(parameters_list[i][p], shards[0].gradients[i][p]);
+            }
+        }
+        layers_list[i]->sync_parameters();
+    }
 
+    // leave the first layer's weight gradients zero for the next sparse step, without a dense fill
+    first_gradients_clear = sparse_step;
+    if (sparse_step) {
+        for (Shard& shard : shards) {
+            for (int r : sparse_rows) {
+                float* row = shard.gradients[0][0].row(r).data();
+                std::fill(row, row + shard.gradients[0][0].cols(), 0.f);
+            }
+        }
+    }
+}
+
+void Model::set_precision(Precision precision){
     for (Layer* layer : layers_list) {
-        outputs = layer->call(outputs);
+        layer->set_precision(precision);
+    }
+}
+
+Tensor Model::predict(const ConstTensorView inputs) {
+    Inputs x;
+    x.dense = inputs;
+    return predict(x);
+}
+
+Tensor Model::predict(const ConstCSRView inputs) {
+    Inputs x;
+    x.sparse = inputs;
+    return predict(x);
+}
+
+Tensor Model::predict(const Inputs& inputs) {
+    if (layers_list.empty()) {
+        return inputs.is_sparse() ? to_dense(inputs.sparse) : Tensor(inputs.dense);
+    }
+
+    CLASSIF_NN_PROFILE_SCOPE("Model::predict", "model");
+    // only two activations are alive at any time: the input and the output of the current layer
+    ConstTensorView current = inputs.dense;
+    Tensor outputs;
+
+    for (int i = 0; i < layers_list.size(); ++i) {
+        Layer* layer = layers_list[i];
+        CLASSIF_NN_PROFILE_SCOPE("Layer::forward", "layer", i, layer->forward_cost(inputs.rows()));
+        Tensor layer_output(inputs.rows(), layer->output_dim);
+        if (i == 0 && inputs.is_sparse()) {
+            layer->forward_sparse(inputs.sparse, layer_output, nullptr);
+        }
+        else {
+            layer->forward(current, layer_output, nullptr);
+        }
+        outputs = std::move(layer_output);
+        current = outputs;
     }
 
     return outputs;
 }
 
-float Model::training_step(std::vector<std::vector<float>> x_batch, std::vector<std::vector<float>> y_batch) {
-    std::vector<std::vector<float>> predictions = call(x_batch);
-    float loss = compute_loss(y_batch, predictions);
-    backpropagation();
-    return loss;
+Tensor Model::call(const ConstTensorView inputs) {
+    // training goes through training_step, which keeps its own per-shard caches
+    return predict(inputs);
+}
+
+Tensor Model::call(const ConstCSRView inputs) {
+    return predict(inputs);
 }
 
-void Model::fit(std::vector<std::vector<float>> x_train, std::vector<std::vector<float>> y_train, int epochs) {
-    if (x_train.size() != y_train.size()) {
+float Model::training_step(const ConstTensorView x_batch, const ConstTensorView y_batch) {
+    Targets targets;
+    targets.values = y_batch;
+    return training_step(x_batch, targets);
+}
+
+float Model::training_step(const ConstTensorView x_batch, const ConstLabelView labels) {
+    Targets targets;
+    targets.labels = labels;
+    return training_step(x_batch, targets);
+}
+
+float Model::training_step(const ConstCSRView x_batch, const ConstTensorView y_batch) {
+    Inputs inputs;
+    inputs.sparse = x_batch;
+    Targets targets;
+    targets.values = y_batch;
+    return training_step(inputs, targets);
+}
+
+float Model::training_step(const ConstCSRView x_batch, const ConstLabelView labels) {
+    Inputs inputs;
+    inputs.sparse = x_batch;
+    Targets targets;
+    targets.labels = labels;
+    return training_step(inputs, targets);
+}
+
+float Model::training_step(const ConstTensorView x_batch, const Targets& y_batch) {
+    Inputs inputs;
+    inputs.dense = x_batch;
+    return training_step(inputs, y_batch);
+}
+
+float Model::training_step(const Inputs& x_batch, const Targets& y_batch) {
+    if (x_batch.rows() != y_batch.rows()) {
+        throw std::invalid_argument("Size of x_batch and y_batch must match.");
+    }
+    CLASSIF_NN_PROFILE_STEP();
+    CLASSIF_NN_PROFILE_SCOPE("Model::training_step", "model");
+    const int num_shards = get_num_threads();
+    prepare_shards(num_shards);
+    const int batch_size = x_batch.rows();
+    prepare_workspaces(batch_size);
+
+    const float scale = 1. / batch_size;
+
+    // the first layer's weight gradients are dense unless every sparse step leaves them zero
+    const bool skip_first_fill = x_batch.is_sparse() && first_gradients_clear;
+    first_gradients_clear = false;  // until this step is applied
+    // across processes the other ranks' gradients fill other rows: the first layer is then updated densely
+    sparse_step = x_batch.is_sparse() && !layers_list.empty() && !parameters_list[0].empty() && !communicator;
+    if (sparse_step) {
+        csr_active_columns(x_batch.sparse, sparse_rows, sparse_seen);
+    }
+
+    if (communicator && !gradient_allreduce) {
+        gradient_allreduce = std::make_unique<GradientAllreduce>(*communicator, shards[0].gradients_views, allreduce_bucket_size);
+    }
+    const bool overlap = gradient_allreduce && num_shards == 1 && batch_size > 0;
+    overlap_allreduce = false;
+
+    run_parallel(num_shards, [&](int s){
+        // contiguous, fixed slices: shard s always gets the same samples for a given batch
+        const int begin = static_cast<long>(batch_size) * s / num_shards;
+        const int end = static_cast<long>(batch_size) * (s + 1) / num_shards;
+        Shard& shard = shards[s];
+        shard.workspace.reset();
+        for (int i = 0; i < shard.gradients.size(); ++i) {
+            for (int p = 0; p < shard.gradients[i].size(); ++p) {
+                if (!(i == 0 && p == 0 && skip_first_fill)) {
+                    shard.gradients[i][p].fill(0.);
+                }
+            }
+        }
+        shard.num_samples = end - begin;
+        accumulate_gradients(x_batch.slice_rows(begin, end), y_batch.slice_rows(begin, end), shard, scale, overlap);
+    });
+    overlap_allreduce = false;
+
+    reduce_gradients();
+    if (gradient_allreduce) {
+        CLASSIF_NN_PROFILE_SCOPE("Model::allreduce_gradients", "model");
+        if (!overlap) {
+            for (int i = layers_list.size() - 1; i >= 0; --i) {
+                gradient_allreduce->layer_ready(i);
+            }
+        }
+        gradient_allreduce->wait();
+    }
+    apply_gradients();
+
+    float loss = 0.;
+    for (Shard& shard : shards) {
+        loss += shard.loss * shard.num_samples;
+    }
+    return loss / batch_size;
+}
+
+void Model::fit(const ConstTensorView x_train, const ConstTensorView y_train, int epochs) {
+    if (x_train.rows() != y_train.rows()) {
         throw std::invalid_argument("Size of x_train and y_train must match.");
     }
 
     for (int epoch = 0; epoch < epochs; ++epoch) {
+        CLASSIF_NN_PROFILE_EPOCH(epoch);
         float loss = training_step(x_train, y_train);
         std::cout << "\r epoch: " << epoch << ", loss: " << loss;;
     }
     std::cout << std::endl;
 }
 
-void Model::fit(std::vector<std::vector<float>> x_train, std::vector<std::vector<float>> y_train, int epochs, int batch_size) {
-    if (x_train.size() != y_train.size()) {
+void Model::fit(const ConstTensorView x_train, const ConstTensorView y_train, int epochs, int batch_size, bool shuffle) {
+    Targets targets;
+    targets.values = y_train;
+    fit(x_train, targets, epochs, batch_size, shuffle);
+}
+
+void Model::fit(const ConstTensorView x_train, const ConstLabelView labels, int epochs, int batch_size, bool shuffle) {
+    Targets targets;
+    targets.labels = labels;
+    fit(x_train, targets, epochs, batch_size, shuffle);
+}
+
+void Model::fit(const ConstTensorView x_train, const Targets& y_train, int epochs, int batch_size, bool shuffle) {
+    if (x_train.rows() != y_train.rows()) {
+        throw std::invalid_argument("Size of x_train and y_train must match.");
+    }
+
+    // the next batch is gathered while the current one is trained on
+    BatchPipeline pipeline(x_train, y_train, batch_size, epochs, shuffle, shuffle_seed);
+    for (const Batch* batch = pipeline.next(); batch; batch = pipeline.next()) {
+        CLASSIF_NN_PROFILE_EPOCH(batch->epoch);
+        training_step(batch->x, batch->y);
+    }
+}
+
+std::vector<float> Model::fit_hogwild(const ConstTensorView x_train, const ConstTensorView y_train, int epochs, int batch_size, const HogwildOptions& options) {
+    Inputs inputs;
+    inputs.dense = x_train;
+    Targets targets;
+    targets.values = y_train;
+    return fit_hogwild(inputs, targets, epochs, batch_size, options);
+}
+
+std::vector<float> Model::fit_hogwild(const ConstTensorView x_train, const ConstLabelView labels, int epochs, int batch_size, const HogwildOptions& options) {
+    Inputs inputs;
+    inputs.dense = x_train;
+    Targets targets;
+    targets.labels = labels;
+    return fit_hogwild(inputs, targets, epochs, batch_size, options);
+}
+
+std::vector<float> Model::fit_hogwild(const ConstCSRView x_train, const ConstTensorView y_train, int epochs, int batch_size, const HogwildOptions& options) {
+    Inputs inputs;
+    inputs.sparse = x_train;
+    Targets targets;
+    targets.values = y_train;
+    return fit_hogwild(inputs, targets, epochs, batch_size, options);
+}
+
+std::vector<float> Model::fit_hogwild(const ConstCSRView x_train, const ConstLabelView labels, int epochs, int batch_size, const HogwildOptions& options) {
+    Inputs inputs;
+    inputs.sparse = x_train;
+    Targets targets;
+    targets.labels = labels;
+    return fit_hogwild(inputs, targets, epochs, batch_size, options);
+}
+
+std::vector<float> Model::fit_hogwild(const Inputs& x_train, const Targets& y_train, int epochs, int batch_size, const HogwildOptions& options) {
+    if (x_train.rows() != y_train.rows()) {
         throw std::invalid_argument("Size of x_train and y_train must match.");
     }
+    if (batch_size < 1) {
+        throw std::invalid_argument("fit_hogwild: the batch size must be positive");
+    }
+    if (communicator) {
+        throw std::logic_error("fit_hogwild: Hogwild training runs in a single process, remove the communicator");
+    }
+    for (Layer* layer : layers_list) {
+        const WeightedLayer* weighted = dynamic_cast<const WeightedLayer*>(layer);
+        if (weighted && weighted->get_precision() == Precision::bf16) {
+            throw std::logic_error("fit_hogwild: bf16 layers are not supported, train them in fp32");
+        }
+    }
+    // one shard per worker, each holding a whole batch
+    const int num_workers = get_num_threads();
+    prepare_shards(num_workers);
+    prepare_workspaces(batch_size * num_workers);
+    first_gradients_clear = false;  // the workers dirty the gradients the synchronous steps rely on
+    std::vector<HogwildWorker> workers(num_workers);
+
+    const int num_samples = x_train.rows();
+    const long num_batches = (num_samples + batch_size - 1) / batch_size;
+    std::vector<int> permutation(num_samples);
+    std::iota(permutation.begin(), permutation.end(), 0);
+    std::mt19937_64 generator(shuffle_seed);
 
-    const int num_samples = x_train.size();
+    // monitoring statistics; the lock is never held while the parameters are read or written
+    std::mutex monitor_mutex;
+    long monitored_batches = 0;
+    long batches_since_report = 0;
+    double loss_since_report = 0.;
 
+    std::vector<float> epoch_losses;
     for (int epoch = 0; epoch < epochs; ++epoch) {
-        for (int i = 0; i < num_samples; i += batch_size) {
-            int end = std::min(i + batch_size, num_samples);
+        CLASSIF_NN_PROFILE_EPOCH(epoch);
+        if (options.shuffle) {
+            std::shuffle(permutation.begin(), permutation.end(), generator);
+        }
+        std::atomic<long> next_batch(0);
+        std::vector<double> worker_losses(num_workers, 0.);
+
+        run_parallel(num_workers, [&](int w){
+            // workers only meet at the end of the epoch
+            for (long b = next_batch.fetch_add(1, std::memory_order_relaxed); b < num_batches; b = next_batch.fetch_add(1, std::memory_order_relaxed)) {
+                const int begin = b * batch_size;
+                const int end = std::min<long>(begin + batch_size, num_samples);
+                const float loss = hogwild_step(x_train, y_train, permutation.data() + begin, end - begin, shards[w], workers[w]);
+                worker_losses[w] += static_cast<double>(loss) * (end - begin);
+
+                if (options.monitor_interval > 0 && options.monitor) {
+                    std::lock_guard<std::mutex> lock(monitor_mutex);
+                    ++monitored_batches;
+                    ++batches_since_report;
+                    loss_since_report += loss;
+                    if (monitored_batches % options.monitor_interval == 0) {
+                        options.monitor(HogwildProgress{epoch, monitored_batches, static_cast<float>(loss_since_report / batches_since_report)});
+                        batches_since_report = 0;
+                        loss_since_report = 0.;
+                    }
+                }
+            }
+        });
+
+        double loss = 0.;
+        for (double worker_loss : worker_losses) {
+            loss += worker_loss;
+        }
+        epoch_losses.push_back(loss / num_samples);
+    }
+    return epoch_losses;
+}
+
+float Model::hogwild_step(const Inputs& x_train, const Targets& y_train, const int* samples, int num_samples, Shard& shard, HogwildWorker& worker) {
+    CLASSIF_NN_PROFILE_STEP();
+    CLASSIF_NN_PROFILE_SCOPE("Model::hogwild_step", "model");
+    // gather the samples into the worker's own buffers
+    Inputs x;
+    if (x_train.is_sparse()) {
+        const ConstCSRView& source = x_train.sparse;
+        CSRTensor& batch = worker.x_sparse;
+        batch.rows = num_samples;
+        batch.cols = source.cols();
+        batch.offsets.assign(1, 0);
+        batch.indices.clear();
+        batch.values.clear();
+        for (int r = 0; r < num_samples; ++r) {
+            const long begin = source.row_begin(samples[r]), end = source.row_end(samples[r]);
+            batch.indices.insert(batch.indices.end(), source.indices() + begin, source.indices() + end);
+            batch.values.insert(batch.values.end(), source.values() + begin, source.values() + end);
+            batch.offsets.push_back(batch.indices.size());
+        }
+        x.sparse = batch;
+    }
+    else {
+        worker.x.resize(num_samples, x_train.cols());
+        for (int r = 0; r < num_samples; ++r) {
+            std::memcpy(worker.x.view().row_data(r), x_train.dense.row_data(samples[r]), x_train.cols() * sizeof(float));
+        }
+        x.dense = worker.x;
+    }
+    Targets y;
+    if (y_train.labels.empty()) {
+        worker.values.resize(num_samples, y_train.values.cols());
+        for (int r = 0; r < num_samples; ++r) {
+            std::memcpy(worker.values.view().row_data(r), y_train.values.row_data(samples[r]), y_train.values.cols() * sizeof(float));
+        }
+        y.values = worker.values;
+    }
+    else {
+        worker.labels.resize(num_samples, 1);
+        for (int r = 0; r < num_samples; ++r) {
+            worker.labels(r, 0) = y_train.labels(samples[r], 0);
+        }
+        y.labels = worker.labels;
+    }
 
-            std::vector<std::vector<float>> x_batch(x_train.begin() + i, x_train.begin() + end);
-            std::vector<std::vector<float>> y_batch(y_train.begin() + i, y_train.begin() + end);
+    // gradients of this batch only, in the worker's shard
+    const bool sparse = x.is_sparse() && !parameters_list[0].empty();
+    if (sparse) {
+        csr_active_columns(x.sparse, worker.sparse_rows, worker.sparse_seen);
+    }
+    shard.workspace.reset();
+    for (int i = 0; i < shard.gradients.size(); ++i) {
+        for (int p = 0; p < shard.gradients[i].size(); ++p) {
+            if (!(i == 0 && p == 0 && sparse && worker.first_gradients_clear)) {
+                shard.gradients[i][p].fill(0.);
+            }
+        }
+    }
+    worker.first_gradients_clear = false;
+    shard.num_samples = num_samples;
+    accumulate_gradients(x, y, shard, 1.f / num_samples, false);
 
-            training_step(x_batch, y_batch);
+    // lock-free updates of the shared parameters
+    for (int i = 0; i < layers_list.size(); ++i) {
+        for (int p = 0; p < parameters_list[i].size(); ++p) {
+            CLASSIF_NN_PROFILE_SCOPE("Optimizer::apply_gradient", "optimizer", i, optimizer->update_cost(parameters_list[i][p].size()));
+            if (i == 0 && p == 0 && sparse) {
+                optimizer->apply_gradient_rows(parameters_list[i][p], shard.gradients[i][p], worker.sparse_rows);
+            }
+            else {
+                optimizer->apply_gradient(parameters_list[i][p], shard.gradients[i][p]);
+            }
         }
+        layers_list[i]->sync_parameters();
     }
-}
\ No newline at end of file
+    if (sparse) {
+        for (int r : worker.sparse_rows) {
+            float* row = shard.gradients[0][0].row(r).data();
+            std::fill(row, row + shard.gradients[0][0].cols(), 0.f);
+        }
+        worker.first_gradients_clear = true;
+    }
+    return shard.loss;
+}
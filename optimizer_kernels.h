@@ -0,0 +1,171 @@
+# pragma once
+
+# include <cstddef>
+# include <cmath>
+# include <immintrin.h>
+
+# include "cpu_dispatch.h"
+
+/*
+Fused, in-place parameter update kernels. Each kernel makes a single pass over a contiguous
+parameter buffer, its gradient and its state buffers, without any temporary.
+Scalar, AVX2/FMA and AVX-512 variants are dispatched with the same ISA selection as the GEMM.
+*/
+
+struct MomentumParameters{
+    float learning_rate;
+    float momentum;
+    bool nesterov;
+};
+
+struct AdamParameters{
+    // learning rate and epsilon with the bias corrections of the current step folded in
+    float step_size;
+    float beta_1;
+    float beta_2;
+    float epsilon;
+};
+
+// ----- plain SGD: w -= lr * g -----
+
+void sgd_update_scalar(float* __restrict w, const float* __restrict g, std::size_t n, float learning_rate){
+    for (std::size_t i = 0; i < n; ++i){
+        w[i] -= learning_rate * g[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void sgd_update_avx2(float* __restrict w, const float* __restrict g, std::size_t n, float learning_rate){
+    const __m256 minus_lr = _mm256_set1_ps(-learning_rate);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        _mm256_storeu_ps(w + i, _mm256_fmadd_ps(minus_lr, _mm256_loadu_ps(g + i), _mm256_loadu_ps(w + i)));
+    }
+    sgd_update_scalar(w + i, g + i, n - i, learning_rate);
+}
+
+__attribute__((target("avx512f")))
+void sgd_update_avx512(float* __restrict w, const float* __restrict g, std::size_t n, float learning_rate){
+    const __m512 minus_lr = _mm512_set1_ps(-learning_rate);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        _mm512_storeu_ps(w + i, _mm512_fmadd_ps(minus_lr, _mm512_loadu_ps(g + i), _mm512_loadu_ps(w + i)));
+    }
+    sgd_update_scalar(w + i, g + i, n - i, learning_rate);
+}
+
+void sgd_update(float* w, const float* g, std::size_t n, float learning_rate){
+    switch (active_isa()){
+        case Isa::avx512: sgd_update_avx512(w, g, n, learning_rate); break;
+        case Isa::avx2: sgd_update_avx2(w, g, n, learning_rate); break;
+        default: sgd_update_scalar(w, g, n, learning_rate);
+    }
+}
+
+// ----- SGD with momentum: v = mu * v + g, w -= lr * v (or lr * (g + mu * v) with Nesterov) -----
+
+void momentum_update_scalar(float* __restrict w, const float* __restrict g, float* __restrict v, std::size_t n, const MomentumParameters& p){
+    for (std::size_t i = 0; i < n; ++i){
+        v[i] = p.momentum * v[i] + g[i];
+        const float step = p.nesterov ? g[i] + p.momentum * v[i] : v[i];
+        w[i] -= p.learning_rate * step;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void momentum_update_avx2(float* __restrict w, const float* __restrict g, float* __restrict v, std::size_t n, const MomentumParameters& p){
+    const __m256 mu = _mm256_set1_ps(p.momentum);
+    const __m256 minus_lr = _mm256_set1_ps(-p.learning_rate);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        const __m256 g_i = _mm256_loadu_ps(g + i);
+        const __m256 v_i = _mm256_fmadd_ps(mu, _mm256_loadu_ps(v + i), g_i);
+        const __m256 step = p.nesterov ? _mm256_fmadd_ps(mu, v_i, g_i) : v_i;
+        _mm256_storeu_ps(v + i, v_i);
+        _mm256_storeu_ps(w + i, _mm256_fmadd_ps(minus_lr, step, _mm256_loadu_ps(w + i)));
+    }
+    momentum_update_scalar(w + i, g + i, v + i, n - i, p);
+}
+
+__attribute__((target("avx512f")))
+void momentum_update_avx512(float* __restrict w, const float* __restrict g, float* __restrict v, std::size_t n, const MomentumParameters& p){
+    const __m512 mu = _mm512_set1_ps(p.momentum);
+    const __m512 minus_lr = _mm512_set1_ps(-p.learning_rate);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        const __m512 g_i = _mm512_loadu_ps(g + i);
+        const __m512 v_i = _mm512_fmadd_ps(mu, _mm512_loadu_ps(v + i), g_i);
+        const __m512 step = p.nesterov ? _mm512_fmadd_ps(mu, v_i, g_i) : v_i;
+        _mm512_storeu_ps(v + i, v_i);
+        _mm512_storeu_ps(w + i, _mm512_fmadd_ps(minus_lr, step, _mm512_loadu_ps(w + i)));
+    }
+    momentum_update_scalar(w + i, g + i, v + i, n - i, p);
+}
+
+void momentum_update(float* w, const float* g, float* v, std::size_t n, const MomentumParameters& p){
+    switch (active_isa()){
+        case Isa::avx512: momentum_update_avx512(w, g, v, n, p); break;
+        case Isa::avx2: momentum_update_avx2(w, g, v, n, p); break;
+        default: momentum_update_scalar(w, g, v, n, p);
+    }
+}
+
+// ----- Adam: m = b1 * m + (1 - b1) * g, v = b2 * v + (1 - b2) * g^2, w -= step * m / (sqrt(v) + eps) -----
+
+void adam_update_scalar(float* __restrict w, const float* __restrict g, float* __restrict m, float* __restrict v, std::size_t n, const AdamParameters& p){
+    for (std::size_t i = 0; i < n; ++i){
+        m[i] = p.beta_1 * m[i] + (1.f - p.beta_1) * g[i];
+        v[i] = p.beta_2 * v[i] + (1.f - p.beta_2) * g[i] * g[i];
+        w[i] -= p.step_size * m[i] / (std::sqrt(v[i]) + p.epsilon);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void adam_update_avx2(float* __restrict w, const float* __restrict g, float* __restrict m, float* __restrict v, std::size_t n, const AdamParameters& p){
+    const __m256 beta_1 = _mm256_set1_ps(p.beta_1);
+    const __m256 one_minus_beta_1 = _mm256_set1_ps(1.f - p.beta_1);
+    const __m256 beta_2 = _mm256_set1_ps(p.beta_2);
+    const __m256 one_minus_beta_2 = _mm256_set1_ps(1.f - p.beta_2);
+    const __m256 minus_step = _mm256_set1_ps(-p.step_size);
+    const __m256 epsilon = _mm256_set1_ps(p.epsilon);
+    std::size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        const __m256 g_i = _mm256_loadu_ps(g + i);
+        const __m256 m_i = _mm256_fmadd_ps(beta_1, _mm256_loadu_ps(m + i), _mm256_mul_ps(one_minus_beta_1, g_i));
+        const __m256 v_i = _mm256_fmadd_ps(beta_2, _mm256_loadu_ps(v + i), _mm256_mul_ps(one_minus_beta_2, _mm256_mul_ps(g_i, g_i)));
+        const __m256 denominator = _mm256_add_ps(_mm256_sqrt_ps(v_i), epsilon);
+        _mm256_storeu_ps(m + i, m_i);
+        _mm256_storeu_ps(v + i, v_i);
+        _mm256_storeu_ps(w + i, _mm256_fmadd_ps(minus_step, _mm256_div_ps(m_i, denominator), _mm256_loadu_ps(w + i)));
+    }
+    adam_update_scalar(w + i, g + i, m + i, v + i, n - i, p);
+}
+
+__attribute__((target("avx512f")))
+void adam_update_avx512(float* __restrict w, const float* __restrict g, float* __restrict m, float* __restrict v, std::size_t n, const AdamParameters& p){
+    const __m512 beta_1 = _mm512_set1_ps(p.beta_1);
+    const __m512 one_minus_beta_1 = _mm512_set1_ps(1.f - p.beta_1);
+    const __m512 beta_2 = _mm512_set1_ps(p.beta_2);
+    const __m512 one_minus_beta_2 = _mm512_set1_ps(1.f - p.beta_2);
+    const __m512 minus_step = _mm512_set1_ps(-p.step_size);
+    const __m512 epsilon = _mm512_set1_ps(p.epsilon);
+    std::size_t i = 0;
+    for (; i + 16 <= n; i += 16){
+        const __m512 g_i = _mm512_loadu_ps(g + i);
+        const __m512 m_i = _mm512_fmadd_ps(beta_1, _mm512_loadu_ps(m + i), _mm512_mul_ps(one_minus_beta_1, g_i));
+        const __m512 v_i = _mm512_fmadd_ps(beta_2, _mm512_loadu_ps(v + i), _mm512_mul_ps(one_minus_beta_2, _mm512_mul_ps(g_i, g_i)));
+        const __m512 denominator = _mm512_add_ps(_mm512_sqrt_ps(v_i), epsilon);
+        _mm512_storeu_ps(m + i, m_i);
+        _mm512_storeu_ps(v + i, v_i);
+        _mm512_storeu_ps(w + i, _mm512_fmadd_ps(minus_step, _mm512_div_ps(m_i, denominator), _mm512_loadu_ps(w + i)));
+    }
+    adam_update_scalar(w + i, g + i, m + i, v + i, n - i, p);
+}
+
+void adam_update(float* w, const float* g, float* m, float* v, std::size_t n, const AdamParameters& p){
+    switch (active_isa()){
+        case Isa::avx512: adam_update_avx512(w, g, m, v, n, p); break;
+        case Isa::avx2: adam_update_avx2(w, g, m, v, n, p); break;
+        default: adam_update_scalar(w, g, m, v, n, p);
+    }
+}
@@ -3,66 +3,300 @@
 # include <vector>
 # include <algorithm>
 # include <memory>
+# include <atomic>
 # include <string>
+# include <cmath>
+# include <stdexcept>
+# include <unordered_map>
 
+# include "tensor.h"
+# include "profiler.h"
 # include "linear_algebra.h"
 # include "loss_functions.h"
+# include "optimizer_kernels.h"
 
 class Optimizer{
+    /*
+    Abstract optimizer. Parameters are updated in place, one fused pass per parameter buffer.
+    State buffers (momentum, Adam moments, ...) are kept per parameter, keyed by its storage,
+    and have the same shape as the parameter.
+    */
     public:
+        Optimizer() : learning_rate(0.) {};
+        Optimizer(const Optimizer&);
+        virtual ~Optimizer() {};
+
         float get_learning_rate();
-        virtual std::vector<std::vector<float>> apply_gradient(const std::vector<std::vector<float>>, const std::vector<std::vector<float>>) = 0;
-        virtual std::vector<float> apply_gradient(std::vector<float>, std::vector<float>) = 0;
-        
+        virtual void apply_gradient(const TensorView parameter, const ConstTensorView gradient) = 0;
+        // update when "gradient" is zero outside "rows" (e.g. the weights of a layer fed with sparse inputs);
+        // optimizers whose update of a zero-gradient row is a no-op only visit those rows, the others update densely
+        virtual void apply_gradient_rows(const TensorView parameter, const ConstTensorView gradient, const std::vector<int>& rows);
+        virtual std::unique_ptr<Optimizer> clone() const = 0;
+
+        // estimated work of one apply_gradient on a parameter of "num_elements" values, for the profiler
+        virtual ProfileCost update_cost(std::size_t num_elements) const;
+
+        // allocates the state buffers of a parameter up front (otherwise done on its first update)
+        void register_parameter(const ConstTensorView parameter);
+
+        // what is needed to rebuild the optimizer with optimizer_from_config (e.g. from a checkpoint)
+        virtual std::string get_name() const = 0;
+        virtual std::vector<float> get_hyperparameters() const = 0;
+        std::string get_loss_name() const;
+
+        struct ParameterState{
+            std::vector<Tensor> buffers;
+            // atomic: Hogwild workers update the same parameter concurrently
+            std::atomic<long> step{0};
+
+            ParameterState() = default;
+            ParameterState(const ParameterState& other) : buffers(other.buffers), step(other.step.load()) {};
+            ParameterState(ParameterState&& other) : buffers(std::move(other.buffers)), step(other.step.load()) {};
+            ParameterState& operator=(const ParameterState& other){
+                buffers = other.buffers;
+                step = other.step.load();
+                return *this;
+            }
+            ParameterState& operator=(ParameterState&& other){
+                buffers = std::move(other.buffers);
+                step = other.step.load();
+                return *this;
+            }
+        };
+
+        // state of a parameter, nullptr if it has none yet
+        const ParameterState* find_state(const ConstTensorView parameter) const;
+        // replaces the state of a parameter, buffers having the shape of the parameter
+        void set_state(const ConstTensorView parameter, ParameterState state);
+
         std::unique_ptr<LossFunction> loss_function;
-        
+
     protected:
-        float learning_rate;
+        // number of state buffers each parameter needs
+        virtual int state_size() const = 0;
+        ParameterState& state_of(const ConstTensorView parameter);
+        void check_shapes(const ConstTensorView parameter, const ConstTensorView gradient);
 
+        float learning_rate;
+        std::string loss_name;
+        std::unordered_map<const float*, ParameterState> states;
 };
 
+Optimizer::Optimizer(const Optimizer& other) : learning_rate(other.learning_rate), loss_name(other.loss_name), states(other.states){
+    if (other.loss_function){
+        loss_function = other.loss_function->clone();
+    }
+}
+
 float Optimizer::get_learning_rate(){
     return learning_rate;
 }
 
+void Optimizer::apply_gradient_rows(const TensorView parameter, const ConstTensorView gradient, const std::vector<int>&){
+    apply_gradient(parameter, gradient);
+}
+
+void Optimizer::register_parameter(const ConstTensorView parameter){
+    state_of(parameter);
+}
+
+std::string Optimizer::get_loss_name() const{
+    return loss_name;
+}
+
+ProfileCost Optimizer::update_cost(std::size_t num_elements) const{
+    // parameter and gradient read, parameter written, each state buffer read and written
+    ProfileCost cost;
+    cost.flops = static_cast<double>(num_elements) * (2 + 4 * state_size());
+    cost.bytes = static_cast<double>(num_elements) * sizeof(float) * (3 + 2 * state_size());
+    return cost;
+}
+
+const Optimizer::ParameterState* Optimizer::find_state(const ConstTensorView parameter) const{
+    auto found = states.find(parameter.data());
+    return found == states.end() ? nullptr : &found->second;
+}
+
+void Optimizer::set_state(const ConstTensorView parameter, ParameterState state){
+    if (state.buffers.size() != state_size()){
+        throw std::invalid_argument("Optimizer: wrong number of state buffers");
+    }
+    for (const Tensor& buffer : state.buffers){
+        check_shapes(parameter, buffer);
+    }
+    states[parameter.data()] = std::move(state);
+}
+
+Optimizer::ParameterState& Optimizer::state_of(const ConstTensorView parameter){
+    auto found = states.find(parameter.data());
+    if (found != states.end()){
+        return found->second;
+    }
+    ParameterState& state = states[parameter.data()];
+    for (int i = 0; i < state_size(); ++i){
+        state.buffers.emplace_back(parameter.rows(), parameter.cols(), 0.);
+    }
+    return state;
+}
+
+void Optimizer::check_shapes(const ConstTensorView parameter, const ConstTensorView gradient){
+    if (parameter.rows() != gradient.rows() || parameter.cols() != gradient.cols()){
+        throw std::invalid_argument("Optimizer: parameter and gradient must have the same shape");
+    }
+}
+
 class SGDOptimizer : public Optimizer{
+    /*
+    Stochastic gradient descent, with optional (Nesterov) momentum.
+    */
     public:
         // SGDOptimizer(float, LossFunction&); TODO
         SGDOptimizer(float learning_rate, std::string);
-        SGDOptimizer(const SGDOptimizer&);
+        SGDOptimizer(float learning_rate, std::string, float momentum, bool nesterov = false);
 
-        std::vector<std::vector<float>> apply_gradient(const std::vector<std::vector<float>>, const std::vector<std::vector<float>>);
-        std::vector<float> apply_gradient(const std::vector<float>, const std::vector<float>);
-        std::unique_ptr<LossFunction> loss_function;
+        void apply_gradient(const TensorView, const ConstTensorView);
+        void apply_gradient_rows(const TensorView, const ConstTensorView, const std::vector<int>&);
+        std::unique_ptr<Optimizer> clone() const;
+        std::string get_name() const;
+        std::vector<float> get_hyperparameters() const;
     protected:
-        float learning_rate;
-        
+        int state_size() const;
+
+        float momentum;
+        bool nesterov;
 };
 
-SGDOptimizer::SGDOptimizer(const SGDOptimizer& other){
-    learning_rate = other.learning_rate;
-    loss_function = other.loss_function->clone();
+// SGDOptimizer::SGDOptimizer(float learning_rate, LossFunction& loss_function): std::make_unique(loss_function){} TODO
+
+SGDOptimizer::SGDOptimizer(float learning_rate_, std::string loss_name) : SGDOptimizer(learning_rate_, loss_name, 0.) {};
+
+SGDOptimizer::SGDOptimizer(float learning_rate_, std::string loss_name_, float momentum_, bool nesterov_){
+    learning_rate = learning_rate_;
+    loss_name = loss_name_;
+    loss_function = loss_function_from_str(loss_name);
+    momentum = momentum_;
+    nesterov = nesterov_;
 }
 
-// SGDOptimizer::SGDOptimizer(float learning_rate, LossFunction& loss_function): std::make_unique(loss_function){} TODO
+std::unique_ptr<Optimizer> SGDOptimizer::clone() const{
+    return std::make_unique<SGDOptimizer>(*this);
+}
+
+std::string SGDOptimizer::get_name() const{
+    return "sgd";
+}
+
+std::vector<float> SGDOptimizer::get_hyperparameters() const{
+    return {momentum, nesterov ? 1.f : 0.f};
+}
+
+int SGDOptimizer::state_size() const{
+    // velocity buffer only when momentum is used
+    return momentum != 0. ? 1 : 0;
+}
+
+void SGDOptimizer::apply_gradient(const TensorView weights, const ConstTensorView gradients){
+    check_shapes(weights, gradients);
+    if (momentum == 0.){
+        for (int r = 0; r < weights.rows(); ++r){
+            sgd_update(weights.row_data(r), gradients.row_data(r), weights.cols(), learning_rate);
+        }
+        return;
+    }
+
+    ParameterState& state = state_of(weights);
+    MomentumParameters parameters{learning_rate, momentum, nesterov};
+    TensorView velocity = state.buffers[0];
+    for (int r = 0; r < weights.rows(); ++r){
+        momentum_update(weights.row_data(r), gradients.row_data(r), velocity.row_data(r), weights.cols(), parameters);
+    }
+    ++state.step;
+}
+
+void SGDOptimizer::apply_gradient_rows(const TensorView weights, const ConstTensorView gradients, const std::vector<int>& rows){
+    // with momentum, the velocity of every row keeps moving the weights
+    if (momentum != 0.){
+        apply_gradient(weights, gradients);
+        return;
+    }
+    check_shapes(weights, gradients);
+    for (int r : rows){
+        sgd_update(weights.row_data(r), gradients.row_data(r), weights.cols(), learning_rate);
+    }
+}
 
-SGDOptimizer::SGDOptimizer(float learning_rate_, std::string loss_name){
+class AdamOptimizer : public Optimizer{
+    /*
+    Adam optimizer (Kingma & Ba), with bias corrected moment estimates.
+    */
+    public:
+        AdamOptimizer(float learning_rate, std::string);
+        AdamOptimizer(float learning_rate, std::string, float beta_1, float beta_2, float epsilon);
+
+        void apply_gradient(const TensorView, const ConstTensorView);
+        std::unique_ptr<Optimizer> clone() const;
+        std::string get_name() const;
+        std::vector<float> get_hyperparameters() const;
+    protected:
+        int state_size() const;
+
+        float beta_1;
+        float beta_2;
+        float epsilon;
+};
+
+AdamOptimizer::AdamOptimizer(float learning_rate_, std::string loss_name) : AdamOptimizer(learning_rate_, loss_name, 0.9, 0.999, 1e-7) {};
+
+AdamOptimizer::AdamOptimizer(float learning_rate_, std::string loss_name_, float beta_1_, float beta_2_, float epsilon_){
     learning_rate = learning_rate_;
+    loss_name = loss_name_;
     loss_function = loss_function_from_str(loss_name);
+    beta_1 = beta_1_;
+    beta_2 = beta_2_;
+    epsilon = epsilon_;
+}
+
+std::unique_ptr<Optimizer> AdamOptimizer::clone() const{
+    return std::make_unique<AdamOptimizer>(*this);
+}
+
+std::string AdamOptimizer::get_name() const{
+    return "adam";
+}
+
+std::vector<float> AdamOptimizer::get_hyperparameters() const{
+    return {beta_1, beta_2, epsilon};
+}
+
+int AdamOptimizer::state_size() const{
+    // first and second moments
+    return 2;
 }
 
+void AdamOptimizer::apply_gradient(const TensorView weights, const ConstTensorView gradients){
+    check_shapes(weights, gradients);
+    ParameterState& state = state_of(weights);
+    const long step = ++state.step;
+
+    // fold the bias corrections into the step size and epsilon, so the kernel does not recompute them
+    const float correction_1 = 1. - std::pow(beta_1, step);
+    const float correction_2 = std::sqrt(1. - std::pow(beta_2, step));
+    AdamParameters parameters{learning_rate * correction_2 / correction_1, beta_1, beta_2, epsilon * correction_2};
 
-std::vector<std::vector<float>> SGDOptimizer::apply_gradient(const std::vector<std::vector<float>> weights, const std::vector<std::vector<float>> gradients){
-    // matrix weights
-    std::vector<std::vector<float>>minus_lr_gradients;
-    std::transform(gradients.begin(), gradients.end(), std::back_inserter(minus_lr_gradients), [&](std::vector<float> v){return vector_scalar_multiplication(-learning_rate, v);});
-    std::vector<std::vector<float>>output(matrix_addition(weights, minus_lr_gradients));
-    return output;
+    TensorView first_moment = state.buffers[0];
+    TensorView second_moment = state.buffers[1];
+    for (int r = 0; r < weights.rows(); ++r){
+        adam_update(weights.row_data(r), gradients.row_data(r), first_moment.row_data(r), second_moment.row_data(r), weights.cols(), parameters);
+    }
 }
 
-std::vector<float> SGDOptimizer::apply_gradient(const std::vector<float> weights, const std::vector<float> gradients){
-    // vectors weights
-    std::vector<float>minus_lr_gradients(vector_scalar_multiplication(-learning_rate, gradients));
-    std::vector<float>output(vector_addition(weights, minus_lr_gradients));
-    return output;
+// --- Factory function, inverse of get_name / get_hyperparameters ---
+std::unique_ptr<Optimizer> optimizer_from_config(std::string name, float learning_rate, std::string loss_name, const std::vector<float>& hyperparameters){
+    if (name == "sgd" && hyperparameters.size() == 2){
+        return std::make_unique<SGDOptimizer>(learning_rate, loss_name, hyperparameters[0], hyperparameters[1] != 0.f);
+    }
+    if (name == "adam" && hyperparameters.size() == 3){
+        return std::make_unique<AdamOptimizer>(learning_rate, loss_name, hyperparameters[0], hyperparameters[1], hyperparameters[2]);
+    }
+    throw std::invalid_argument("unknown optimizer configuration");
 }
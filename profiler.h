@@ -0,0 +1,291 @@
+# pragma once
+
+# include <vector>
+# include <string>
+# include <map>
+# include <tuple>
+# include <memory>
+# include <mutex>
+# include <atomic>
+# include <chrono>
+# include <cstdio>
+# include <cstddef>
+# include <cstdint>
+# include <cstdlib>
+# include <fstream>
+# include <iostream>
+# include <algorithm>
+# include <stdexcept>
+# include <new>
+
+/*
+Built-in instrumentation of training and inference: every model phase, layer forward/backward and optimizer
+update becomes an event with its wall time, estimated FLOPs and bytes moved, and the number of heap
+allocations made during it. Events are exported as a Chrome trace (chrome://tracing, Perfetto) or as a
+per-epoch text summary.
+
+Everything is compiled out unless CLASSIF_NN_PROFILE is defined: the CLASSIF_NN_PROFILE_* macros then
+expand to nothing and their arguments are not evaluated. Allocations are only counted when
+CLASSIF_NN_PROFILE_COUNT_ALLOCATIONS is also defined, in exactly one translation unit, before including
+this header: it replaces the global operator new and delete.
+*/
+
+struct ProfileCost{
+    double flops = 0.;  // floating point operations
+    double bytes = 0.;  // bytes read and written, assuming every operand is touched once
+};
+
+struct ProfileEvent{
+    const char* name;
+    const char* category;
+    int layer;             // index of the layer in the model, -1 if none
+    int thread;            // index of the recording thread, in order of first event
+    int epoch;
+    long step;
+    std::uint64_t start_ns;
+    std::uint64_t duration_ns;
+    ProfileCost cost;
+    std::uint64_t allocations;
+};
+
+// heap allocations made by the calling thread (0 unless CLASSIF_NN_PROFILE_COUNT_ALLOCATIONS is defined)
+std::uint64_t& profile_allocation_count(){
+    thread_local std::uint64_t count = 0;
+    return count;
+}
+
+class Profiler{
+    /*
+    Process-wide event recorder. Each thread appends to its own buffer, so recording takes no lock
+    once a thread has recorded its first event. Reading (events, exports, clear) must not overlap
+    with training or inference.
+    */
+    public:
+        static Profiler& instance();
+
+        void record(const ProfileEvent& event);
+        // steps and epochs stamped on the next events
+        void next_step();
+        void set_epoch(int epoch_);
+        int get_epoch() const { return epoch.load(std::memory_order_relaxed); }
+        long get_step() const { return step.load(std::memory_order_relaxed); }
+        // nanoseconds since the profiler was created
+        std::uint64_t now() const;
+
+        // events of every thread, by start time
+        std::vector<ProfileEvent> events() const;
+        void clear();
+
+        void write_chrome_trace(const std::string& path) const;
+        // per epoch table: calls, time, GFLOP/s, GB/s and allocations of every (phase, layer)
+        void write_summary(std::ostream& stream) const;
+
+    private:
+        Profiler() : epoch(0), step(0), origin(std::chrono::steady_clock::now()) {};
+
+        struct ThreadBuffer{
+            int thread;
+            std::vector<ProfileEvent> events;
+        };
+        ThreadBuffer& thread_buffer();
+
+        mutable std::mutex mutex;
+        std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+        std::atomic<int> epoch;
+        std::atomic<long> step;
+        const std::chrono::steady_clock::time_point origin;
+};
+
+Profiler& Profiler::instance(){
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::ThreadBuffer& Profiler::thread_buffer(){
+    // buffers belong to the profiler, so events of a finished thread are kept
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (!buffer){
+        std::lock_guard<std::mutex> lock(mutex);
+        buffers.push_back(std::make_unique<ThreadBuffer>());
+        buffer = buffers.back().get();
+        buffer->thread = buffers.size() - 1;
+        buffer->events.reserve(1 << 12);
+    }
+    return *buffer;
+}
+
+void Profiler::record(const ProfileEvent& event){
+    ThreadBuffer& buffer = thread_buffer();
+    buffer.events.push_back(event);
+    buffer.events.back().thread = buffer.thread;
+}
+
+void Profiler::next_step(){
+    step.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Profiler::set_epoch(int epoch_){
+    epoch.store(epoch_, std::memory_order_relaxed);
+}
+
+std::uint64_t Profiler::now() const{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+std::vector<ProfileEvent> Profiler::events() const{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<ProfileEvent> output;
+    for (const std::unique_ptr<ThreadBuffer>& buffer : buffers){
+        output.insert(output.end(), buffer->events.begin(), buffer->events.end());
+    }
+    std::stable_sort(output.begin(), output.end(), [](const ProfileEvent& a, const ProfileEvent& b){ return a.start_ns < b.start_ns; });
+    return output;
+}
+
+void Profiler::clear(){
+    std::lock_guard<std::mutex> lock(mutex);
+    for (std::unique_ptr<ThreadBuffer>& buffer : buffers){
+        buffer->events.clear();
+    }
+    step.store(0);
+    epoch.store(0);
+}
+
+void Profiler::write_chrome_trace(const std::string& path) const{
+    std::ofstream file(path);
+    if (!file){
+        throw std::runtime_error("Profiler: cannot write " + path);
+    }
+    // "complete" events (ph X), timestamps and durations in microseconds
+    file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    const std::vector<ProfileEvent> all_events = events();
+    char line[512];
+    for (std::size_t i = 0; i < all_events.size(); ++i){
+        const ProfileEvent& event = all_events[i];
+        std::snprintf(line, sizeof(line),
+                      "{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, "
+                      "\"args\": {\"layer\": %d, \"epoch\": %d, \"step\": %ld, \"flops\": %.0f, \"bytes\": %.0f, \"allocations\": %llu}}%s\n",
+                      event.name, event.category, event.thread, event.start_ns * 1e-3, event.duration_ns * 1e-3,
+                      event.layer, event.epoch, event.step, event.cost.flops, event.cost.bytes,
+                      static_cast<unsigned long long>(event.allocations), i + 1 < all_events.size() ? "," : "");
+        file << line;
+    }
+    file << "]}\n";
+}
+
+void Profiler::write_summary(std::ostream& stream) const{
+    struct Totals{
+        long calls = 0;
+        double seconds = 0.;
+        ProfileCost cost;
+        std::uint64_t allocations = 0;
+    };
+    // (epoch, category, name, layer) -> totals over every thread and step of the epoch
+    std::map<std::tuple<int, std::string, std::string, int>, Totals> table;
+    for (const ProfileEvent& event : events()){
+        Totals& totals = table[std::make_tuple(event.epoch, std::string(event.category), std::string(event.name), event.layer)];
+        ++totals.calls;
+        totals.seconds += event.duration_ns * 1e-9;
+        totals.cost.flops += event.cost.flops;
+        totals.cost.bytes += event.cost.bytes;
+        totals.allocations += event.allocations;
+    }
+
+    int current_epoch = -1;
+    char line[256];
+    for (const auto& entry : table){
+        const int event_epoch = std::get<0>(entry.first);
+        if (event_epoch != current_epoch){
+            current_epoch = event_epoch;
+            stream << "epoch " << current_epoch << std::endl;
+            std::snprintf(line, sizeof(line), "  %-30s %5s %7s %11s %11s %9s %8s %7s", "phase", "layer", "calls", "total ms", "mean us", "GFLOP/s", "GB/s", "allocs");
+            stream << line << std::endl;
+        }
+        const Totals& totals = entry.second;
+        const std::string layer = std::get<3>(entry.first) < 0 ? "-" : std::to_string(std::get<3>(entry.first));
+        const double seconds = std::max(totals.seconds, 1e-12);
+        std::snprintf(line, sizeof(line), "  %-30s %5s %7ld %11.3f %11.2f %9.2f %8.2f %7llu", std::get<2>(entry.first).c_str(), layer.c_str(), totals.calls,
+                      totals.seconds * 1e3, totals.seconds * 1e6 / totals.calls, totals.cost.flops / seconds * 1e-9, totals.cost.bytes / seconds * 1e-9,
+                      static_cast<unsigned long long>(totals.allocations));
+        stream << line << std::endl;
+    }
+}
+
+class ProfileScope{
+    /*
+    Records the event of the enclosing scope when it ends. Use through CLASSIF_NN_PROFILE_SCOPE.
+    */
+    public:
+        ProfileScope(const char* name, const char* category, int layer = -1, ProfileCost cost = ProfileCost());
+        ~ProfileScope();
+        ProfileScope(const ProfileScope&) = delete;
+        ProfileScope& operator=(const ProfileScope&) = delete;
+
+    private:
+        ProfileEvent event;
+};
+
+ProfileScope::ProfileScope(const char* name, const char* category, int layer, ProfileCost cost){
+    Profiler& profiler = Profiler::instance();
+    event.name = name;
+    event.category = category;
+    event.layer = layer;
+    event.thread = 0;
+    event.epoch = profiler.get_epoch();
+    event.step = profiler.get_step();
+    event.cost = cost;
+    event.allocations = profile_allocation_count();
+    event.start_ns = profiler.now();
+}
+
+ProfileScope::~ProfileScope(){
+    Profiler& profiler = Profiler::instance();
+    event.duration_ns = profiler.now() - event.start_ns;
+    event.allocations = profile_allocation_count() - event.allocations;
+    profiler.record(event);
+}
+
+# ifdef CLASSIF_NN_PROFILE
+#     define CLASSIF_NN_PROFILE_CONCAT_(a, b) a##b
+#     define CLASSIF_NN_PROFILE_CONCAT(a, b) CLASSIF_NN_PROFILE_CONCAT_(a, b)
+      // CLASSIF_NN_PROFILE_SCOPE(name, category[, layer[, ProfileCost]]): times the rest of the enclosing scope
+#     define CLASSIF_NN_PROFILE_SCOPE(...) ProfileScope CLASSIF_NN_PROFILE_CONCAT(profile_scope_, __LINE__)(__VA_ARGS__)
+#     define CLASSIF_NN_PROFILE_STEP() Profiler::instance().next_step()
+#     define CLASSIF_NN_PROFILE_EPOCH(epoch) Profiler::instance().set_epoch(epoch)
+# else
+#     define CLASSIF_NN_PROFILE_SCOPE(...) ((void)0)
+#     define CLASSIF_NN_PROFILE_STEP() ((void)0)
+#     define CLASSIF_NN_PROFILE_EPOCH(epoch) ((void)0)
+# endif
+
+# if defined(CLASSIF_NN_PROFILE) && defined(CLASSIF_NN_PROFILE_COUNT_ALLOCATIONS)
+// every replacement operator new and delete goes through this pair, kept out of line so the compiler does not
+// pair a delete expression with the malloc/free underneath (-Wmismatched-new-delete)
+__attribute__((noinline)) void* profile_allocate(std::size_t size, std::size_t alignment){
+    ++profile_allocation_count();
+    size = std::max<std::size_t>(size, 1);
+    void* pointer = alignment > alignof(std::max_align_t) ? std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment) : std::malloc(size);
+    if (!pointer){
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+__attribute__((noinline)) void profile_deallocate(void* pointer) noexcept{
+    std::free(pointer);
+}
+
+void* operator new(std::size_t size){ return profile_allocate(size, alignof(std::max_align_t)); }
+void* operator new[](std::size_t size){ return profile_allocate(size, alignof(std::max_align_t)); }
+void* operator new(std::size_t size, std::align_val_t alignment){ return profile_allocate(size, static_cast<std::size_t>(alignment)); }
+void* operator new[](std::size_t size, std::align_val_t alignment){ return profile_allocate(size, static_cast<std::size_t>(alignment)); }
+
+void operator delete(void* pointer) noexcept { profile_deallocate(pointer); }
+void operator delete[](void* pointer) noexcept { profile_deallocate(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { profile_deallocate(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { profile_deallocate(pointer); }
+void operator delete(void* pointer, std::align_val_t) noexcept { profile_deallocate(pointer); }
+void operator delete[](void* pointer, std::align_val_t) noexcept { profile_deallocate(pointer); }
+void operator delete(void* pointer, std::size_t, std::align_val_t) noexcept { profile_deallocate(pointer); }
+void operator delete[](void* pointer, std::size_t, std::align_val_t) noexcept { profile_deallocate(pointer); }
+# endif
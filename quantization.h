@@ -0,0 +1,566 @@
+# pragma once
+
+# include <vector>
+# include <cstdint>
+# include <cstddef>
+# include <cstring>
+# include <cmath>
+# include <algorithm>
+# include <chrono>
+# include <iostream>
+# include <stdexcept>
+# include <immintrin.h>
+
+# include "tensor.h"
+# include "cpu_dispatch.h"
+# include "activation_kernels.h"
+# include "activations.h"
+# include "fullyconnected_layer.h"
+# include "model.h"
+
+/*
+Post-training int8 quantization of a Model of FullyConnectedLayers, for inference.
+Weights are quantized once, symmetrically per output channel: w = scale_j * q, q in [-127, 127].
+Layer inputs are quantized symmetrically too, per row at run time (dynamic) or with one scale per layer
+measured on sample batches (calibrated). Products are accumulated in int32 and dequantized once per output:
+    y[b, j] = activation(acc[b, j] * input_scale[b] * weight_scale[j] + bias[j])
+Kernels: AVX-512 VNNI (vpdpbusd, inputs shifted to uint8 with a per-channel correction), AVX2 (int16 pairs
+and vpmaddwd) and a scalar fallback; all give the same int32 accumulators.
+*/
+
+enum class ActivationQuantization{
+    dynamic,    // scale of every input row computed from its own range
+    calibrated  // one scale per layer, from the ranges seen by calibrate()
+};
+
+const int QUANT_PANEL = 16;  // output channels per packed weight panel
+const int QUANT_ROWS = 4;          // batch rows per AVX2 and scalar tile
+const int QUANT_ROWS_VNNI = 12;    // batch rows per VNNI tile: 24 zmm accumulators, as the fp32 kernel
+
+template <typename T>
+using QuantBuffer = std::vector<T, AlignedAllocator<T, TENSOR_ALIGNMENT>>;
+
+// ----- int8 GEMM kernels: c[r, j] = sum_k a[r, k] * w[k, j] for a tile of rows and one or two weight panels -----
+// Packed weights: panel p, group of 4 inputs g, channel c, input i -> w[((p * groups + g) * 16 + c) * 4 + i]
+
+template <int Rows>
+void quantized_tile_scalar(const std::int8_t* a, int lda, const std::int8_t* w, int groups, std::int32_t* c, int ldc){
+    for (int r = 0; r < Rows; ++r){
+        for (int j = 0; j < QUANT_PANEL; ++j){
+            std::int32_t sum = 0;
+            for (int g = 0; g < groups; ++g){
+                const std::int8_t* weights = w + (g * QUANT_PANEL + j) * 4;
+                const std::int8_t* inputs = a + r * lda + 4 * g;
+                sum += inputs[0] * weights[0] + inputs[1] * weights[1] + inputs[2] * weights[2] + inputs[3] * weights[3];
+            }
+            c[r * ldc + j] = sum;
+        }
+    }
+}
+
+template <int Rows>
+__attribute__((target("avx2")))
+void quantized_tile_avx2(const std::int16_t* a, int lda, const std::int8_t* w, int groups, std::int32_t* c, int ldc){
+    // inputs are int16; one 64 bits broadcast holds the 4 inputs of a group, each channel gets two int32 partial sums
+    for (int half = 0; half < 2; ++half){
+        __m256i low[Rows], high[Rows];
+        #pragma GCC unroll 4
+        for (int r = 0; r < Rows; ++r){
+            low[r] = _mm256_setzero_si256();
+            high[r] = _mm256_setzero_si256();
+        }
+        for (int g = 0; g < groups; ++g){
+            const __m256i packed = _mm256_load_si256(reinterpret_cast<const __m256i*>(w + g * QUANT_PANEL * 4 + half * 32));
+            const __m256i weights_low = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(packed));          // channels 0-3
+            const __m256i weights_high = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(packed, 1));    // channels 4-7
+            #pragma GCC unroll 4
+            for (int r = 0; r < Rows; ++r){
+                std::int64_t group_inputs;
+                std::memcpy(&group_inputs, a + r * lda + 4 * g, sizeof(group_inputs));
+                const __m256i inputs = _mm256_set1_epi64x(group_inputs);
+                low[r] = _mm256_add_epi32(low[r], _mm256_madd_epi16(weights_low, inputs));
+                high[r] = _mm256_add_epi32(high[r], _mm256_madd_epi16(weights_high, inputs));
+            }
+        }
+        const __m256i order = _mm256_setr_epi32(0, 1, 4, 5, 2, 3, 6, 7);
+        #pragma GCC unroll 4
+        for (int r = 0; r < Rows; ++r){
+            const __m256i sums = _mm256_permutevar8x32_epi32(_mm256_hadd_epi32(low[r], high[r]), order);
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + r * ldc + half * 8), sums);
+        }
+    }
+}
+
+template <int Rows, int Panels>
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+void quantized_tile_vnni(const std::uint8_t* a, int lda, const std::int8_t* w, int groups, std::int32_t* c, int ldc){
+    // inputs are uint8 (shifted by 128); one 32 bits broadcast holds the 4 inputs of a group
+    __m512i sums[Rows][Panels];
+    #pragma GCC unroll 12
+    for (int r = 0; r < Rows; ++r){
+        for (int p = 0; p < Panels; ++p){
+            sums[r][p] = _mm512_setzero_si512();
+        }
+    }
+    const std::size_t panel_size = static_cast<std::size_t>(groups) * QUANT_PANEL * 4;
+    for (int g = 0; g < groups; ++g){
+        __m512i weights[Panels];
+        #pragma GCC unroll 2
+        for (int p = 0; p < Panels; ++p){
+            weights[p] = _mm512_load_si512(w + p * panel_size + g * QUANT_PANEL * 4);
+        }
+        #pragma GCC unroll 12
+        for (int r = 0; r < Rows; ++r){
+            std::int32_t group_inputs;
+            std::memcpy(&group_inputs, a + r * lda + 4 * g, sizeof(group_inputs));
+            const __m512i inputs = _mm512_set1_epi32(group_inputs);
+            #pragma GCC unroll 2
+            for (int p = 0; p < Panels; ++p){
+                sums[r][p] = _mm512_dpbusd_epi32(sums[r][p], inputs, weights[p]);
+            }
+        }
+    }
+    #pragma GCC unroll 12
+    for (int r = 0; r < Rows; ++r){
+        #pragma GCC unroll 2
+        for (int p = 0; p < Panels; ++p){
+            _mm512_storeu_si512(c + r * ldc + p * QUANT_PANEL, sums[r][p]);
+        }
+    }
+}
+
+template <int Rows>
+void quantized_rows_vnni(const std::uint8_t* a, int lda, const std::int8_t* w, int groups, int panels, std::int32_t* c, int ldc){
+    const std::size_t panel_size = static_cast<std::size_t>(groups) * QUANT_PANEL * 4;
+    int p = 0;
+    for (; p + 2 <= panels; p += 2){
+        quantized_tile_vnni<Rows, 2>(a, lda, w + p * panel_size, groups, c + p * QUANT_PANEL, ldc);
+    }
+    if (p < panels){
+        quantized_tile_vnni<Rows, 1>(a, lda, w + p * panel_size, groups, c + p * QUANT_PANEL, ldc);
+    }
+}
+
+template <int Rows>
+void quantized_rows(Isa isa, const void* a, int lda, const std::int8_t* w, int groups, int panels, std::int32_t* c, int ldc){
+    const std::size_t panel_size = static_cast<std::size_t>(groups) * QUANT_PANEL * 4;
+    if (isa == Isa::avx512){
+        quantized_rows_vnni<Rows>(static_cast<const std::uint8_t*>(a), lda, w, groups, panels, c, ldc);
+        return;
+    }
+    for (int p = 0; p < panels; ++p){
+        if (isa == Isa::avx2){
+            quantized_tile_avx2<Rows>(static_cast<const std::int16_t*>(a), lda, w + p * panel_size, groups, c + p * QUANT_PANEL, ldc);
+        }
+        else {
+            quantized_tile_scalar<Rows>(static_cast<const std::int8_t*>(a), lda, w + p * panel_size, groups, c + p * QUANT_PANEL, ldc);
+        }
+    }
+}
+
+// which kernel the quantized layers use: avx512 means VNNI
+Isa quantized_kernel_isa(){
+    if (has_avx512_vnni()){
+        return Isa::avx512;
+    }
+    return active_isa() == Isa::scalar ? Isa::scalar : Isa::avx2;
+}
+
+// ----- input quantization: q = round(x / scale) clamped to [-127, 127], stored as the kernel of "isa" reads it -----
+
+__attribute__((target("avx512f")))
+float quantization_range_avx512(const float* values, int n){
+    __m512 range = _mm512_setzero_ps();
+    int i = 0;
+    for (; i + 16 <= n; i += 16){
+        range = _mm512_max_ps(range, _mm512_abs_ps(_mm512_loadu_ps(values + i)));
+    }
+    float result = _mm512_reduce_max_ps(range);
+    for (; i < n; ++i){
+        result = std::max(result, std::abs(values[i]));
+    }
+    return result;
+}
+
+__attribute__((target("avx2")))
+float quantization_range_avx2(const float* values, int n){
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    __m256 range = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8){
+        range = _mm256_max_ps(range, _mm256_andnot_ps(sign, _mm256_loadu_ps(values + i)));
+    }
+    alignas(32) float lanes[8];
+    _mm256_store_ps(lanes, range);
+    float result = *std::max_element(lanes, lanes + 8);
+    for (; i < n; ++i){
+        result = std::max(result, std::abs(values[i]));
+    }
+    return result;
+}
+
+// largest |value| of a row
+float quantization_range(Isa isa, const float* values, int n){
+    if (isa == Isa::avx512){
+        return quantization_range_avx512(values, n);
+    }
+    if (isa == Isa::avx2){
+        return quantization_range_avx2(values, n);
+    }
+    float result = 0.;
+    for (int i = 0; i < n; ++i){
+        result = std::max(result, std::abs(values[i]));
+    }
+    return result;
+}
+
+int quantize_value(float value, float inverse_scale){
+    return std::max(-127, std::min(127, static_cast<int>(std::nearbyint(value * inverse_scale))));
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void quantize_row_avx512(const float* values, int n, float inverse_scale, std::uint8_t* destination){
+    // uint8 for vpdpbusd: q + 128
+    const __m512 scale = _mm512_set1_ps(inverse_scale);
+    const __m512i low = _mm512_set1_epi32(-127), high = _mm512_set1_epi32(127), shift = _mm512_set1_epi32(128);
+    int i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m512i q = _mm512_cvtps_epi32(_mm512_mul_ps(_mm512_loadu_ps(values + i), scale));
+        q = _mm512_add_epi32(_mm512_min_epi32(_mm512_max_epi32(q, low), high), shift);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(destination + i), _mm512_cvtepi32_epi8(q));
+    }
+    for (; i < n; ++i){
+        destination[i] = quantize_value(values[i], inverse_scale) + 128;
+    }
+}
+
+__attribute__((target("avx2")))
+void quantize_row_avx2(const float* values, int n, float inverse_scale, std::int16_t* destination){
+    const __m256 scale = _mm256_set1_ps(inverse_scale);
+    const __m256i low = _mm256_set1_epi32(-127), high = _mm256_set1_epi32(127);
+    int i = 0;
+    for (; i + 16 <= n; i += 16){
+        __m256i q0 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(values + i), scale));
+        __m256i q1 = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(values + i + 8), scale));
+        q0 = _mm256_min_epi32(_mm256_max_epi32(q0, low), high);
+        q1 = _mm256_min_epi32(_mm256_max_epi32(q1, low), high);
+        // packs works per 128 bits lane, the permute puts the 16 values back in order
+        const __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(q0, q1), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(destination + i), packed);
+    }
+    for (; i < n; ++i){
+        destination[i] = quantize_value(values[i], inverse_scale);
+    }
+}
+
+// writes the n quantized values of a row
+void quantize_row(Isa isa, const float* values, int n, float inverse_scale, std::int8_t* destination){
+    if (isa == Isa::avx512){
+        quantize_row_avx512(values, n, inverse_scale, reinterpret_cast<std::uint8_t*>(destination));
+    }
+    else if (isa == Isa::avx2){
+        quantize_row_avx2(values, n, inverse_scale, reinterpret_cast<std::int16_t*>(destination));
+    }
+    else {
+        for (int i = 0; i < n; ++i){
+            destination[i] = quantize_value(values[i], inverse_scale);
+        }
+    }
+}
+
+// buffers of QuantizedLinear::forward, kept per thread so inference does not allocate once warm
+struct QuantizedScratch{
+    QuantBuffer<std::int8_t> inputs;
+    QuantBuffer<std::int32_t> accumulators;
+    std::vector<float> scales;
+};
+
+QuantizedScratch& quantized_scratch(){
+    thread_local QuantizedScratch scratch;
+    return scratch;
+}
+
+// ----- quantized layer -----
+
+class QuantizedLinear{
+    /*
+    Inference-only int8 copy of a FullyConnectedLayer. Weights take a quarter of the fp32 storage
+    (plus one scale and one sum per output channel).
+    */
+    public:
+        QuantizedLinear(FullyConnectedLayer& layer);
+
+        int input_dim;
+        int output_dim;
+
+        void forward(const ConstTensorView input, const TensorView output, ActivationQuantization mode) const;
+        // widens the calibrated input range to cover "input"
+        void observe(const ConstTensorView input);
+        std::size_t weight_bytes() const;
+
+    protected:
+        // quantizes the rows of "input" into the layout of the kernel, returns the scale of each row
+        void quantize_input(Isa isa, const ConstTensorView input, ActivationQuantization mode, QuantBuffer<std::int8_t>& packed, std::vector<float>& scales) const;
+
+        int groups;  // input_dim / 4, rounded up
+        int panels;  // output_dim / QUANT_PANEL, rounded up
+        QuantBuffer<std::int8_t> weights;
+        std::vector<float> weight_scales;       // per output channel, padded to whole panels
+        std::vector<std::int32_t> weight_sums;  // per output channel, for the uint8 shift of the VNNI kernel
+        std::vector<float> bias;                // zeros when the layer has none
+        ActivationKind activation;
+        float activation_parameter;
+        float input_range;                      // largest |input| seen by observe()
+};
+
+QuantizedLinear::QuantizedLinear(FullyConnectedLayer& layer)
+    : input_dim(layer.input_dim), output_dim(layer.output_dim), input_range(0.){
+    groups = (input_dim + 3) / 4;
+    panels = (output_dim + QUANT_PANEL - 1) / QUANT_PANEL;
+    activation = layer.get_activation().get_kind();
+    activation_parameter = layer.get_activation().get_parameter();
+    bias.assign(output_dim, 0.);
+    if (layer.has_bias()){
+        const Tensor fp32_bias = layer.get_bias();
+        std::copy(fp32_bias.data(), fp32_bias.data() + output_dim, bias.begin());
+    }
+
+    const Tensor fp32_weights = layer.get_weights();
+    weights.assign(static_cast<std::size_t>(panels) * groups * QUANT_PANEL * 4, 0);
+    weight_scales.assign(panels * QUANT_PANEL, 0.);
+    weight_sums.assign(panels * QUANT_PANEL, 0);
+    for (int j = 0; j < output_dim; ++j){
+        float range = 0.;
+        for (int k = 0; k < input_dim; ++k){
+            range = std::max(range, std::abs(fp32_weights(k, j)));
+        }
+        const float scale = range > 0. ? range / 127.f : 1.f;
+        weight_scales[j] = scale;
+
+        const int p = j / QUANT_PANEL, channel = j % QUANT_PANEL;
+        for (int k = 0; k < input_dim; ++k){
+            const int q = std::max(-127, std::min(127, static_cast<int>(std::nearbyint(fp32_weights(k, j) / scale))));
+            weights[((static_cast<std::size_t>(p) * groups + k / 4) * QUANT_PANEL + channel) * 4 + k % 4] = q;
+            weight_sums[j] += q;
+        }
+    }
+}
+
+std::size_t QuantizedLinear::weight_bytes() const{
+    return weights.size() + weight_scales.size() * sizeof(float) + weight_sums.size() * sizeof(std::int32_t) + bias.size() * sizeof(float);
+}
+
+void QuantizedLinear::observe(const ConstTensorView input){
+    for (int r = 0; r < input.rows(); ++r){
+        const float* row = input.row_data(r);
+        for (int k = 0; k < input.cols(); ++k){
+            input_range = std::max(input_range, std::abs(row[k]));
+        }
+    }
+}
+
+void QuantizedLinear::quantize_input(Isa isa, const ConstTensorView input, ActivationQuantization mode, QuantBuffer<std::int8_t>& packed, std::vector<float>& scales) const{
+    // one row of 4 * groups elements of 1 (scalar, VNNI) or 2 (AVX2) bytes, padded with zeros (their weights are zero too)
+    const int element_size = isa == Isa::avx2 ? 2 : 1;
+    const int row_size = 4 * groups * element_size;
+    packed.resize(static_cast<std::size_t>(input.rows()) * row_size);
+    scales.resize(input.rows());
+
+    for (int r = 0; r < input.rows(); ++r){
+        const float* row = input.row_data(r);
+        const float range = mode == ActivationQuantization::dynamic ? quantization_range(isa, row, input_dim) : input_range;
+        const float scale = range > 0. ? range / 127.f : 1.f;
+        scales[r] = scale;
+        std::int8_t* destination = packed.data() + static_cast<std::size_t>(r) * row_size;
+        quantize_row(isa, row, input_dim, 1.f / scale, destination);
+        std::fill(destination + input_dim * element_size, destination + row_size, 0);
+    }
+}
+
+void QuantizedLinear::forward(const ConstTensorView input, const TensorView output, ActivationQuantization mode) const{
+    if (input.cols() != input_dim || output.cols() != output_dim || output.rows() != input.rows()){
+        throw std::invalid_argument("QuantizedLinear: invalid shapes");
+    }
+    if (mode == ActivationQuantization::calibrated && input_range == 0.){
+        throw std::logic_error("QuantizedLinear: calibrate the model before using calibrated scales");
+    }
+
+    const Isa isa = quantized_kernel_isa();
+    QuantizedScratch& scratch = quantized_scratch();
+    quantize_input(isa, input, mode, scratch.inputs, scratch.scales);
+    const std::vector<float>& row_scales = scratch.scales;
+
+    const int ldc = panels * QUANT_PANEL;
+    QuantBuffer<std::int32_t>& accumulators = scratch.accumulators;
+    accumulators.resize(static_cast<std::size_t>(input.rows()) * ldc);
+    const int element_size = isa == Isa::avx2 ? 2 : 1;
+    const int lda = 4 * groups;  // in elements
+    const std::int8_t* a = scratch.inputs.data();
+    int r = 0;
+    if (isa == Isa::avx512){
+        for (; r + QUANT_ROWS_VNNI <= input.rows(); r += QUANT_ROWS_VNNI){
+            quantized_rows_vnni<QUANT_ROWS_VNNI>(reinterpret_cast<const std::uint8_t*>(a) + static_cast<std::size_t>(r) * lda, lda, weights.data(), groups, panels, accumulators.data() + static_cast<std::size_t>(r) * ldc, ldc);
+        }
+    }
+    for (; r + QUANT_ROWS <= input.rows(); r += QUANT_ROWS){
+        quantized_rows<QUANT_ROWS>(isa, a + static_cast<std::size_t>(r) * lda * element_size, lda, weights.data(), groups, panels, accumulators.data() + static_cast<std::size_t>(r) * ldc, ldc);
+    }
+    for (; r < input.rows(); ++r){
+        quantized_rows<1>(isa, a + static_cast<std::size_t>(r) * lda * element_size, lda, weights.data(), groups, panels, accumulators.data() + static_cast<std::size_t>(r) * ldc, ldc);
+    }
+
+    // dequantization, bias, then the activation on the whole batch
+    const std::int32_t shift = isa == Isa::avx512 ? 128 : 0;
+    for (int b = 0; b < input.rows(); ++b){
+        const std::int32_t* sums = accumulators.data() + static_cast<std::size_t>(b) * ldc;
+        const float row_scale = row_scales[b];
+        float* destination = output.row_data(b);
+        for (int j = 0; j < output_dim; ++j){
+            destination[j] = static_cast<float>(sums[j] - shift * weight_sums[j]) * (row_scale * weight_scales[j]) + bias[j];
+        }
+    }
+    activation_kernel(activation, activation_parameter, output, TensorView());
+}
+
+// ----- quantized model -----
+
+class QuantizedModel{
+    /*
+    Int8 inference graph built from a trained Model. The Model is only read by the constructor and calibrate.
+    */
+    public:
+        QuantizedModel(Model& model, ActivationQuantization mode = ActivationQuantization::dynamic);
+
+        // runs a representative batch through the fp32 layers (as Model::predict does) and records the range
+        // of the input of every layer; may be called with several batches
+        void calibrate(const ConstTensorView batch);
+        Tensor predict(const ConstTensorView inputs) const;
+
+        std::size_t weight_bytes() const;
+        ActivationQuantization get_mode() const { return mode; }
+
+    protected:
+        std::vector<Layer*> source_layers;
+        std::vector<QuantizedLinear> layers;
+        ActivationQuantization mode;
+};
+
+QuantizedModel::QuantizedModel(Model& model, ActivationQuantization mode_) : source_layers(model.get_layers()), mode(mode_){
+    for (Layer* layer : source_layers){
+        FullyConnectedLayer* fully_connected = dynamic_cast<FullyConnectedLayer*>(layer);
+        if (!fully_connected){
+            throw std::invalid_argument("QuantizedModel: only fully connected layers can be quantized");
+        }
+        layers.emplace_back(*fully_connected);
+    }
+}
+
+void QuantizedModel::calibrate(const ConstTensorView batch){
+    ConstTensorView current = batch;
+    Tensor outputs;
+    for (int i = 0; i < source_layers.size(); ++i){
+        layers[i].observe(current);
+        Tensor layer_output(current.rows(), source_layers[i]->output_dim);
+        source_layers[i]->forward(current, layer_output, nullptr);
+        outputs = std::move(layer_output);
+        current = outputs;
+    }
+}
+
+Tensor QuantizedModel::predict(const ConstTensorView inputs) const{
+    if (layers.empty()){
+        return Tensor(inputs);
+    }
+    ConstTensorView current = inputs;
+    Tensor outputs;
+    for (const QuantizedLinear& layer : layers){
+        Tensor layer_output(current.rows(), layer.output_dim);
+        layer.forward(current, layer_output, mode);
+        outputs = std::move(layer_output);
+        current = outputs;
+    }
+    return outputs;
+}
+
+std::size_t QuantizedModel::weight_bytes() const{
+    std::size_t bytes = 0;
+    for (const QuantizedLinear& layer : layers){
+        bytes += layer.weight_bytes();
+    }
+    return bytes;
+}
+
+// ----- accuracy report -----
+
+struct QuantizationReport{
+    int samples;
+    float max_abs_error;     // largest |int8 output - fp32 output|
+    float mean_abs_error;
+    float top1_agreement;    // fraction of rows where both models predict the same class
+    float fp32_accuracy;     // against the labels, when given
+    float int8_accuracy;
+    double fp32_ms;          // time of predict on the whole set
+    double int8_ms;
+    std::size_t fp32_weight_bytes;
+    std::size_t int8_weight_bytes;
+};
+
+int argmax_row(const ConstTensorView values, int r){
+    const float* row = values.row_data(r);
+    return std::max_element(row, row + values.cols()) - row;
+}
+
+QuantizationReport compare_quantized(Model& model, const QuantizedModel& quantized, const ConstTensorView x, const ConstLabelView labels = ConstLabelView()){
+    QuantizationReport report{};
+    report.samples = x.rows();
+
+    // one untimed run each, so first-call allocations are not measured
+    model.predict(x);
+    quantized.predict(x);
+    auto start = std::chrono::steady_clock::now();
+    Tensor fp32_outputs = model.predict(x);
+    auto middle = std::chrono::steady_clock::now();
+    Tensor int8_outputs = quantized.predict(x);
+    auto end = std::chrono::steady_clock::now();
+    report.fp32_ms = std::chrono::duration<double, std::milli>(middle - start).count();
+    report.int8_ms = std::chrono::duration<double, std::milli>(end - middle).count();
+
+    double total_error = 0.;
+    int agreements = 0, fp32_correct = 0, int8_correct = 0;
+    for (int r = 0; r < x.rows(); ++r){
+        for (int j = 0; j < fp32_outputs.cols(); ++j){
+            const float error = std::abs(fp32_outputs(r, j) - int8_outputs(r, j));
+            report.max_abs_error = std::max(report.max_abs_error, error);
+            total_error += error;
+        }
+        const int fp32_class = argmax_row(fp32_outputs, r);
+        const int int8_class = argmax_row(int8_outputs, r);
+        agreements += fp32_class == int8_class;
+        if (!labels.empty()){
+            fp32_correct += fp32_class == labels(r, 0);
+            int8_correct += int8_class == labels(r, 0);
+        }
+    }
+    const int samples = std::max(1, x.rows());
+    report.mean_abs_error = total_error / (static_cast<double>(samples) * std::max(1, fp32_outputs.cols()));
+    report.top1_agreement = static_cast<float>(agreements) / samples;
+    report.fp32_accuracy = static_cast<float>(fp32_correct) / samples;
+    report.int8_accuracy = static_cast<float>(int8_correct) / samples;
+
+    for (Layer* layer : model.get_layers()){
+        for (TensorView parameter : layer->parameters()){
+            report.fp32_weight_bytes += parameter.size() * sizeof(float);
+        }
+    }
+    report.int8_weight_bytes = quantized.weight_bytes();
+    return report;
+}
+
+void print_report(const QuantizationReport& report, std::ostream& stream = std::cout){
+    stream << "int8 vs fp32 on " << report.samples << " samples" << std::endl;
+    stream << "  output error: max " << report.max_abs_error << ", mean " << report.mean_abs_error << std::endl;
+    stream << "  top-1 agreement: " << report.top1_agreement * 100.f << "%" << std::endl;
+    stream << "  accuracy: fp32 " << report.fp32_accuracy * 100.f << "%, int8 " << report.int8_accuracy * 100.f << "%" << std::endl;
+    stream << "  predict time: fp32 " << report.fp32_ms << " ms, int8 " << report.int8_ms << " ms" << std::endl;
+    stream << "  weights: fp32 " << report.fp32_weight_bytes << " bytes, int8 " << report.int8_weight_bytes << " bytes" << std::endl;
+}
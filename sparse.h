@@ -0,0 +1,316 @@
+# pragma once
+
+# include <vector>
+# include <cstdint>
+# include <algorithm>
+# include <stdexcept>
+# include <immintrin.h>
+
+# include "tensor.h"
+# include "cpu_dispatch.h"
+# include "activation_kernels.h"
+# include "gemm.h"
+
+/*
+Sparse input batches in CSR form (compressed sparse rows), for features that are mostly zero: row r holds
+the values values[offsets[r] .. offsets[r + 1]) at the columns indices[...]. A fully connected layer
+fed with a CSR batch only reads the weight rows of the non-zero inputs, and its weight gradient only
+touches those rows, so its cost scales with the number of non-zeros instead of input_dim.
+*/
+
+class ConstCSRView{
+    /*
+    Non-owning view on a CSR batch. Offsets are absolute positions in "indices" and "values", so a range
+    of rows is a view on the same arrays.
+    */
+    public:
+        ConstCSRView() : offsets_ptr(nullptr), indices_ptr(nullptr), values_ptr(nullptr), n_rows(0), n_cols(0) {};
+        ConstCSRView(const long* offsets_, const int* indices_, const float* values_, int rows_, int cols_)
+            : offsets_ptr(offsets_), indices_ptr(indices_), values_ptr(values_), n_rows(rows_), n_cols(cols_) {};
+
+        int rows() const { return n_rows; }
+        int cols() const { return n_cols; }
+        bool empty() const { return n_rows == 0 || n_cols == 0; }
+        long nnz() const { return n_rows == 0 ? 0 : offsets_ptr[n_rows] - offsets_ptr[0]; }
+
+        // non-zeros of row r: positions row_begin(r) to row_end(r) of indices() and values()
+        long row_begin(int r) const { return offsets_ptr[r]; }
+        long row_end(int r) const { return offsets_ptr[r + 1]; }
+        const int* indices() const { return indices_ptr; }
+        const float* values() const { return values_ptr; }
+
+        ConstCSRView slice_rows(int begin, int end) const;
+
+    private:
+        const long* offsets_ptr;
+        const int* indices_ptr;
+        const float* values_ptr;
+        int n_rows;
+        int n_cols;
+};
+
+ConstCSRView ConstCSRView::slice_rows(int begin, int end) const{
+    if (begin < 0 || end > n_rows || begin > end){
+        throw std::out_of_range("CSR: row range out of range");
+    }
+    return ConstCSRView(offsets_ptr + begin, indices_ptr, values_ptr, end - begin, n_cols);
+}
+
+struct CSRTensor{
+    // owning CSR batch; column indices are increasing within each row
+    int rows = 0;
+    int cols = 0;
+    std::vector<long> offsets{0};
+    std::vector<int> indices;
+    std::vector<float> values;
+
+    long nnz() const { return offsets.back(); }
+    operator ConstCSRView() const { return ConstCSRView(offsets.data(), indices.data(), values.data(), rows, cols); }
+    ConstCSRView slice_rows(int begin, int end) const { return ConstCSRView(*this).slice_rows(begin, end); }
+};
+
+CSRTensor to_csr(const ConstTensorView dense){
+    // keeps the values that are not exactly zero
+    CSRTensor output;
+    output.rows = dense.rows();
+    output.cols = dense.cols();
+    output.offsets.reserve(dense.rows() + 1);
+    for (int r = 0; r < dense.rows(); ++r){
+        const float* row = dense.row_data(r);
+        for (int c = 0; c < dense.cols(); ++c){
+            if (row[c] != 0.f){
+                output.indices.push_back(c);
+                output.values.push_back(row[c]);
+            }
+        }
+        output.offsets.push_back(output.indices.size());
+    }
+    return output;
+}
+
+Tensor to_dense(const ConstCSRView sparse){
+    Tensor output(sparse.rows(), sparse.cols(), 0.);
+    for (int r = 0; r < sparse.rows(); ++r){
+        for (long k = sparse.row_begin(r); k < sparse.row_end(r); ++k){
+            output(r, sparse.indices()[k]) = sparse.values()[k];
+        }
+    }
+    return output;
+}
+
+struct Inputs{
+    // input batch of a model: dense rows, or a CSR batch for the first layer
+    ConstTensorView dense;
+    ConstCSRView sparse;
+
+    bool is_sparse() const { return dense.empty() && !sparse.empty(); }
+    int rows() const { return is_sparse() ? sparse.rows() : dense.rows(); }
+    int cols() const { return is_sparse() ? sparse.cols() : dense.cols(); }
+    Inputs slice_rows(int begin, int end) const;
+};
+
+Inputs Inputs::slice_rows(int begin, int end) const{
+    Inputs output;
+    if (is_sparse()){
+        output.sparse = sparse.slice_rows(begin, end);
+    }
+    else {
+        output.dense = dense.slice_rows(begin, end);
+    }
+    return output;
+}
+
+// input columns with at least one non-zero in the batch, in increasing order
+void csr_active_columns(const ConstCSRView sparse, std::vector<int>& columns, std::vector<char>& seen){
+    seen.assign(sparse.cols(), 0);
+    columns.clear();
+    if (sparse.rows() == 0){
+        return;
+    }
+    for (long k = sparse.row_begin(0); k < sparse.row_end(sparse.rows() - 1); ++k){
+        const int c = sparse.indices()[k];
+        if (!seen[c]){
+            seen[c] = 1;
+            columns.push_back(c);
+        }
+    }
+    std::sort(columns.begin(), columns.end());
+}
+
+// ----- sparse x dense product: output = epilogue(sparse . weights) -----
+
+void csr_multiply_row_scalar(const int* indices, const float* values, long nnz, const ConstTensorView weights, const float* bias, float* output){
+    const int n = weights.cols();
+    for (int j = 0; j < n; ++j){
+        output[j] = bias ? bias[j] : 0.f;
+    }
+    for (long k = 0; k < nnz; ++k){
+        const float value = values[k];
+        const float* w = weights.row_data(indices[k]);
+        for (int j = 0; j < n; ++j){
+            output[j] += value * w[j];
+        }
+    }
+}
+
+template <int Vectors>
+__attribute__((target("avx2,fma")))
+void csr_multiply_block_avx2(const int* indices, const float* values, long nnz, const ConstTensorView weights, const float* bias, float* output, int column){
+    // 8 * Vectors output columns, kept in registers over all the non-zeros of the row
+    __m256 acc[Vectors];
+    #pragma GCC unroll 4
+    for (int v = 0; v < Vectors; ++v){
+        acc[v] = bias ? _mm256_loadu_ps(bias + column + 8 * v) : _mm256_setzero_ps();
+    }
+    for (long k = 0; k < nnz; ++k){
+        const __m256 value = _mm256_set1_ps(values[k]);
+        const float* w = weights.row_data(indices[k]) + column;
+        #pragma GCC unroll 4
+        for (int v = 0; v < Vectors; ++v){
+            acc[v] = _mm256_fmadd_ps(value, _mm256_loadu_ps(w + 8 * v), acc[v]);
+        }
+    }
+    #pragma GCC unroll 4
+    for (int v = 0; v < Vectors; ++v){
+        _mm256_storeu_ps(output + column + 8 * v, acc[v]);
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void csr_multiply_row_avx2(const int* indices, const float* values, long nnz, const ConstTensorView weights, const float* bias, float* output){
+    const int n = weights.cols();
+    int j = 0;
+    for (; j + 32 <= n; j += 32){
+        csr_multiply_block_avx2<4>(indices, values, nnz, weights, bias, output, j);
+    }
+    for (; j + 8 <= n; j += 8){
+        csr_multiply_block_avx2<1>(indices, values, nnz, weights, bias, output, j);
+    }
+    for (; j < n; ++j){
+        float sum = bias ? bias[j] : 0.f;
+        for (long k = 0; k < nnz; ++k){
+            sum += values[k] * weights(indices[k], j);
+        }
+        output[j] = sum;
+    }
+}
+
+template <int Vectors>
+__attribute__((target("avx512f")))
+void csr_multiply_block_avx512(const int* indices, const float* values, long nnz, const ConstTensorView weights, const float* bias, float* output, int column, __mmask16 last_mask){
+    // 16 * Vectors output columns, the last vector restricted to "last_mask"
+    __m512 acc[Vectors];
+    #pragma GCC unroll 4
+    for (int v = 0; v < Vectors; ++v){
+        const __mmask16 mask = v + 1 == Vectors ? last_mask : 0xFFFF;
+        acc[v] = bias ? _mm512_maskz_loadu_ps(mask, bias + column + 16 * v) : _mm512_setzero_ps();
+    }
+    for (long k = 0; k < nnz; ++k){
+        const __m512 value = _mm512_set1_ps(values[k]);
+        const float* w = weights.row_data(indices[k]) + column;
+        #pragma GCC unroll 4
+        for (int v = 0; v < Vectors; ++v){
+            const __mmask16 mask = v + 1 == Vectors ? last_mask : 0xFFFF;
+            acc[v] = _mm512_fmadd_ps(value, _mm512_maskz_loadu_ps(mask, w + 16 * v), acc[v]);
+        }
+    }
+    #pragma GCC unroll 4
+    for (int v = 0; v < Vectors; ++v){
+        const __mmask16 mask = v + 1 == Vectors ? last_mask : 0xFFFF;
+        _mm512_mask_storeu_ps(output + column + 16 * v, mask, acc[v]);
+    }
+}
+
+__attribute__((target("avx512f")))
+void csr_multiply_row_avx512(const int* indices, const float* values, long nnz, const ConstTensorView weights, const float* bias, float* output){
+    const int n = weights.cols();
+    int j = 0;
+    for (; j + 64 <= n; j += 64){
+        csr_multiply_block_avx512<4>(indices, values, nnz, weights, bias, output, j, 0xFFFF);
+    }
+    for (; j < n; j += 16){
+        const int remaining = std::min(16, n - j);
+        csr_multiply_block_avx512<1>(indices, values, nnz, weights, bias, output, j, static_cast<__mmask16>((1u << remaining) - 1));
+    }
+}
+
+void csr_multiply(const ConstCSRView input, const ConstTensorView weights, const TensorView output, const GemmEpilogue& epilogue = GemmEpilogue()){
+    // output = activation(input . weights + bias), the derivative of the activation written as in gemm
+    if (input.cols() != weights.rows() || output.rows() != input.rows() || output.cols() != weights.cols()){
+        throw std::invalid_argument("CSR multiply: invalid shapes");
+    }
+    const Isa isa = active_isa();
+    for (int r = 0; r < input.rows(); ++r){
+        const long begin = input.row_begin(r);
+        const int* indices = input.indices() + begin;
+        const float* values = input.values() + begin;
+        const long nnz = input.row_end(r) - begin;
+        float* row = output.row_data(r);
+        if (isa == Isa::avx512){
+            csr_multiply_row_avx512(indices, values, nnz, weights, epilogue.bias, row);
+        }
+        else if (isa == Isa::avx2){
+            csr_multiply_row_avx2(indices, values, nnz, weights, epilogue.bias, row);
+        }
+        else {
+            csr_multiply_row_scalar(indices, values, nnz, weights, epilogue.bias, row);
+        }
+        if (epilogue.activation != ActivationKind::identity || epilogue.derivatives){
+            activation_kernel(epilogue.activation, epilogue.activation_parameter, row,
+                              epilogue.derivatives ? epilogue.derivatives + static_cast<std::size_t>(r) * epilogue.ldd : nullptr, output.cols());
+        }
+    }
+}
+
+// ----- sparse weight gradient: gradient += scale * input^T . signal, on the rows of the non-zero inputs only -----
+
+void csr_axpy_scalar(float alpha, const float* x, float* y, int n){
+    for (int j = 0; j < n; ++j){
+        y[j] += alpha * x[j];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+void csr_axpy_avx2(float alpha, const float* x, float* y, int n){
+    const __m256 a = _mm256_set1_ps(alpha);
+    int j = 0;
+    for (; j + 8 <= n; j += 8){
+        _mm256_storeu_ps(y + j, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j)));
+    }
+    for (; j < n; ++j){
+        y[j] += alpha * x[j];
+    }
+}
+
+__attribute__((target("avx512f")))
+void csr_axpy_avx512(float alpha, const float* x, float* y, int n){
+    const __m512 a = _mm512_set1_ps(alpha);
+    for (int j = 0; j < n; j += 16){
+        const __mmask16 mask = n - j >= 16 ? 0xFFFF : static_cast<__mmask16>((1u << (n - j)) - 1);
+        _mm512_mask_storeu_ps(y + j, mask, _mm512_fmadd_ps(a, _mm512_maskz_loadu_ps(mask, x + j), _mm512_maskz_loadu_ps(mask, y + j)));
+    }
+}
+
+void csr_transpose_multiply_accumulate(const ConstCSRView input, const ConstTensorView signal, const TensorView gradient, float scale){
+    if (input.rows() != signal.rows() || gradient.rows() != input.cols() || gradient.cols() != signal.cols()){
+        throw std::invalid_argument("CSR transpose multiply: invalid shapes");
+    }
+    const Isa isa = active_isa();
+    const int n = signal.cols();
+    for (int r = 0; r < input.rows(); ++r){
+        const float* signal_row = signal.row_data(r);
+        for (long k = input.row_begin(r); k < input.row_end(r); ++k){
+            const float alpha = scale * input.values()[k];
+            float* gradient_row = gradient.row_data(input.indices()[k]);
+            if (isa == Isa::avx512){
+                csr_axpy_avx512(alpha, signal_row, gradient_row, n);
+            }
+            else if (isa == Isa::avx2){
+                csr_axpy_avx2(alpha, signal_row, gradient_row, n);
+            }
+            else {
+                csr_axpy_scalar(alpha, signal_row, gradient_row, n);
+            }
+        }
+    }
+}
@@ -0,0 +1,385 @@
+# pragma once
+
+# include <array>
+# include <tuple>
+# include <utility>
+# include <algorithm>
+# include <stdexcept>
+# include <string>
+# include <immintrin.h>
+
+# include "tensor.h"
+# include "cpu_dispatch.h"
+# include "activation_kernels.h"
+# include "fullyconnected_layer.h"
+# include "model.h"
+
+/*
+Inference network with a topology fixed at compile time, for deployed models:
+
+    using MnistNet = StaticModel<StaticDense<784, 128, ActivationKind::relu>,
+                                 StaticDense<128, 64, ActivationKind::relu>,
+                                 StaticDense<64, 10, ActivationKind::identity, false>>;
+    auto net = std::make_unique<MnistNet>();  // weights live in the object (400 kB here): heap or static storage
+    net->load(model);                         // from a trained Model with the same topology
+    std::array<float, 10> logits = net->predict(image);
+
+Shapes are constexpr and every buffer is statically sized, there is no virtual call, and the kernels are
+templates on the layer shapes: the register tile (rows x columns) is fully unrolled and the reduction over
+the inputs has a compile-time trip count. Samples are processed a few rows at a time, so each weight loaded
+from cache is used by every row of the tile. Weights are stored with the output dimension padded to 16
+columns (zeros), so no kernel needs a column remainder.
+*/
+
+template <int InputDim, int OutputDim, ActivationKind Activation = ActivationKind::identity, bool UseBias = true>
+struct StaticDense{
+    static_assert(InputDim > 0 && OutputDim > 0, "StaticDense: dimensions must be positive");
+
+    static constexpr int input_dim = InputDim;
+    static constexpr int output_dim = OutputDim;
+    static constexpr int padded_dim = (OutputDim + 15) / 16 * 16;
+    static constexpr ActivationKind activation = Activation;
+    static constexpr bool use_bias = UseBias;
+
+    // input_dim x padded_dim, row-major
+    alignas(64) std::array<float, InputDim * padded_dim> weights{};
+    alignas(64) std::array<float, padded_dim> bias{};
+    float activation_parameter = 0.;
+};
+
+// ----- kernels: y[r, :] = activation(x[r, :] . W + b) for Rows rows -----
+
+template <ActivationKind Activation>
+float static_activation(float value, float parameter){
+    if constexpr (Activation == ActivationKind::relu){
+        return value > 0.f ? value : 0.f;
+    }
+    else if constexpr (Activation == ActivationKind::leaky_relu){
+        return value > 0.f ? value : parameter * value;
+    }
+    return value;
+}
+
+template <typename Layer, int Rows>
+void static_dense_scalar(const Layer& layer, const float* x, int ldx, float* y, int ldy){
+    constexpr int N = Layer::padded_dim;
+    for (int r = 0; r < Rows; ++r){
+        float* y_row = y + r * ldy;
+        std::copy(layer.bias.begin(), layer.bias.end(), y_row);
+        for (int i = 0; i < Layer::input_dim; ++i){
+            const float x_ri = x[r * ldx + i];
+            const float* w_row = layer.weights.data() + i * N;
+            for (int j = 0; j < N; ++j){
+                y_row[j] += x_ri * w_row[j];
+            }
+        }
+        for (int j = 0; j < N; ++j){
+            y_row[j] = static_activation<Layer::activation>(y_row[j], layer.activation_parameter);
+        }
+    }
+}
+
+template <typename Layer, int Rows, int Vectors>
+__attribute__((target("avx2,fma")))
+void static_dense_block_avx2(const Layer& layer, int column, const float* x, int ldx, float* y, int ldy){
+    // Rows x (8 * Vectors) tile of the output
+    constexpr int N = Layer::padded_dim;
+    __m256 acc[Rows][Vectors];
+    #pragma GCC unroll 8
+    for (int r = 0; r < Rows; ++r){
+        #pragma GCC unroll 8
+        for (int v = 0; v < Vectors; ++v){
+            acc[r][v] = _mm256_load_ps(layer.bias.data() + column + 8 * v);
+        }
+    }
+    const float* w = layer.weights.data() + column;
+    #pragma GCC unroll 2
+    for (int i = 0; i < Layer::input_dim; ++i){
+        __m256 w_i[Vectors];
+        #pragma GCC unroll 8
+        for (int v = 0; v < Vectors; ++v){
+            w_i[v] = _mm256_load_ps(w + i * N + 8 * v);
+        }
+        #pragma GCC unroll 8
+        for (int r = 0; r < Rows; ++r){
+            const __m256 x_ri = _mm256_broadcast_ss(x + r * ldx + i);
+            #pragma GCC unroll 8
+            for (int v = 0; v < Vectors; ++v){
+                acc[r][v] = _mm256_fmadd_ps(x_ri, w_i[v], acc[r][v]);
+            }
+        }
+    }
+    const __m256 zero = _mm256_setzero_ps(), slope = _mm256_set1_ps(layer.activation_parameter);
+    #pragma GCC unroll 8
+    for (int r = 0; r < Rows; ++r){
+        #pragma GCC unroll 8
+        for (int v = 0; v < Vectors; ++v){
+            __m256 value = acc[r][v];
+            if constexpr (Layer::activation == ActivationKind::relu){
+                value = _mm256_max_ps(value, zero);
+            }
+            else if constexpr (Layer::activation == ActivationKind::leaky_relu){
+                value = _mm256_blendv_ps(_mm256_mul_ps(value, slope), value, _mm256_cmp_ps(value, zero, _CMP_GT_OQ));
+            }
+            _mm256_storeu_ps(y + r * ldy + column + 8 * v, value);
+        }
+    }
+}
+
+template <typename Layer, int Rows>
+void static_dense_avx2(const Layer& layer, const float* x, int ldx, float* y, int ldy){
+    // blocks of 32 columns, then the remaining 16 (padded_dim is a multiple of 16)
+    constexpr int N = Layer::padded_dim;
+    constexpr int full_blocks = N / 32;
+    for (int block = 0; block < full_blocks; ++block){
+        static_dense_block_avx2<Layer, Rows, 4>(layer, 32 * block, x, ldx, y, ldy);
+    }
+    if constexpr (N % 32 != 0){
+        static_dense_block_avx2<Layer, Rows, 2>(layer, 32 * full_blocks, x, ldx, y, ldy);
+    }
+}
+
+template <typename Layer, int Rows, int Vectors>
+__attribute__((target("avx512f")))
+void static_dense_block_avx512(const Layer& layer, int column, const float* x, int ldx, float* y, int ldy){
+    // Rows x (16 * Vectors) tile of the output
+    constexpr int N = Layer::padded_dim;
+    __m512 acc[Rows][Vectors];
+    #pragma GCC unroll 8
+    for (int r = 0; r < Rows; ++r){
+        #pragma GCC unroll 8
+        for (int v = 0; v < Vectors; ++v){
+            acc[r][v] = _mm512_load_ps(layer.bias.data() + column + 16 * v);
+        }
+    }
+    const float* w = layer.weights.data() + column;
+    #pragma GCC unroll 2
+    for (int i = 0; i < Layer::input_dim; ++i){
+        __m512 w_i[Vectors];
+        #pragma GCC unroll 8
+        for (int v = 0; v < Vectors; ++v){
+            w_i[v] = _mm512_load_ps(w + i * N + 16 * v);
+        }
+        #pragma GCC unroll 8
+        for (int r = 0; r < Rows; ++r){
+            const __m512 x_ri = _mm512_set1_ps(x[r * ldx + i]);
+            #pragma GCC unroll 8
+            for (int v = 0; v < Vectors; ++v){
+                acc[r][v] = _mm512_fmadd_ps(x_ri, w_i[v], acc[r][v]);
+            }
+        }
+    }
+    const __m512 zero = _mm512_setzero_ps(), slope = _mm512_set1_ps(layer.activation_parameter);
+    #pragma GCC unroll 8
+    for (int r = 0; r < Rows; ++r){
+        #pragma GCC unroll 8
+        for (int v = 0; v < Vectors; ++v){
+            __m512 value = acc[r][v];
+            if constexpr (Layer::activation == ActivationKind::relu){
+                value = _mm512_max_ps(value, zero);
+            }
+            else if constexpr (Layer::activation == ActivationKind::leaky_relu){
+                value = _mm512_mask_mul_ps(value, _mm512_cmp_ps_mask(value, zero, _CMP_LE_OQ), value, slope);
+            }
+            _mm512_storeu_ps(y + r * ldy + column + 16 * v, value);
+        }
+    }
+}
+
+template <typename Layer, int Rows>
+void static_dense_avx512(const Layer& layer, const float* x, int ldx, float* y, int ldy){
+    // blocks of 64 columns, then the remaining 16, 32 or 48
+    constexpr int N = Layer::padded_dim;
+    constexpr int full_blocks = N / 64;
+    for (int block = 0; block < full_blocks; ++block){
+        static_dense_block_avx512<Layer, Rows, 4>(layer, 64 * block, x, ldx, y, ldy);
+    }
+    if constexpr (N % 64 != 0){
+        static_dense_block_avx512<Layer, Rows, (N % 64) / 16>(layer, 64 * full_blocks, x, ldx, y, ldy);
+    }
+}
+
+// ----- model -----
+
+template <typename... Layers>
+class StaticModel{
+    /*
+    Chain of StaticDense layers; see the top of static_model.h. Copyable, holds its weights by value.
+    */
+    static_assert(sizeof...(Layers) > 0, "StaticModel: at least one layer is needed");
+
+    public:
+        static constexpr int num_layers = sizeof...(Layers);
+        static constexpr int input_dim = std::tuple_element_t<0, std::tuple<Layers...>>::input_dim;
+        static constexpr int output_dim = std::tuple_element_t<num_layers - 1, std::tuple<Layers...>>::output_dim;
+        // rows processed together by the kernels
+        static constexpr int tile_rows = 4;
+
+        // copies the parameters of a Model of fully connected layers with the same shapes, bias and activations
+        void load(Model& model);
+
+        // one sample: "input" holds input_dim values; no shape is checked
+        std::array<float, output_dim> predict(const float* input) const;
+        std::array<float, output_dim> predict(const std::array<float, input_dim>& input) const;
+        // batch_size samples, row-major and contiguous
+        void predict(const float* inputs, int batch_size, float* outputs) const;
+        Tensor predict(const ConstTensorView inputs) const;
+
+        std::tuple<Layers...> layers;
+
+    private:
+        static constexpr int buffer_dim = std::max({Layers::padded_dim...});
+
+        template <std::size_t L>
+        void load_layer(Model& model);
+        template <std::size_t... L>
+        void load_layers(Model& model, std::index_sequence<L...>);
+        template <Isa Kind, int Rows, std::size_t L>
+        void run_layers(const float* x, int ldx, float* buffer_in, float* buffer_out, float* outputs) const;
+        template <Isa Kind, int Rows>
+        void predict_tile(const float* inputs, float* outputs) const;
+        template <Isa Kind>
+        void predict_rows(const float* inputs, int batch_size, float* outputs) const;
+};
+
+template <typename... Layers>
+template <std::size_t L>
+void StaticModel<Layers...>::load_layer(Model& model){
+    using Static = std::tuple_element_t<L, std::tuple<Layers...>>;
+    Static& layer = std::get<L>(layers);
+    FullyConnectedLayer* source = dynamic_cast<FullyConnectedLayer*>(model.get_layers()[L]);
+    const std::string name = "StaticModel: layer " + std::to_string(L);
+    if (!source){
+        throw std::invalid_argument(name + " is not fully connected");
+    }
+    if (source->input_dim != Static::input_dim || source->output_dim != Static::output_dim){
+        throw std::invalid_argument(name + " has shape " + std::to_string(source->input_dim) + "x" + std::to_string(source->output_dim)
+                                    + " instead of " + std::to_string(Static::input_dim) + "x" + std::to_string(Static::output_dim));
+    }
+    if (source->has_bias() != Static::use_bias){
+        throw std::invalid_argument(name + (Static::use_bias ? " has no bias" : " has a bias"));
+    }
+    if (source->get_activation().get_kind() != Static::activation){
+        throw std::invalid_argument(name + " has the activation " + activation_name(source->get_activation().get_kind())
+                                    + " instead of " + activation_name(Static::activation));
+    }
+
+    const Tensor weights = source->get_weights();
+    for (int i = 0; i < Static::input_dim; ++i){
+        std::copy(weights.data() + i * Static::output_dim, weights.data() + (i + 1) * Static::output_dim, layer.weights.data() + i * Static::padded_dim);
+    }
+    if constexpr (Static::use_bias){
+        const Tensor bias = source->get_bias();
+        std::copy(bias.data(), bias.data() + Static::output_dim, layer.bias.data());
+    }
+    layer.activation_parameter = source->get_activation().get_parameter();
+}
+
+template <typename... Layers>
+void StaticModel<Layers...>::load(Model& model){
+    if (model.get_layers().size() != num_layers){
+        throw std::invalid_argument("StaticModel: the model has " + std::to_string(model.get_layers().size()) + " layers instead of " + std::to_string(num_layers));
+    }
+    load_layers(model, std::index_sequence_for<Layers...>());
+}
+
+template <typename... Layers>
+template <std::size_t... L>
+void StaticModel<Layers...>::load_layers(Model& model, std::index_sequence<L...>){
+    (load_layer<L>(model), ...);
+}
+
+template <typename... Layers>
+template <Isa Kind, int Rows, std::size_t L>
+void StaticModel<Layers...>::run_layers(const float* x, int ldx, float* buffer_in, float* buffer_out, float* outputs) const{
+    // layer L reads x (ldx apart), writes buffer_out (buffer_dim apart); the last one ends in "outputs"
+    using Static = std::tuple_element_t<L, std::tuple<Layers...>>;
+    const Static& layer = std::get<L>(layers);
+    if constexpr (Kind == Isa::avx512){
+        static_dense_avx512<Static, Rows>(layer, x, ldx, buffer_out, buffer_dim);
+    }
+    else if constexpr (Kind == Isa::avx2){
+        static_dense_avx2<Static, Rows>(layer, x, ldx, buffer_out, buffer_dim);
+    }
+    else {
+        static_dense_scalar<Static, Rows>(layer, x, ldx, buffer_out, buffer_dim);
+    }
+    // activations that are not applied in the kernels
+    for (int r = 0; r < Rows; ++r){
+        float* row = buffer_out + r * buffer_dim;
+        if constexpr (Static::activation == ActivationKind::softmax){
+            softmax_kernel(row, Static::output_dim);
+        }
+        else if constexpr (Static::activation == ActivationKind::sigmoid){
+            activation_kernel(Static::activation, layer.activation_parameter, row, nullptr, Static::output_dim);
+        }
+    }
+
+    if constexpr (L + 1 < num_layers){
+        run_layers<Kind, Rows, L + 1>(buffer_out, buffer_dim, buffer_out, buffer_in, outputs);
+    }
+    else {
+        for (int r = 0; r < Rows; ++r){
+            std::copy(buffer_out + r * buffer_dim, buffer_out + r * buffer_dim + output_dim, outputs + r * output_dim);
+        }
+    }
+}
+
+template <typename... Layers>
+template <Isa Kind, int Rows>
+void StaticModel<Layers...>::predict_tile(const float* inputs, float* outputs) const{
+    // the activations of a tile only live on the stack
+    alignas(64) float buffer_a[Rows * buffer_dim];
+    alignas(64) float buffer_b[Rows * buffer_dim];
+    run_layers<Kind, Rows, 0>(inputs, input_dim, buffer_a, buffer_b, outputs);
+}
+
+template <typename... Layers>
+template <Isa Kind>
+void StaticModel<Layers...>::predict_rows(const float* inputs, int batch_size, float* outputs) const{
+    int r = 0;
+    for (; r + tile_rows <= batch_size; r += tile_rows){
+        predict_tile<Kind, tile_rows>(inputs + static_cast<std::size_t>(r) * input_dim, outputs + static_cast<std::size_t>(r) * output_dim);
+    }
+    for (; r < batch_size; ++r){
+        predict_tile<Kind, 1>(inputs + static_cast<std::size_t>(r) * input_dim, outputs + static_cast<std::size_t>(r) * output_dim);
+    }
+}
+
+template <typename... Layers>
+void StaticModel<Layers...>::predict(const float* inputs, int batch_size, float* outputs) const{
+    switch (active_isa()){
+        case Isa::avx512: predict_rows<Isa::avx512>(inputs, batch_size, outputs); break;
+        case Isa::avx2: predict_rows<Isa::avx2>(inputs, batch_size, outputs); break;
+        default: predict_rows<Isa::scalar>(inputs, batch_size, outputs);
+    }
+}
+
+template <typename... Layers>
+std::array<float, StaticModel<Layers...>::output_dim> StaticModel<Layers...>::predict(const float* input) const{
+    std::array<float, output_dim> output;
+    predict(input, 1, output.data());
+    return output;
+}
+
+template <typename... Layers>
+std::array<float, StaticModel<Layers...>::output_dim> StaticModel<Layers...>::predict(const std::array<float, input_dim>& input) const{
+    return predict(input.data());
+}
+
+template <typename... Layers>
+Tensor StaticModel<Layers...>::predict(const ConstTensorView inputs) const{
+    if (inputs.cols() != input_dim){
+        throw std::invalid_argument("StaticModel: the input has " + std::to_string(inputs.cols()) + " columns instead of " + std::to_string(input_dim));
+    }
+    Tensor outputs(inputs.rows(), output_dim);
+    if (inputs.is_contiguous()){
+        predict(inputs.data(), inputs.rows(), outputs.data());
+    }
+    else {
+        for (int r = 0; r < inputs.rows(); ++r){
+            predict(inputs.row_data(r), 1, outputs.data() + static_cast<std::size_t>(r) * output_dim);
+        }
+    }
+    return outputs;
+}
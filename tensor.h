@@ -0,0 +1,307 @@
+# pragma once
+
+# include <vector>
+# include <array>
+# include <cstddef>
+# include <cstdlib>
+# include <new>
+# include <stdexcept>
+# include <algorithm>
+# include <type_traits>
+# include <memory>
+
+template <typename T, std::size_t Alignment>
+class AlignedAllocator{
+    /*
+    Allocator returning memory aligned on "Alignment" bytes (a cache line by default for tensors),
+    so that rows start on boundaries the SIMD kernels can load from.
+    */
+    public:
+        using value_type = T;
+
+        template <typename U>
+        struct rebind{
+            using other = AlignedAllocator<U, Alignment>;
+        };
+
+        AlignedAllocator() noexcept {};
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment>&) noexcept {};
+
+        T* allocate(std::size_t n);
+        void deallocate(T* p, std::size_t) noexcept;
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, Alignment>&) const noexcept { return true; }
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, Alignment>&) const noexcept { return false; }
+};
+
+template <typename T, std::size_t Alignment>
+T* AlignedAllocator<T, Alignment>::allocate(std::size_t n){
+    // aligned_alloc requires the size to be a multiple of the alignment
+    std::size_t bytes = ((n * sizeof(T) + Alignment - 1) / Alignment) * Alignment;
+    void* p = std::aligned_alloc(Alignment, bytes == 0 ? Alignment : bytes);
+    if (!p){
+        throw std::bad_alloc();
+    }
+    return static_cast<T*>(p);
+}
+
+template <typename T, std::size_t Alignment>
+void AlignedAllocator<T, Alignment>::deallocate(T* p, std::size_t) noexcept{
+    std::free(p);
+}
+
+const std::size_t TENSOR_ALIGNMENT = 64;
+
+template <typename T>
+class BasicTensorView{
+    /*
+    Non-owning, row-major 2D view: "rows" x "cols" elements, consecutive rows "stride" elements apart.
+    Vectors are represented as 1 x n views. Views are cheap to copy and never allocate.
+    */
+    public:
+        BasicTensorView() : ptr(nullptr), n_rows(0), n_cols(0), row_stride(0) {};
+        BasicTensorView(T* data_, int rows_, int cols_) : ptr(data_), n_rows(rows_), n_cols(cols_), row_stride(cols_) {};
+        BasicTensorView(T* data_, int rows_, int cols_, int stride_) : ptr(data_), n_rows(rows_), n_cols(cols_), row_stride(stride_) {};
+
+        // a view on mutable data can always be used as a view on const data
+        template <typename U, typename = std::enable_if_t<std::is_convertible<U*, T*>::value>>
+        BasicTensorView(const BasicTensorView<U>& other) : ptr(other.data()), n_rows(other.rows()), n_cols(other.cols()), row_stride(other.stride()) {};
+
+        T* data() const { return ptr; }
+        int rows() const { return n_rows; }
+        int cols() const { return n_cols; }
+        int stride() const { return row_stride; }
+        std::array<int, 2> shape() const { return {n_rows, n_cols}; }
+        std::size_t size() const { return static_cast<std::size_t>(n_rows) * n_cols; }
+        bool empty() const { return n_rows == 0 || n_cols == 0; }
+        bool is_contiguous() const { return row_stride == n_cols || n_rows <= 1; }
+
+        T& operator()(int r, int c) const { return ptr[static_cast<std::size_t>(r) * row_stride + c]; }
+        T* row_data(int r) const { return ptr + static_cast<std::size_t>(r) * row_stride; }
+
+        BasicTensorView row(int r) const;
+        BasicTensorView slice_rows(int begin, int end) const;
+        BasicTensorView slice_cols(int begin, int end) const;
+
+    private:
+        T* ptr;
+        int n_rows;
+        int n_cols;
+        int row_stride;
+};
+
+template <typename T>
+BasicTensorView<T> BasicTensorView<T>::row(int r) const{
+    if (r < 0 || r >= n_rows){
+        throw std::out_of_range("Tensor: row index out of range");
+    }
+    return BasicTensorView(row_data(r), 1, n_cols, n_cols);
+}
+
+template <typename T>
+BasicTensorView<T> BasicTensorView<T>::slice_rows(int begin, int end) const{
+    if (begin < 0 || end > n_rows || begin > end){
+        throw std::out_of_range("Tensor: invalid row slice");
+    }
+    return BasicTensorView(row_data(begin), end - begin, n_cols, row_stride);
+}
+
+template <typename T>
+BasicTensorView<T> BasicTensorView<T>::slice_cols(int begin, int end) const{
+    if (begin < 0 || end > n_cols || begin > end){
+        throw std::out_of_range("Tensor: invalid column slice");
+    }
+    return BasicTensorView(ptr + begin, n_rows, end - begin, row_stride);
+}
+
+template <typename T>
+class BasicTensor{
+    /*
+    Owning, contiguous, row-major 2D tensor stored in a single aligned allocation.
+    Converts implicitly to views, which is what every kernel takes as argument.
+    A tensor can also borrow external contiguous storage (e.g. a mapped file), kept alive by "owner";
+    such a tensor cannot be resized, and copying any tensor always gives an owning copy.
+    */
+    public:
+        BasicTensor() : ptr(nullptr), n_rows(0), n_cols(0) {};
+        BasicTensor(int rows_, int cols_);
+        BasicTensor(int rows_, int cols_, T fill_value);
+        BasicTensor(int rows_, int cols_, const std::vector<T>& values_);
+        BasicTensor(const std::vector<std::vector<T>>& nested);
+        explicit BasicTensor(BasicTensorView<const T> other);
+        BasicTensor(const BasicTensor& other);
+        BasicTensor(BasicTensor&& other) noexcept;
+        BasicTensor& operator=(const BasicTensor& other);
+        BasicTensor& operator=(BasicTensor&& other) noexcept;
+
+        // tensor on the contiguous storage of "view", which stays valid as long as "owner" is alive
+        static BasicTensor borrow(BasicTensorView<T> view, std::shared_ptr<const void> owner);
+        bool is_borrowed() const { return owner != nullptr; }
+
+        T* data() { return ptr; }
+        const T* data() const { return ptr; }
+        int rows() const { return n_rows; }
+        int cols() const { return n_cols; }
+        int stride() const { return n_cols; }
+        std::array<int, 2> shape() const { return {n_rows, n_cols}; }
+        std::size_t size() const { return static_cast<std::size_t>(n_rows) * n_cols; }
+        bool empty() const { return size() == 0; }
+
+        T& operator()(int r, int c) { return ptr[static_cast<std::size_t>(r) * n_cols + c]; }
+        const T& operator()(int r, int c) const { return ptr[static_cast<std::size_t>(r) * n_cols + c]; }
+
+        BasicTensorView<T> view() { return BasicTensorView<T>(ptr, n_rows, n_cols); }
+        BasicTensorView<const T> view() const { return BasicTensorView<const T>(ptr, n_rows, n_cols); }
+        operator BasicTensorView<T>() { return view(); }
+        operator BasicTensorView<const T>() const { return view(); }
+
+        BasicTensorView<T> row(int r) { return view().row(r); }
+        BasicTensorView<const T> row(int r) const { return view().row(r); }
+        BasicTensorView<T> slice_rows(int begin, int end) { return view().slice_rows(begin, end); }
+        BasicTensorView<const T> slice_rows(int begin, int end) const { return view().slice_rows(begin, end); }
+
+        void resize(int rows_, int cols_);
+        void fill(T value);
+        std::vector<std::vector<T>> to_vectors() const;
+
+    private:
+        std::vector<T, AlignedAllocator<T, TENSOR_ALIGNMENT>> values;
+        T* ptr;  // values.data(), or the borrowed storage
+        int n_rows;
+        int n_cols;
+        std::shared_ptr<const void> owner;
+};
+
+template <typename T>
+BasicTensor<T>::BasicTensor(int rows_, int cols_) : n_rows(rows_), n_cols(cols_){
+    if (rows_ < 0 || cols_ < 0){
+        throw std::invalid_argument("Tensor: negative dimension");
+    }
+    values.resize(static_cast<std::size_t>(rows_) * cols_);
+    ptr = values.data();
+}
+
+template <typename T>
+BasicTensor<T>::BasicTensor(int rows_, int cols_, T fill_value) : BasicTensor(rows_, cols_){
+    fill(fill_value);
+}
+
+template <typename T>
+BasicTensor<T>::BasicTensor(int rows_, int cols_, const std::vector<T>& values_) : BasicTensor(rows_, cols_){
+    if (values_.size() != size()){
+        throw std::invalid_argument("Tensor: number of values does not match the shape");
+    }
+    std::copy(values_.begin(), values_.end(), ptr);
+}
+
+template <typename T>
+BasicTensor<T>::BasicTensor(const std::vector<std::vector<T>>& nested)
+    : BasicTensor(nested.size(), nested.empty() ? 0 : nested[0].size()){
+    for (int r = 0; r < n_rows; ++r){
+        if (nested[r].size() != n_cols){
+            throw std::invalid_argument("Tensor: all rows must have the same size");
+        }
+        std::copy(nested[r].begin(), nested[r].end(), ptr + static_cast<std::size_t>(r) * n_cols);
+    }
+}
+
+template <typename T>
+BasicTensor<T>::BasicTensor(BasicTensorView<const T> other) : BasicTensor(other.rows(), other.cols()){
+    for (int r = 0; r < n_rows; ++r){
+        std::copy(other.row_data(r), other.row_data(r) + n_cols, ptr + static_cast<std::size_t>(r) * n_cols);
+    }
+}
+
+template <typename T>
+BasicTensor<T>::BasicTensor(const BasicTensor& other) : BasicTensor(other.view()) {}
+
+template <typename T>
+BasicTensor<T>::BasicTensor(BasicTensor&& other) noexcept
+    : values(std::move(other.values)), ptr(other.ptr), n_rows(other.n_rows), n_cols(other.n_cols), owner(std::move(other.owner)){
+    other.ptr = nullptr;
+    other.n_rows = 0;
+    other.n_cols = 0;
+}
+
+template <typename T>
+BasicTensor<T>& BasicTensor<T>::operator=(const BasicTensor& other){
+    if (this != &other){
+        // reuses the current allocation when it is large enough
+        owner.reset();
+        values.assign(other.ptr, other.ptr + other.size());
+        ptr = values.data();
+        n_rows = other.n_rows;
+        n_cols = other.n_cols;
+    }
+    return *this;
+}
+
+template <typename T>
+BasicTensor<T>& BasicTensor<T>::operator=(BasicTensor&& other) noexcept{
+    if (this != &other){
+        values = std::move(other.values);
+        ptr = other.ptr;
+        n_rows = other.n_rows;
+        n_cols = other.n_cols;
+        owner = std::move(other.owner);
+        other.ptr = nullptr;
+        other.n_rows = 0;
+        other.n_cols = 0;
+    }
+    return *this;
+}
+
+template <typename T>
+BasicTensor<T> BasicTensor<T>::borrow(BasicTensorView<T> view, std::shared_ptr<const void> owner_){
+    if (!view.is_contiguous()){
+        throw std::invalid_argument("Tensor: only contiguous storage can be borrowed");
+    }
+    BasicTensor output;
+    output.ptr = view.data();
+    output.n_rows = view.rows();
+    output.n_cols = view.cols();
+    output.owner = std::move(owner_);
+    return output;
+}
+
+template <typename T>
+void BasicTensor<T>::resize(int rows_, int cols_){
+    // keeps the allocation when shrinking, so reusing a tensor across steps does not reallocate
+    if (owner){
+        if (static_cast<std::size_t>(rows_) * cols_ != size()){
+            throw std::logic_error("Tensor: a borrowed tensor cannot be resized");
+        }
+        n_rows = rows_;
+        n_cols = cols_;
+        return;
+    }
+    values.resize(static_cast<std::size_t>(rows_) * cols_);
+    ptr = values.data();
+    n_rows = rows_;
+    n_cols = cols_;
+}
+
+template <typename T>
+void BasicTensor<T>::fill(T value){
+    std::fill(ptr, ptr + size(), value);
+}
+
+template <typename T>
+std::vector<std::vector<T>> BasicTensor<T>::to_vectors() const{
+    std::vector<std::vector<T>> output(n_rows);
+    for (int r = 0; r < n_rows; ++r){
+        output[r].assign(ptr + static_cast<std::size_t>(r) * n_cols, ptr + static_cast<std::size_t>(r + 1) * n_cols);
+    }
+    return output;
+}
+
+using Tensor = BasicTensor<float>;
+using TensorView = BasicTensorView<float>;
+using ConstTensorView = BasicTensorView<const float>;
+
+// integer class labels, one per row
+using LabelTensor = BasicTensor<int>;
+using ConstLabelView = BasicTensorView<const int>;
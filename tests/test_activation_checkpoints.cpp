@@ -0,0 +1,96 @@
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <random>
+#include <cstring>
+#include "model.h"
+#include "layers.h"
+#include "optimizers.h"
+#include "fullyconnected_layer.h"
+
+// Activation checkpointing: one compute_gradients call on a 5 layer model must give the same loss and the same
+// gradients, bit for bit, with any set of checkpoints as without, since the recomputed segments run the same
+// kernels on the same inputs.
+
+class InspectedModel : public Model {
+    public:
+        using Model::Model;
+
+        // loss and gradients of every parameter of one forward and backward pass over the whole batch
+        std::vector<Tensor> gradients(const Tensor& x, const LabelTensor& labels, float& loss) {
+            prepare_shards(1);
+            prepare_workspaces(x.rows());
+            Shard& shard = shards[0];
+            for (std::vector<Tensor>& layer_gradients : shard.gradients) {
+                for (Tensor& gradient : layer_gradients) {
+                    std::fill(gradient.data(), gradient.data() + gradient.size(), 0.f);
+                }
+            }
+            Inputs inputs;
+            inputs.dense = x;
+            Targets targets;
+            targets.labels = labels;
+            shard.workspace.reset();
+            compute_gradients(inputs, targets, shard, 1.f);
+            loss = shard.loss;
+            std::vector<Tensor> output;
+            for (const std::vector<Tensor>& layer_gradients : shard.gradients) {
+                for (const Tensor& gradient : layer_gradients) {
+                    output.emplace_back(ConstTensorView(gradient));
+                }
+            }
+            return output;
+        }
+};
+
+int main() {
+    const int samples = 96;
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+    Tensor x(samples, 16);
+    LabelTensor labels(samples, 1);
+    for (int i = 0; i < samples; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            x(i, j) = distribution(generator);
+        }
+        labels(i, 0) = (x(i, 0) > 0) + 2 * (x(i, 1) > 0);
+    }
+
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.push_back(std::make_unique<FullyConnectedLayer>(16, 32, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(32, 24, true, "sigmoid"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(24, 40, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(40, 20, true, "sigmoid"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(20, 4, false, "identity"));
+    InspectedModel model(std::move(layers), std::make_unique<SGDOptimizer>(0.05, "softmax_crossentropy"));
+    model.set_num_threads(1);
+
+    float reference_loss = 0.f;
+    const std::vector<Tensor> reference = model.gradients(x, labels, reference_loss);
+
+    std::vector<std::vector<int>> checkpoint_sets = {{0}, {1}, {3}, {0, 2}, {1, 3}, {0, 1, 2, 3}};
+    checkpoint_sets.push_back(model.plan_activation_checkpoints(samples, 1e12).checkpoints);
+    int failures = 0;
+    for (const std::vector<int>& checkpoints : checkpoint_sets) {
+        model.set_activation_checkpoints(checkpoints);
+        float loss = 0.f;
+        const std::vector<Tensor> gradients = model.gradients(x, labels, loss);
+        bool same = loss == reference_loss && gradients.size() == reference.size();
+        for (int p = 0; same && p < gradients.size(); ++p) {
+            same = gradients[p].size() == reference[p].size()
+                   && std::memcmp(gradients[p].data(), reference[p].data(), gradients[p].size() * sizeof(float)) == 0;
+        }
+        if (!same) {
+            std::cerr << "gradients with checkpoints {";
+            for (int checkpoint : checkpoints) {
+                std::cerr << " " << checkpoint;
+            }
+            std::cerr << " } differ from those without" << std::endl;
+            failures++;
+        }
+    }
+    if (failures == 0) {
+        std::cout << "activation checkpoints: ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
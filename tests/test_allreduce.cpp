@@ -0,0 +1,96 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "distributed.h"
+
+// Allreduce over both transports, with 2 and 3 ranks forked on this host: every rank must end with the serial sum
+// of the ranks' inputs. Sizes cover n = 0, n < size, n not divisible by size, and (with a small shared memory slot)
+// n larger than the slot. Inputs are small integers, so the sum is exact whatever the reduction order.
+
+const std::size_t SLOT_CAPACITY = 64;  // floats per shared memory slot
+const std::size_t SIZES[] = {0, 1, 2, 7, 64, 100, 1000, 3 * SLOT_CAPACITY + 5};
+
+float input(int rank, std::size_t i) {
+    return static_cast<float>((rank + 1) * static_cast<int>(i % 17) - rank);
+}
+
+// runs in a forked rank; returns the exit status
+int check_rank(Communicator& communicator, const std::string& label) {
+    int failures = 0;
+    for (std::size_t n : SIZES) {
+        std::vector<float> data(n), expected(n, 0.f);
+        for (std::size_t i = 0; i < n; ++i) {
+            data[i] = input(communicator.rank(), i);
+            for (int r = 0; r < communicator.size(); ++r) {
+                expected[i] += input(r, i);
+            }
+        }
+        communicator.allreduce(data.data(), n);
+        if (data != expected) {
+            std::cerr << label << ", rank " << communicator.rank() << ": allreduce of " << n << " values differs from the serial sum" << std::endl;
+            failures++;
+        }
+    }
+    communicator.barrier();
+    return failures == 0 ? 0 : 1;
+}
+
+// forks "size" ranks on "transport" and waits for them; returns the number of ranks that failed
+int run(const std::string& transport, int size, int base_port) {
+    const std::string label = transport + " with " + std::to_string(size) + " ranks";
+    const std::string name = "/classif_nn_test_allreduce_" + std::to_string(getpid());
+    const std::uint64_t job = static_cast<std::uint64_t>(getpid()) << 32 ^ std::chrono::steady_clock::now().time_since_epoch().count();
+    std::vector<std::string> addresses;
+    for (int rank = 0; rank < size; ++rank) {
+        addresses.push_back("127.0.0.1:" + std::to_string(base_port + rank));
+    }
+
+    std::vector<pid_t> children;
+    for (int rank = 0; rank < size; ++rank) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            int status = 1;
+            try {
+                std::unique_ptr<Communicator> communicator;
+                if (transport == "shm") {
+                    communicator = std::make_unique<SharedMemoryCommunicator>(name, rank, size, job, SLOT_CAPACITY, std::chrono::seconds(20));
+                }
+                else {
+                    communicator = std::make_unique<TcpRingCommunicator>(rank, addresses, std::chrono::seconds(20));
+                }
+                status = check_rank(*communicator, label);
+            }
+            catch (const std::exception& error) {
+                std::cerr << label << ", rank " << rank << ": " << error.what() << std::endl;
+            }
+            _exit(status);
+        }
+        children.push_back(pid);
+    }
+    int failures = 0;
+    for (pid_t child : children) {
+        int status = 0;
+        waitpid(child, &status, 0);
+        failures += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    return failures;
+}
+
+int main() {
+    // ports derived from the pid, so that concurrent test runs do not collide
+    const int base_port = 30000 + getpid() % 5000 * 5;
+    int failures = 0;
+    for (const std::string transport : {"shm", "tcp"}) {
+        failures += run(transport, 2, base_port);
+        failures += run(transport, 3, base_port + 2);
+    }
+    if (failures == 0) {
+        std::cout << "allreduce: ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
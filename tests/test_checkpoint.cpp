@@ -0,0 +1,140 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <memory>
+#include <random>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unistd.h>
+#include "model.h"
+#include "layers.h"
+#include "optimizers.h"
+#include "fullyconnected_layer.h"
+#include "checkpoint.h"
+
+// Checkpoints: a model trained with Adam, saved and loaded back in both modes, must predict the same outputs bit
+// for bit and take the same next Adam step (the moments and step counts round-trip); truncated files and files
+// with a wrong magic must be rejected.
+
+Model make_model() {
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.push_back(std::make_unique<FullyConnectedLayer>(12, 24, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(24, 16, true, "sigmoid"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(16, 3, false, "identity"));
+    return Model(std::move(layers), std::make_unique<AdamOptimizer>(0.01, "softmax_crossentropy"));
+}
+
+bool same_tensor(const ConstTensorView a, const ConstTensorView b) {
+    return a.rows() == b.rows() && a.cols() == b.cols() && std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+bool same_parameters(const Model& a, const Model& b) {
+    if (a.get_layers().size() != b.get_layers().size()) {
+        return false;
+    }
+    for (int i = 0; i < a.get_layers().size(); ++i) {
+        std::vector<TensorView> pa = a.get_layers()[i]->parameters(), pb = b.get_layers()[i]->parameters();
+        if (pa.size() != pb.size()) {
+            return false;
+        }
+        for (int p = 0; p < pa.size(); ++p) {
+            if (!same_tensor(pa[p], pb[p])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+std::string read_file(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void write_file(const std::string& path, const std::string& contents) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+}
+
+bool rejected(const std::string& path) {
+    try {
+        load_checkpoint(path, CheckpointLoading::copy);
+    }
+    catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    const int samples = 64;
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+    Tensor x(samples, 12);
+    LabelTensor labels(samples, 1);
+    for (int i = 0; i < samples; ++i) {
+        for (int j = 0; j < 12; ++j) {
+            x(i, j) = distribution(generator);
+        }
+        labels(i, 0) = (x(i, 0) > 0) + (x(i, 1) > 0);
+    }
+
+    // two steps so that the Adam moments and step counts are not at their initial values
+    Model model = make_model();
+    model.training_step(x, labels);
+    model.training_step(x, labels);
+
+    const std::string path = "test_checkpoint_" + std::to_string(getpid()) + ".ckpt";
+    const std::string damaged_path = path + ".damaged";
+    save_checkpoint(model, path);
+
+    int failures = 0;
+    Model copied = load_checkpoint(path, CheckpointLoading::copy);
+    Model mapped = load_checkpoint(path, CheckpointLoading::map);
+    const Tensor expected = model.predict(x);
+    if (!same_tensor(copied.predict(x), expected)) {
+        std::cerr << "copied checkpoint predicts different outputs" << std::endl;
+        failures++;
+    }
+    if (!same_tensor(mapped.predict(x), expected)) {
+        std::cerr << "mapped checkpoint predicts different outputs" << std::endl;
+        failures++;
+    }
+
+    model.training_step(x, labels);
+    copied.training_step(x, labels);
+    mapped.training_step(x, labels);
+    if (!same_parameters(copied, model)) {
+        std::cerr << "copied checkpoint takes a different Adam step" << std::endl;
+        failures++;
+    }
+    if (!same_parameters(mapped, model)) {
+        std::cerr << "mapped checkpoint takes a different Adam step" << std::endl;
+        failures++;
+    }
+
+    const std::string contents = read_file(path);
+    for (std::size_t size : {contents.size() / 2, contents.size() - 1, sizeof(CheckpointHeader) - 1}) {
+        write_file(damaged_path, contents.substr(0, size));
+        if (!rejected(damaged_path)) {
+            std::cerr << "checkpoint truncated to " << size << " bytes was accepted" << std::endl;
+            failures++;
+        }
+    }
+    std::string wrong_magic = contents;
+    wrong_magic[0] ^= 0xff;
+    write_file(damaged_path, wrong_magic);
+    if (!rejected(damaged_path)) {
+        std::cerr << "checkpoint with a wrong magic was accepted" << std::endl;
+        failures++;
+    }
+
+    std::remove(path.c_str());
+    std::remove(damaged_path.c_str());
+    if (failures == 0) {
+        std::cout << "checkpoint round trip: ok" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
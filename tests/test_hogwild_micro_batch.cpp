@@ -0,0 +1,92 @@
+#include <iostream>
+#include <vector>
+#include <memory>
+#include <random>
+#include <cmath>
+#include "model.h"
+#include "layers.h"
+#include "optimizers.h"
+#include "fullyconnected_layer.h"
+
+// Hogwild training with micro-batching: every worker's workspace must stay within the micro-batch size, and with
+// a single worker the weights must match those of Hogwild training on whole batches.
+
+class InspectedModel : public Model {
+    public:
+        using Model::Model;
+
+        // largest workspace a worker used, against the one reserved for a micro-batch
+        bool workspaces_within(int rows) const {
+            const std::size_t reserved = workspace_size(get_activation_checkpoints(), rows);
+            for (const Shard& shard : shards) {
+                if (shard.workspace.peak_usage() > reserved) {
+                    std::cerr << "workspace peak " << shard.workspace.peak_usage() << " > reserved " << reserved << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        }
+};
+
+InspectedModel make_model() {
+    std::vector<std::unique_ptr<Layer>> layers;
+    layers.push_back(std::make_unique<FullyConnectedLayer>(20, 32, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(32, 16, true, "relu"));
+    layers.push_back(std::make_unique<FullyConnectedLayer>(16, 4, false, "identity"));
+    return InspectedModel(std::move(layers), std::make_unique<SGDOptimizer>(0.05, "softmax_crossentropy"));
+}
+
+int main() {
+    const int samples = 256, batch_size = 64, micro_batch_size = 10;
+    std::mt19937 generator(0);
+    std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+    Tensor x(samples, 20);
+    LabelTensor labels(samples, 1);
+    for (int i = 0; i < samples; ++i) {
+        for (int j = 0; j < 20; ++j) {
+            x(i, j) = distribution(generator);
+        }
+        labels(i, 0) = (x(i, 0) > 0) + 2 * (x(i, 1) > 0);
+    }
+
+    HogwildOptions options;
+    options.shuffle = false;
+
+    // both models start from the same weights and run a single worker, so only the micro-batching differs
+    InspectedModel reference = make_model();
+    InspectedModel model = make_model();
+    for (int i = 0; i < model.get_layers().size(); ++i) {
+        std::vector<TensorView> target = model.get_layers()[i]->parameters(), source = reference.get_layers()[i]->parameters();
+        for (int p = 0; p < target.size(); ++p) {
+            std::copy(source[p].data(), source[p].data() + source[p].size(), target[p].data());
+        }
+    }
+    reference.set_num_threads(1);
+    model.set_num_threads(1);
+    reference.fit_hogwild(x, labels, 3, batch_size, options);
+    model.set_micro_batch_size(micro_batch_size);
+    model.fit_hogwild(x, labels, 3, batch_size, options);
+
+    int failures = 0;
+    if (!model.workspaces_within(micro_batch_size)) {
+        std::cerr << "fit_hogwild ignored the micro-batch size" << std::endl;
+        failures++;
+    }
+    float max_difference = 0.f;
+    for (int i = 0; i < model.get_layers().size(); ++i) {
+        std::vector<TensorView> a = model.get_layers()[i]->parameters(), b = reference.get_layers()[i]->parameters();
+        for (int p = 0; p < a.size(); ++p) {
+            for (int k = 0; k < a[p].size(); ++k) {
+                max_difference = std::max(max_difference, std::abs(a[p].data()[k] - b[p].data()[k]));
+            }
+        }
+    }
+    if (max_difference > 1e-5f) {
+        std::cerr << "micro-batched Hogwild weights differ by " << max_difference << std::endl;
+        failures++;
+    }
+    if (failures == 0) {
+        std::cout << "hogwild micro-batching: ok (max weight difference " << max_difference << ")" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
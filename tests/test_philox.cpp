@@ -0,0 +1,92 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include "cpu_dispatch.h"
+#include "thread_pool.h"
+#include "weights_init.h"
+
+// Weight initialization: philox_block must reproduce the Philox4x32-10 known-answer vectors of Random123 (counter
+// words c0..c3 = block low, block high, stream low, stream high; key words = seed low, seed high), the AVX2 and
+// AVX-512 blocks must match the scalar ones, and initialize must give the same buffer on a 3-thread pool as on a
+// single thread, including when two threads initialize concurrently on the shared pool.
+
+struct PhiloxVector{
+    std::uint32_t counter[4];
+    std::uint32_t key[2];
+    std::uint32_t expected[4];
+};
+
+const PhiloxVector PHILOX_VECTORS[] = {
+    {{0x00000000, 0x00000000, 0x00000000, 0x00000000}, {0x00000000, 0x00000000}, {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+    {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff}, {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+    {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0}, {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}
+};
+
+std::uint64_t words(std::uint32_t low, std::uint32_t high) {
+    return static_cast<std::uint64_t>(high) << 32 | low;
+}
+
+bool same_buffer(const Tensor& a, const Tensor& b) {
+    return std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+}
+
+int main() {
+    int failures = 0;
+    for (const PhiloxVector& vector : PHILOX_VECTORS) {
+        std::uint32_t output[4];
+        philox_block(words(vector.counter[0], vector.counter[1]), words(vector.counter[2], vector.counter[3]), words(vector.key[0], vector.key[1]), output);
+        if (std::memcmp(output, vector.expected, sizeof(output)) != 0) {
+            std::cerr << "philox_block does not match the known-answer vector with counter " << std::hex << vector.counter[0] << std::dec << std::endl;
+            failures++;
+        }
+    }
+
+    // an odd number of blocks, crossing the 2^32 boundary of the low counter word, exercises the vector tails
+    const std::uint64_t first_block = 0xfffffff0, stream = 0x123456789, seed = 0xfedcba9876543210;
+    const int num_blocks = 61;
+    std::vector<std::uint32_t> scalar(4 * num_blocks), vectorized(4 * num_blocks);
+    philox_blocks_scalar(first_block, num_blocks, stream, seed, scalar.data());
+    if (active_isa() != Isa::scalar) {
+        philox_blocks_avx2(first_block, num_blocks, stream, seed, vectorized.data());
+        if (vectorized != scalar) {
+            std::cerr << "AVX2 Philox blocks differ from the scalar ones" << std::endl;
+            failures++;
+        }
+    }
+    if (active_isa() == Isa::avx512) {
+        philox_blocks_avx512(first_block, num_blocks, stream, seed, vectorized.data());
+        if (vectorized != scalar) {
+            std::cerr << "AVX-512 Philox blocks differ from the scalar ones" << std::endl;
+            failures++;
+        }
+    }
+
+    // large enough to be filled in parallel, and not a whole number of chunks
+    const int rows = 700, cols = 1001;
+    ThreadPool serial_pool(1), pool(3);
+    for (InitKind kind : {InitKind::he_uniform, InitKind::glorot_normal}) {
+        Initializer initializer;
+        initializer.kind = kind;
+        Tensor reference(rows, cols), parallel(rows, cols), shared_a(rows, cols), shared_b(rows, cols);
+        initialize(reference, initializer, cols, rows, seed, stream, &serial_pool);
+        initialize(parallel, initializer, cols, rows, seed, stream, &pool);
+        std::thread other([&]() { initialize(shared_a, initializer, cols, rows, seed, stream); });
+        initialize(shared_b, initializer, cols, rows, seed, stream);
+        other.join();
+        if (!same_buffer(parallel, reference)) {
+            std::cerr << "initialize on 3 threads differs from a single thread" << std::endl;
+            failures++;
+        }
+        if (!same_buffer(shared_a, reference) || !same_buffer(shared_b, reference)) {
+            std::cerr << "concurrent initialize on the shared pool differs from a single thread" << std::endl;
+            failures++;
+        }
+    }
+
+    if (failures == 0) {
+        std::cout << "philox initialization: ok (" << isa_name(active_isa()) << ")" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
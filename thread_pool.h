@@ -0,0 +1,197 @@
+# pragma once
+
+# include <vector>
+# include <thread>
+# include <mutex>
+# include <condition_variable>
+# include <atomic>
+# include <exception>
+# include <stdexcept>
+# include <algorithm>
+# include <pthread.h>
+# include <sched.h>
+
+class TaskRef{
+    /*
+    Non-owning reference to a callable taking a task index. Unlike std::function it never allocates,
+    so dispatching a lambda with many captures stays allocation free. The callable must outlive the reference.
+    */
+    public:
+        template <typename F>
+        TaskRef(const F& function) : object(&function), invoke([](const void* f, int i){ (*static_cast<const F*>(f))(i); }) {};
+
+        void operator()(int i) const { invoke(object, i); }
+
+    private:
+        const void* object;
+        void (*invoke)(const void*, int);
+};
+
+class ThreadPool{
+    /*
+    Persistent pool of worker threads. Workers are created once and sleep between jobs,
+    so dispatching a job costs a wake-up instead of a thread creation.
+    The calling thread takes part in every job, so a pool of size n runs n tasks at once.
+    When pinning is enabled, thread i is bound to core cores[i] (core i by default). The calling thread, bound to
+    cores[0], gets its previous affinity back when the pool is destroyed, which must then happen on a live thread
+    (normally the one that built the pool).
+    */
+    public:
+        ThreadPool(int num_threads, bool pin_threads = false);
+        ThreadPool(int num_threads, const std::vector<int>& cores);
+        ~ThreadPool();
+
+        int size() const;
+
+        // runs task(i) for every i in [0, num_tasks) and returns once all of them are done
+        void parallel_for(int num_tasks, const TaskRef task);
+
+    protected:
+        void worker_loop(int thread_index);
+        void run_tasks();
+        void pin_current_thread(int core);
+        // core i % number of cores for thread i
+        static std::vector<int> default_cores(int num_threads);
+
+        std::vector<std::thread> workers;
+        std::vector<int> thread_cores;  // written before any worker starts, then only read
+        pthread_t caller;
+        cpu_set_t caller_affinity;      // restored on "caller" when the pool is destroyed, if it was pinned
+
+        std::mutex mutex;
+        std::condition_variable job_ready;
+        std::condition_variable job_done;
+
+        const TaskRef* current_task;
+        int current_num_tasks;
+        std::atomic<int> next_task;
+        int busy_workers;
+        long generation;
+        bool stopping;
+        std::exception_ptr error;
+};
+
+ThreadPool::ThreadPool(int num_threads, bool pin_threads) : ThreadPool(num_threads, pin_threads ? default_cores(num_threads) : std::vector<int>()) {}
+
+std::vector<int> ThreadPool::default_cores(int num_threads){
+    const int num_cores = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> cores;
+    for (int i = 0; i < num_threads; ++i){
+        cores.push_back(i % num_cores);
+    }
+    return cores;
+}
+
+ThreadPool::ThreadPool(int num_threads, const std::vector<int>& cores)
+    : thread_cores(cores), current_task(nullptr), current_num_tasks(0), next_task(0), busy_workers(0), generation(0), stopping(false){
+    if (num_threads < 1){
+        throw std::invalid_argument("ThreadPool: at least one thread is needed");
+    }
+    if (!cores.empty() && cores.size() != num_threads){
+        throw std::invalid_argument("ThreadPool: one core per thread is needed for pinning");
+    }
+    caller = pthread_self();
+    if (!thread_cores.empty()){
+        pthread_getaffinity_np(caller, sizeof(cpu_set_t), &caller_affinity);
+        pin_current_thread(thread_cores[0]);
+    }
+    // thread 0 is the caller
+    for (int i = 1; i < num_threads; ++i){
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    for (std::thread& worker : workers){
+        worker.join();
+    }
+    if (!thread_cores.empty()){
+        pthread_setaffinity_np(caller, sizeof(cpu_set_t), &caller_affinity);
+    }
+}
+
+int ThreadPool::size() const{
+    return workers.size() + 1;
+}
+
+void ThreadPool::pin_current_thread(int core){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+}
+
+void ThreadPool::run_tasks(){
+    for (int i = next_task.fetch_add(1); i < current_num_tasks; i = next_task.fetch_add(1)){
+        try {
+            (*current_task)(i);
+        }
+        catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error){
+                error = std::current_exception();
+            }
+        }
+    }
+}
+
+void ThreadPool::worker_loop(int thread_index){
+    if (!thread_cores.empty()){
+        pin_current_thread(thread_cores[thread_index]);
+    }
+    long seen_generation = 0;
+    while (true){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            job_ready.wait(lock, [&]{return stopping || generation != seen_generation; });
+            if (stopping){
+                return;
+            }
+            seen_generation = generation;
+        }
+
+        run_tasks();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            --busy_workers;
+        }
+        job_done.notify_one();
+    }
+}
+
+void ThreadPool::parallel_for(int num_tasks, const TaskRef task){
+    if (workers.empty() || num_tasks <= 1){
+        for (int i = 0; i < num_tasks; ++i){
+            task(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        current_task = &task;
+        current_num_tasks = num_tasks;
+        next_task = 0;
+        busy_workers = workers.size();
+        error = nullptr;
+        ++generation;
+    }
+    job_ready.notify_all();
+
+    run_tasks();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait(lock, [&]{return busy_workers == 0; });
+    current_task = nullptr;
+    if (error){
+        std::exception_ptr to_throw = error;
+        error = nullptr;
+        std::rethrow_exception(to_throw);
+    }
+}
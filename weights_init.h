@@ -1,43 +1,456 @@
 # pragma once
 
 # include <vector>
-# include <random>
 # include <cmath>
+# include <cstdint>
+# include <cstddef>
 # include <algorithm>
+# include <atomic>
+# include <mutex>
+# include <thread>
+# include <stdexcept>
+# include <immintrin.h>
 
-std::vector<float> vector_fill_init(int input_dim, int output_dim, float value_fill){
-    std::vector<float> output(output_dim, value_fill);
+# include "tensor.h"
+# include "cpu_dispatch.h"
+# include "thread_pool.h"
 
-    return output;
+/*
+Weight initialization on a counter-based random generator (Philox4x32-10, Salmon et al. 2011).
+Element i of a buffer only depends on (seed, stream, i): buffers are filled in parallel, in fixed chunks,
+with the same values whatever the number of threads or the instruction set.
+Without an explicit seed, initializers use the global seed (set_init_seed) and take the next stream,
+so a program that builds its layers in the same order gets the same weights on every run.
+Large buffers are filled on the pool given to initialize or, by default, on a process-wide initialization pool
+(one thread per core, independent of Model::set_num_threads). Threads that initialize concurrently take turns
+on that shared pool.
+*/
+
+enum class InitKind{
+    uniform,         // U(-scale, scale)
+    normal,          // N(0, scale^2)
+    glorot_uniform,  // U(-l, l), l = sqrt(6 / (fan_in + fan_out))
+    glorot_normal,   // N(0, 2 / (fan_in + fan_out))
+    he_uniform,      // U(-l, l), l = sqrt(6 / fan_in)
+    he_normal        // N(0, 2 / fan_in)
+};
+
+struct Initializer{
+    InitKind kind = InitKind::glorot_uniform;
+    float scale = 1.;  // only used by uniform and normal
+};
+
+// ----- Philox4x32-10 -----
+
+const std::uint32_t PHILOX_M0 = 0xD2511F53;
+const std::uint32_t PHILOX_M1 = 0xCD9E8D57;
+const std::uint32_t PHILOX_W0 = 0x9E3779B9;
+const std::uint32_t PHILOX_W1 = 0xBB67AE85;
+const int PHILOX_ROUNDS = 10;
+
+// four random words of block "block" of the stream; the counter is (block, stream), the key the seed
+void philox_block(std::uint64_t block, std::uint64_t stream, std::uint64_t seed, std::uint32_t* output){
+    std::uint32_t c0 = block, c1 = block >> 32, c2 = stream, c3 = stream >> 32;
+    std::uint32_t k0 = seed, k1 = seed >> 32;
+    for (int round = 0; round < PHILOX_ROUNDS; ++round){
+        const std::uint64_t product_0 = static_cast<std::uint64_t>(PHILOX_M0) * c0;
+        const std::uint64_t product_1 = static_cast<std::uint64_t>(PHILOX_M1) * c2;
+        const std::uint32_t next_0 = (product_1 >> 32) ^ c1 ^ k0;
+        const std::uint32_t next_2 = (product_0 >> 32) ^ c3 ^ k1;
+        c1 = product_1;
+        c3 = product_0;
+        c0 = next_0;
+        c2 = next_2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    output[0] = c0;
+    output[1] = c1;
+    output[2] = c2;
+    output[3] = c3;
 }
 
-std::vector<std::vector<float>> matrix_2d_fill_init(int input_dim, int output_dim, float value_fill){
-    std::vector<std::vector<float>> output(input_dim);
-    std::transform(output.begin(), output.end(), output.begin(), [&](std::vector<float>){return vector_fill_init(input_dim, output_dim, value_fill); });
-    return output;
+void philox_blocks_scalar(std::uint64_t first_block, int num_blocks, std::uint64_t stream, std::uint64_t seed, std::uint32_t* output){
+    for (int b = 0; b < num_blocks; ++b){
+        philox_block(first_block + b, stream, seed, output + 4 * b);
+    }
+}
+
+__attribute__((target("avx2")))
+void philox_blocks_avx2(std::uint64_t first_block, int num_blocks, std::uint64_t stream, std::uint64_t seed, std::uint32_t* output){
+    // 8 blocks at once, one per 32 bits lane; the 32 x 32 -> 64 products are done on even and odd lanes separately
+    const __m256i m0 = _mm256_set1_epi64x(PHILOX_M0);
+    const __m256i m1 = _mm256_set1_epi64x(PHILOX_M1);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    alignas(32) std::uint32_t words[4][8];
+    int b = 0;
+    for (; b + 8 <= num_blocks; b += 8){
+        const std::uint64_t block = first_block + b;
+        // the low word may wrap inside the 8 blocks, the high word is then fixed lane by lane
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32(static_cast<std::uint32_t>(block)), lane);
+        __m256i carry = _mm256_cmpgt_epi32(_mm256_xor_si256(_mm256_set1_epi32(block), _mm256_set1_epi32(0x80000000)),
+                                           _mm256_xor_si256(c0, _mm256_set1_epi32(0x80000000)));
+        __m256i c1 = _mm256_sub_epi32(_mm256_set1_epi32(block >> 32), carry);
+        __m256i c2 = _mm256_set1_epi32(static_cast<std::uint32_t>(stream));
+        __m256i c3 = _mm256_set1_epi32(stream >> 32);
+        std::uint32_t k0 = seed, k1 = seed >> 32;
+        for (int round = 0; round < PHILOX_ROUNDS; ++round){
+            const __m256i even_0 = _mm256_mul_epu32(c0, m0);
+            const __m256i odd_0 = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+            const __m256i even_1 = _mm256_mul_epu32(c2, m1);
+            const __m256i odd_1 = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+            const __m256i low_0 = _mm256_blend_epi32(even_0, _mm256_slli_epi64(odd_0, 32), 0xAA);
+            const __m256i high_0 = _mm256_blend_epi32(_mm256_srli_epi64(even_0, 32), odd_0, 0xAA);
+            const __m256i low_1 = _mm256_blend_epi32(even_1, _mm256_slli_epi64(odd_1, 32), 0xAA);
+            const __m256i high_1 = _mm256_blend_epi32(_mm256_srli_epi64(even_1, 32), odd_1, 0xAA);
+            c0 = _mm256_xor_si256(_mm256_xor_si256(high_1, c1), _mm256_set1_epi32(k0));
+            c2 = _mm256_xor_si256(_mm256_xor_si256(high_0, c3), _mm256_set1_epi32(k1));
+            c1 = low_1;
+            c3 = low_0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words[0]), c0);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words[1]), c1);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words[2]), c2);
+        _mm256_store_si256(reinterpret_cast<__m256i*>(words[3]), c3);
+        for (int l = 0; l < 8; ++l){
+            for (int w = 0; w < 4; ++w){
+                output[4 * (b + l) + w] = words[w][l];
+            }
+        }
+    }
+    philox_blocks_scalar(first_block + b, num_blocks - b, stream, seed, output + 4 * b);
+}
+
+__attribute__((target("avx512f")))
+void philox_blocks_avx512(std::uint64_t first_block, int num_blocks, std::uint64_t stream, std::uint64_t seed, std::uint32_t* output){
+    // same as the AVX2 version with 16 blocks at once
+    const __m512i m0 = _mm512_set1_epi64(PHILOX_M0);
+    const __m512i m1 = _mm512_set1_epi64(PHILOX_M1);
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    alignas(64) std::uint32_t words[4][16];
+    int b = 0;
+    for (; b + 16 <= num_blocks; b += 16){
+        const std::uint64_t block = first_block + b;
+        __m512i c0 = _mm512_add_epi32(_mm512_set1_epi32(static_cast<std::uint32_t>(block)), lane);
+        const __mmask16 carry = _mm512_cmplt_epu32_mask(c0, _mm512_set1_epi32(static_cast<std::uint32_t>(block)));
+        __m512i c1 = _mm512_mask_add_epi32(_mm512_set1_epi32(block >> 32), carry, _mm512_set1_epi32(block >> 32), _mm512_set1_epi32(1));
+        __m512i c2 = _mm512_set1_epi32(static_cast<std::uint32_t>(stream));
+        __m512i c3 = _mm512_set1_epi32(stream >> 32);
+        std::uint32_t k0 = seed, k1 = seed >> 32;
+        for (int round = 0; round < PHILOX_ROUNDS; ++round){
+            const __m512i even_0 = _mm512_mul_epu32(c0, m0);
+            const __m512i odd_0 = _mm512_mul_epu32(_mm512_srli_epi64(c0, 32), m0);
+            const __m512i even_1 = _mm512_mul_epu32(c2, m1);
+            const __m512i odd_1 = _mm512_mul_epu32(_mm512_srli_epi64(c2, 32), m1);
+            const __m512i low_0 = _mm512_mask_blend_epi32(0xAAAA, even_0, _mm512_slli_epi64(odd_0, 32));
+            const __m512i high_0 = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even_0, 32), odd_0);
+            const __m512i low_1 = _mm512_mask_blend_epi32(0xAAAA, even_1, _mm512_slli_epi64(odd_1, 32));
+            const __m512i high_1 = _mm512_mask_blend_epi32(0xAAAA, _mm512_srli_epi64(even_1, 32), odd_1);
+            c0 = _mm512_xor_si512(_mm512_xor_si512(high_1, c1), _mm512_set1_epi32(k0));
+            c2 = _mm512_xor_si512(_mm512_xor_si512(high_0, c3), _mm512_set1_epi32(k1));
+            c1 = low_1;
+            c3 = low_0;
+            k0 += PHILOX_W0;
+            k1 += PHILOX_W1;
+        }
+        _mm512_store_si512(words[0], c0);
+        _mm512_store_si512(words[1], c1);
+        _mm512_store_si512(words[2], c2);
+        _mm512_store_si512(words[3], c3);
+        for (int l = 0; l < 16; ++l){
+            for (int w = 0; w < 4; ++w){
+                output[4 * (b + l) + w] = words[w][l];
+            }
+        }
+    }
+    philox_blocks_scalar(first_block + b, num_blocks - b, stream, seed, output + 4 * b);
+}
+
+void philox_blocks(std::uint64_t first_block, int num_blocks, std::uint64_t stream, std::uint64_t seed, std::uint32_t* output){
+    switch (active_isa()){
+        case Isa::avx512: philox_blocks_avx512(first_block, num_blocks, stream, seed, output); break;
+        case Isa::avx2: philox_blocks_avx2(first_block, num_blocks, stream, seed, output); break;
+        default: philox_blocks_scalar(first_block, num_blocks, stream, seed, output);
+    }
+}
+
+// ----- distributions -----
+
+const int INIT_CHUNK = 1 << 14;                 // elements per task, a multiple of 32 (one group of normal pairs)
+const std::size_t INIT_PARALLEL_MIN = 1 << 18;  // smaller buffers are filled by the calling thread
+
+// uniform in [0, 1) with 24 random bits
+float uniform_from_bits(std::uint32_t bits){
+    return (bits >> 8) * (1.f / 16777216.f);
+}
+
+void fill_uniform_chunk(float* output, int n, std::size_t first, float low, float high, std::uint64_t stream, std::uint64_t seed){
+    alignas(64) std::uint32_t bits[INIT_CHUNK];
+    philox_blocks(first / 4, (n + 3) / 4, stream, seed, bits);
+    const float width = high - low;
+    for (int i = 0; i < n; ++i){
+        output[i] = low + width * uniform_from_bits(bits[i]);
+    }
+}
+
+// Box-Muller with polynomial log and sin/cos (Cephes), written with separate multiplies and adds so that
+// the scalar and SIMD versions round identically. Element k of every group of 32 is paired with element k + 16:
+// out[k] = r cos(t), out[k + 16] = r sin(t), r = stddev * sqrt(-2 log(u1)), t = 2 pi u2 - pi.
+
+const int NORMAL_GROUP = 32;
+const float LOG_SQRT_HALF = 0.707106781186547524f;
+const float LOG_P[9] = {7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f, 1.4249322787e-1f,
+                        -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f};
+const float LOG_Q1 = -2.12194440e-4f;
+const float LOG_Q2 = 0.693359375f;
+const float SINCOS_2_OVER_PI = 0.636619772367581343f;
+const float SINCOS_PI_2_HI = 1.5703125f;
+const float SINCOS_PI_2_LO = 4.83826794897e-4f;
+const float SIN_P[3] = {-1.9515295891e-4f, 8.3321608736e-3f, -1.6666654611e-1f};
+const float COS_P[3] = {2.443315711809948e-5f, -1.388731625493765e-3f, 4.166664568298827e-2f};
+const float TWO_PI = 6.28318530717958648f;
+const float PI = 3.14159265358979324f;
+
+void box_muller_pair(std::uint32_t bits_1, std::uint32_t bits_2, float stddev, float& cosine_output, float& sine_output){
+    // log(u1), u1 in (0, 1]
+    const float u1 = ((bits_1 >> 8) + 1) * (1.f / 16777216.f);
+    int exponent;
+    float m = std::frexp(u1, &exponent);
+    if (m < LOG_SQRT_HALF){
+        exponent -= 1;
+        m = m + m - 1.f;
+    }
+    else {
+        m = m - 1.f;
+    }
+    const float z = m * m;
+    float polynomial = LOG_P[0];
+    for (int i = 1; i < 9; ++i){
+        polynomial = polynomial * m + LOG_P[i];
+    }
+    float y = m * z * polynomial;
+    y = y + LOG_Q1 * exponent;
+    y = y - 0.5f * z;
+    const float log_u1 = (m + y) + LOG_Q2 * exponent;
+    const float radius = stddev * std::sqrt(-2.f * log_u1);
+
+    // sin and cos of t in [-pi, pi): t = q * pi / 2 + r, |r| <= pi / 4
+    const float t = TWO_PI * uniform_from_bits(bits_2) - PI;
+    const float q = std::nearbyint(t * SINCOS_2_OVER_PI);
+    const float r = (t - q * SINCOS_PI_2_HI) - q * SINCOS_PI_2_LO;
+    const float r2 = r * r;
+    const float sin_r = r + r * r2 * ((SIN_P[0] * r2 + SIN_P[1]) * r2 + SIN_P[2]);
+    const float cos_r = (1.f - 0.5f * r2) + r2 * r2 * ((COS_P[0] * r2 + COS_P[1]) * r2 + COS_P[2]);
+    const int quadrant = static_cast<int>(q) & 3;
+    const float sine = quadrant == 0 ? sin_r : quadrant == 1 ? cos_r : quadrant == 2 ? -sin_r : -cos_r;
+    const float cosine = quadrant == 0 ? cos_r : quadrant == 1 ? -sin_r : quadrant == 2 ? -cos_r : sin_r;
+
+    cosine_output = radius * cosine;
+    sine_output = radius * sine;
+}
+
+void box_muller_scalar(const std::uint32_t* bits, float* output, int num_groups, float stddev){
+    for (int g = 0; g < num_groups; ++g){
+        const std::uint32_t* group_bits = bits + g * NORMAL_GROUP;
+        float* group_output = output + g * NORMAL_GROUP;
+        for (int k = 0; k < NORMAL_GROUP / 2; ++k){
+            box_muller_pair(group_bits[k], group_bits[k + NORMAL_GROUP / 2], stddev, group_output[k], group_output[k + NORMAL_GROUP / 2]);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+void box_muller_lanes_avx2(__m256i bits_1, __m256i bits_2, __m256 stddev, float* cosine_output, float* sine_output){
+    const __m256 scale_24 = _mm256_set1_ps(1.f / 16777216.f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    const __m256 u1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_srli_epi32(bits_1, 8), _mm256_set1_epi32(1))), scale_24);
+
+    // frexp: mantissa in [0.5, 1), u1 is a normal positive float
+    const __m256i u1_bits = _mm256_castps_si256(u1);
+    __m256 exponent = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(u1_bits, 23), _mm256_set1_epi32(126)));
+    __m256 m = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(u1_bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F000000)));
+    const __m256 small = _mm256_cmp_ps(m, _mm256_set1_ps(LOG_SQRT_HALF), _CMP_LT_OQ);
+    exponent = _mm256_sub_ps(exponent, _mm256_and_ps(small, one));
+    m = _mm256_sub_ps(_mm256_add_ps(m, _mm256_and_ps(small, m)), one);
+    const __m256 z = _mm256_mul_ps(m, m);
+    __m256 polynomial = _mm256_set1_ps(LOG_P[0]);
+    for (int i = 1; i < 9; ++i){
+        polynomial = _mm256_add_ps(_mm256_mul_ps(polynomial, m), _mm256_set1_ps(LOG_P[i]));
+    }
+    __m256 y = _mm256_mul_ps(_mm256_mul_ps(m, z), polynomial);
+    y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_set1_ps(LOG_Q1), exponent));
+    y = _mm256_sub_ps(y, _mm256_mul_ps(_mm256_set1_ps(0.5f), z));
+    const __m256 log_u1 = _mm256_add_ps(_mm256_add_ps(m, y), _mm256_mul_ps(_mm256_set1_ps(LOG_Q2), exponent));
+    const __m256 radius = _mm256_mul_ps(stddev, _mm256_sqrt_ps(_mm256_mul_ps(_mm256_set1_ps(-2.f), log_u1)));
+
+    const __m256 u2 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(bits_2, 8)), scale_24);
+    const __m256 t = _mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(TWO_PI), u2), _mm256_set1_ps(PI));
+    const __m256 q = _mm256_round_ps(_mm256_mul_ps(t, _mm256_set1_ps(SINCOS_2_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    const __m256 r = _mm256_sub_ps(_mm256_sub_ps(t, _mm256_mul_ps(q, _mm256_set1_ps(SINCOS_PI_2_HI))), _mm256_mul_ps(q, _mm256_set1_ps(SINCOS_PI_2_LO)));
+    const __m256 r2 = _mm256_mul_ps(r, r);
+    const __m256 sin_polynomial = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(SIN_P[0]), r2), _mm256_set1_ps(SIN_P[1])), r2), _mm256_set1_ps(SIN_P[2]));
+    const __m256 sin_r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, r2), sin_polynomial));
+    const __m256 cos_polynomial = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(COS_P[0]), r2), _mm256_set1_ps(COS_P[1])), r2), _mm256_set1_ps(COS_P[2]));
+    const __m256 cos_r = _mm256_add_ps(_mm256_sub_ps(one, _mm256_mul_ps(_mm256_set1_ps(0.5f), r2)), _mm256_mul_ps(_mm256_mul_ps(r2, r2), cos_polynomial));
+
+    // quadrant: odd swaps sin and cos, sin is negated in quadrants 2 and 3, cos in quadrants 1 and 2
+    const __m256i quadrant = _mm256_and_si256(_mm256_cvtps_epi32(q), _mm256_set1_epi32(3));
+    const __m256 odd = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+    const __m256 sign_bit = _mm256_set1_ps(-0.f);
+    const __m256 negate_sine = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(quadrant, _mm256_set1_epi32(1))), sign_bit);
+    const __m256 negate_cosine = _mm256_and_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), _mm256_set1_epi32(2))), sign_bit);
+    const __m256 sine = _mm256_xor_ps(_mm256_blendv_ps(sin_r, cos_r, odd), negate_sine);
+    const __m256 cosine = _mm256_xor_ps(_mm256_blendv_ps(cos_r, sin_r, odd), negate_cosine);
+
+    _mm256_storeu_ps(cosine_output, _mm256_mul_ps(radius, cosine));
+    _mm256_storeu_ps(sine_output, _mm256_mul_ps(radius, sine));
+}
+
+__attribute__((target("avx2")))
+void box_muller_avx2(const std::uint32_t* bits, float* output, int num_groups, float stddev){
+    const __m256 stddev_vector = _mm256_set1_ps(stddev);
+    for (int g = 0; g < num_groups; ++g){
+        const std::uint32_t* group_bits = bits + g * NORMAL_GROUP;
+        float* group_output = output + g * NORMAL_GROUP;
+        for (int k = 0; k < NORMAL_GROUP / 2; k += 8){
+            const __m256i bits_1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(group_bits + k));
+            const __m256i bits_2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(group_bits + k + NORMAL_GROUP / 2));
+            box_muller_lanes_avx2(bits_1, bits_2, stddev_vector, group_output + k, group_output + k + NORMAL_GROUP / 2);
+        }
+    }
+}
+
+void box_muller(const std::uint32_t* bits, float* output, int num_groups, float stddev){
+    // AVX-512 machines use the AVX2 version: the transform is cheap next to the generator
+    if (active_isa() == Isa::scalar){
+        box_muller_scalar(bits, output, num_groups, stddev);
+    }
+    else {
+        box_muller_avx2(bits, output, num_groups, stddev);
+    }
+}
+
+void fill_normal_chunk(float* output, int n, std::size_t first, float stddev, std::uint64_t stream, std::uint64_t seed){
+    // chunks start on a group boundary, so the pairing does not depend on how the buffer is split
+    alignas(64) std::uint32_t bits[INIT_CHUNK];
+    const int num_groups = (n + NORMAL_GROUP - 1) / NORMAL_GROUP;
+    philox_blocks(first / 4, num_groups * NORMAL_GROUP / 4, stream, seed, bits);
+    const int full_groups = n / NORMAL_GROUP;
+    box_muller(bits, output, full_groups, stddev);
+    if (full_groups < num_groups){
+        float last_group[NORMAL_GROUP];
+        box_muller(bits + full_groups * NORMAL_GROUP, last_group, 1, stddev);
+        std::copy(last_group, last_group + n - full_groups * NORMAL_GROUP, output + full_groups * NORMAL_GROUP);
+    }
+}
+
+ThreadPool& init_thread_pool(){
+    // created on the first large initialization only
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+    return pool;
+}
+
+// held around every job of init_thread_pool: ThreadPool::parallel_for takes one caller at a time
+std::mutex& init_thread_pool_mutex(){
+    static std::mutex mutex;
+    return mutex;
+}
+
+// fills "output" on "pool", which must not run another job meanwhile, or on the shared initialization pool
+void initialize(const TensorView output, const Initializer& initializer, int fan_in, int fan_out, std::uint64_t seed, std::uint64_t stream, ThreadPool* pool = nullptr){
+    if (!output.is_contiguous()){
+        throw std::invalid_argument("initialize: the output must be contiguous");
+    }
+    if (fan_in <= 0 || fan_out <= 0){
+        throw std::invalid_argument("initialize: fans must be positive");
+    }
+    bool normal = false;
+    float scale = initializer.scale;
+    switch (initializer.kind){
+        case InitKind::uniform: break;
+        case InitKind::normal: normal = true; break;
+        case InitKind::glorot_uniform: scale = std::sqrt(6.f / (fan_in + fan_out)); break;
+        case InitKind::glorot_normal: scale = std::sqrt(2.f / (fan_in + fan_out)); normal = true; break;
+        case InitKind::he_uniform: scale = std::sqrt(6.f / fan_in); break;
+        case InitKind::he_normal: scale = std::sqrt(2.f / fan_in); normal = true; break;
+    }
+
+    float* data = output.data();
+    const std::size_t size = output.size();
+    const int num_chunks = (size + INIT_CHUNK - 1) / INIT_CHUNK;
+    auto fill_chunk = [&](int c){
+        const std::size_t first = static_cast<std::size_t>(c) * INIT_CHUNK;
+        const int n = std::min<std::size_t>(INIT_CHUNK, size - first);
+        if (normal){
+            fill_normal_chunk(data + first, n, first, scale, stream, seed);
+        }
+        else {
+            fill_uniform_chunk(data + first, n, first, -scale, scale, stream, seed);
+        }
+    };
+    if (size >= INIT_PARALLEL_MIN && pool){
+        pool->parallel_for(num_chunks, fill_chunk);
+    }
+    else if (size >= INIT_PARALLEL_MIN){
+        std::lock_guard<std::mutex> lock(init_thread_pool_mutex());
+        init_thread_pool().parallel_for(num_chunks, fill_chunk);
+    }
+    else {
+        for (int c = 0; c < num_chunks; ++c){
+            fill_chunk(c);
+        }
+    }
 }
 
-float glorot_uniform_values(int input_dim, int output_dim){
-    std::random_device rd;
-    std::mt19937 gen(rd());
+// ----- global seed -----
+
+std::atomic<std::uint64_t>& init_seed_state(){
+    static std::atomic<std::uint64_t> seed(0);
+    return seed;
+}
 
-    float lower_limit = -std::sqrt(6) / std::sqrt(input_dim + output_dim);
-    float higher_limit = std::sqrt(6) / std::sqrt(input_dim + output_dim);
+std::atomic<std::uint64_t>& init_stream_state(){
+    static std::atomic<std::uint64_t> stream(0);
+    return stream;
+}
 
-    std::uniform_real_distribution<float> distribution(lower_limit, higher_limit);
+// seed of the initializers called without one; also restarts the streams
+void set_init_seed(std::uint64_t seed){
+    init_seed_state() = seed;
+    init_stream_state() = 0;
+}
 
-    return distribution(gen);
+std::uint64_t get_init_seed(){
+    return init_seed_state();
 }
 
-std::vector<float> vector_glorot_uniform_init(int input_dim, int output_dim){
-    std::vector<float> output(output_dim);
-    std::transform(output.begin(), output.end(), output.begin(), [&](float){return glorot_uniform_values(input_dim, output_dim); });
+std::uint64_t next_init_stream(){
+    return init_stream_state().fetch_add(1);
+}
 
+Tensor initialized_tensor(int rows, int cols, const Initializer& initializer, int fan_in, int fan_out){
+    Tensor output(rows, cols);
+    initialize(output, initializer, fan_in, fan_out, get_init_seed(), next_init_stream());
     return output;
 }
 
-std::vector<std::vector<float>> matrix_2d_glorot_uniform_init(int input_dim, int output_dim){
-    std::vector<std::vector<float>> output(input_dim);
-    std::transform(output.begin(), output.end(), output.begin(), [&](std::vector<float>){return vector_glorot_uniform_init(input_dim, output_dim); });
+Tensor vector_fill_init(int input_dim, int output_dim, float value_fill){
+    Tensor output(1, output_dim, value_fill);
+
     return output;
-}
\ No newline at end of file
+}
+
+Tensor matrix_2d_fill_init(int input_dim, int output_dim, float value_fill){
+    Tensor output(input_dim, output_dim, value_fill);
+    return output;
+}
+
+Tensor vector_glorot_uniform_init(int input_dim, int output_dim){
+    return initialized_tensor(1, output_dim, Initializer(), input_dim, output_dim);
+}
+
+Tensor matrix_2d_glorot_uniform_init(int input_dim, int output_dim){
+    return initialized_tensor(input_dim, output_dim, Initializer(), input_dim, output_dim);
+}
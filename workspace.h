@@ -0,0 +1,91 @@
+# pragma once
+
+# include <vector>
+# include <cstddef>
+# include <algorithm>
+# include <stdexcept>
+
+# include "tensor.h"
+
+class Workspace{
+    /*
+    Step-scoped bump allocator for the temporaries of a training step (layer outputs, activation derivatives,
+    loss and backward signals). Allocations are 64 bytes aligned views into one buffer and are all released
+    together by reset(); nothing is freed individually.
+    The buffer is sized up front with reserve(); if a step needs more, the extra allocations go to overflow
+    blocks and the next reset() grows the buffer to the peak usage, so later steps do not allocate.
+    mark() and rewind() release the allocations made since the mark, for buffers that are only needed during
+    a part of the step (e.g. the segments recomputed by activation checkpointing).
+    */
+    public:
+        Workspace() : used(0), peak(0) {};
+        Workspace(const Workspace&) = delete;
+        Workspace& operator=(const Workspace&) = delete;
+        Workspace(Workspace&&) = default;
+        Workspace& operator=(Workspace&&) = default;
+
+        // number of floats an allocation of rows x cols takes, alignment included
+        static std::size_t allocation_size(int rows, int cols);
+
+        // makes sure "size" floats (a sum of allocation_size) can be allocated without touching the heap
+        void reserve(std::size_t size);
+        TensorView allocate(int rows, int cols);
+        // releases every allocation; views handed out before are invalid afterwards
+        void reset();
+        // releases the allocations made after mark() returned "mark"; overflow blocks are only freed by reset()
+        std::size_t mark() const { return used; }
+        void rewind(std::size_t mark_);
+
+        std::size_t capacity() const { return buffer.size(); }
+        std::size_t peak_usage() const { return peak; }
+
+    private:
+        std::vector<float, AlignedAllocator<float, TENSOR_ALIGNMENT>> buffer;
+        std::vector<std::vector<float, AlignedAllocator<float, TENSOR_ALIGNMENT>>> overflow;
+        std::size_t used;
+        std::size_t peak;
+};
+
+std::size_t Workspace::allocation_size(int rows, int cols){
+    const std::size_t alignment = TENSOR_ALIGNMENT / sizeof(float);
+    return (static_cast<std::size_t>(rows) * cols + alignment - 1) / alignment * alignment;
+}
+
+void Workspace::reserve(std::size_t size){
+    if (size > buffer.size()){
+        // only called between steps: nothing allocated from the old buffer is alive anymore
+        buffer = std::vector<float, AlignedAllocator<float, TENSOR_ALIGNMENT>>(size);
+        used = 0;
+        overflow.clear();
+    }
+}
+
+TensorView Workspace::allocate(int rows, int cols){
+    const std::size_t size = allocation_size(rows, cols);
+    float* data;
+    if (used + size <= buffer.size()){
+        data = buffer.data() + used;
+    }
+    else {
+        overflow.emplace_back(size);
+        data = overflow.back().data();
+    }
+    used += size;
+    peak = std::max(peak, used);
+    return TensorView(data, rows, cols);
+}
+
+void Workspace::rewind(std::size_t mark_){
+    if (mark_ > used){
+        throw std::logic_error("Workspace: rewinding past the current allocations");
+    }
+    used = mark_;
+}
+
+void Workspace::reset(){
+    if (!overflow.empty()){
+        overflow.clear();
+        buffer = std::vector<float, AlignedAllocator<float, TENSOR_ALIGNMENT>>(peak);
+    }
+    used = 0;
+}